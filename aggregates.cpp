@@ -0,0 +1,505 @@
+// aggregates.cpp
+// Released under the MIT License
+
+/* Sums and counts are easy to calculate in a single scan (and in
+parallel), since partial results can simply be added together. The
+aggregates defined within this file share that property: each one
+can be updated one value at a time and merged with a partial result
+from another thread (or from a saved pivot state), so they work with
+every scan_to_multi_pivot() mode.
+
+1. Minimums and maximums are merged by taking the smaller or larger
+of the two values.
+
+2. Variances and standard deviations are calculated via Welford's
+algorithm, which tracks a running mean and sum of squared deviations
+(thus avoiding the precision problems of subtracting a squared sum
+from a sum of squares). Partial results are merged via Chan et al.'s
+pairwise formula. The sample (n - 1) variance is reported.
+
+3. Distinct counts are approximated via a HyperLogLog sketch: each
+value gets hashed, and each of the sketch's registers tracks the
+longest run of leading zeros found among the hashes assigned to it.
+Merging two sketches just requires taking the maximum of each
+register.
+
+4. Quantiles are approximated via a merging t-digest, which groups
+values into weighted centroids. Centroids near the middle of the
+distribution can absorb many values, whereas those near its tails
+only absorb a few, which keeps extreme quantiles accurate. Digests
+are merged by re-clustering the centroids of both.
+
+Aggregates are configured per value field via the value_aggregates
+map within each Pivot_Spec. Each field that requests at least one of
+them receives one Value_Aggregates object per group, and each of these
+objects only updates the members that its field requested; fields
+(and pivot tables) without any additional aggregates don't allocate
+anything or do any extra work. */
+
+#include "aggregates.h"
+#include "binary_io.h"
+#include "csv_output.h"
+#include "pivot_hash_table.h"
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cmath>
+#include <numbers>
+#include <stdexcept>
+
+std::vector<std::string>
+Aggregate_Set::column_names(const std::string &value_field) const {
+  std::vector<std::string> names;
+  if (min) {
+    names.push_back(value_field + "_Min");
+  }
+  if (max) {
+    names.push_back(value_field + "_Max");
+  }
+  if (variance) {
+    names.push_back(value_field + "_Variance");
+  }
+  if (stddev) {
+    names.push_back(value_field + "_StdDev");
+  }
+  if (distinct_count) {
+    names.push_back(value_field + "_Distinct_Count");
+  }
+  for (double q : quantiles) {
+    // Expressing each quantile as a percentile (e.g. 0.999 as P99.9):
+    char percentile[32];
+    auto result = std::to_chars(percentile, percentile + sizeof(percentile),
+                                q * 100, std::chars_format::general, 10);
+    names.push_back(value_field + "_P" +
+                    std::string(percentile, result.ptr));
+  }
+  return names;
+}
+
+// Hyper_Log_Log:
+
+void Hyper_Log_Log::add(double value) {
+  if (registers_.empty()) {
+    registers_.assign(size_t(1) << precision, 0);
+  }
+  // (Adding 0.0 ensures that -0.0 and 0.0 get the same hash.)
+  uint64_t hash = Integer_Hash{}(std::bit_cast<uint64_t>(value + 0.0));
+  // The hash's first bits determine its register; the register then
+  // stores the position of the first 1 bit among the remaining bits.
+  size_t index = hash >> (64 - precision);
+  uint64_t remaining_bits = (hash << precision) | (uint64_t(1) << (precision - 1));
+  uint8_t rank = static_cast<uint8_t>(std::countl_zero(remaining_bits) + 1);
+  registers_[index] = std::max(registers_[index], rank);
+}
+
+void Hyper_Log_Log::merge(const Hyper_Log_Log &other) {
+  if (other.registers_.empty()) {
+    return;
+  }
+  if (registers_.empty()) {
+    registers_ = other.registers_;
+    return;
+  }
+  for (size_t i = 0; i < registers_.size(); i++) {
+    registers_[i] = std::max(registers_[i], other.registers_[i]);
+  }
+}
+
+double Hyper_Log_Log::estimate() const {
+  if (registers_.empty()) {
+    return 0.0;
+  }
+  double register_count = double(registers_.size());
+  double harmonic_sum = 0.0;
+  size_t empty_registers = 0;
+  for (uint8_t rank : registers_) {
+    harmonic_sum += std::ldexp(1.0, -int(rank));
+    empty_registers += (rank == 0);
+  }
+  double alpha = 0.7213 / (1.0 + 1.079 / register_count);
+  double estimate =
+      alpha * register_count * register_count / harmonic_sum;
+  // For small cardinalities, linear counting (based on the number of
+  // registers that are still empty) is more accurate:
+  if ((estimate <= 2.5 * register_count) && (empty_registers > 0)) {
+    estimate = register_count *
+               std::log(register_count / double(empty_registers));
+  }
+  return estimate;
+}
+
+void Hyper_Log_Log::save(Binary_Writer &writer) const {
+  writer.write<uint64_t>(registers_.size());
+  writer.write_bytes(registers_.data(), registers_.size());
+}
+
+void Hyper_Log_Log::load(Binary_Reader &reader) {
+  uint64_t register_count = reader.read<uint64_t>();
+  if ((register_count != 0) && (register_count != (size_t(1) << precision))) {
+    throw std::runtime_error(reader.file_path() +
+                             " contains an invalid HyperLogLog sketch.");
+  }
+  Hyper_Log_Log other;
+  other.registers_.resize(register_count);
+  reader.read_bytes(other.registers_.data(), register_count);
+  merge(other);
+}
+
+// T_Digest:
+
+// The t-digest's k1 scale function (and its inverse), which maps a
+// quantile onto an index that increases most quickly near the tails:
+static double scale_index(double q) {
+  return T_Digest::compression / (2 * std::numbers::pi) *
+         std::asin(2 * q - 1);
+}
+static double scale_quantile(double k) {
+  return (std::sin(std::min(k, T_Digest::compression / 4) * 2 *
+                   std::numbers::pi / T_Digest::compression) +
+          1) /
+         2;
+}
+
+void T_Digest::add(double value) {
+  if (centroids_.empty() && buffer_.empty()) {
+    min_ = value;
+    max_ = value;
+  }
+  min_ = std::min(min_, value);
+  max_ = std::max(max_, value);
+  buffer_.push_back({value, 1.0});
+  if (buffer_.size() >= 8 * compression) {
+    compress();
+  }
+}
+
+void T_Digest::merge(const T_Digest &other) {
+  if (other.centroids_.empty() && other.buffer_.empty()) {
+    return;
+  }
+  if (centroids_.empty() && buffer_.empty()) {
+    min_ = other.min_;
+    max_ = other.max_;
+  }
+  min_ = std::min(min_, other.min_);
+  max_ = std::max(max_, other.max_);
+  buffer_.insert(buffer_.end(), other.centroids_.begin(),
+                 other.centroids_.end());
+  buffer_.insert(buffer_.end(), other.buffer_.begin(), other.buffer_.end());
+  compress();
+}
+
+void T_Digest::compress() {
+  /* Sorting all centroids (including buffered ones) by their means,
+  then merging neighbors for as long as each merged centroid spans no
+  more than one unit of the scale function. */
+  if (buffer_.empty()) {
+    return;
+  }
+  buffer_.insert(buffer_.end(), centroids_.begin(), centroids_.end());
+  std::ranges::sort(buffer_, {}, &Centroid::mean);
+  double total_weight = 0.0;
+  for (const Centroid &centroid : buffer_) {
+    total_weight += centroid.weight;
+  }
+
+  centroids_.clear();
+  Centroid current = buffer_.front();
+  double weight_so_far = 0.0; // The weight of all completed centroids
+  double weight_limit = total_weight * scale_quantile(scale_index(0.0) + 1);
+  for (size_t i = 1; i < buffer_.size(); i++) {
+    const Centroid &next = buffer_[i];
+    if (weight_so_far + current.weight + next.weight <= weight_limit) {
+      current.mean += (next.mean - current.mean) * next.weight /
+                      (current.weight + next.weight);
+      current.weight += next.weight;
+      continue;
+    }
+    centroids_.push_back(current);
+    weight_so_far += current.weight;
+    weight_limit =
+        total_weight *
+        scale_quantile(scale_index(weight_so_far / total_weight) + 1);
+    current = next;
+  }
+  centroids_.push_back(current);
+  buffer_.clear();
+}
+
+double T_Digest::quantile(double q) {
+  compress();
+  if (centroids_.empty()) {
+    return std::numeric_limits<double>::quiet_NaN();
+  }
+  if (centroids_.size() == 1) {
+    return centroids_.front().mean;
+  }
+  double total_weight = 0.0;
+  for (const Centroid &centroid : centroids_) {
+    total_weight += centroid.weight;
+  }
+  // Each centroid's mean is treated as lying at the midpoint of its
+  // weight; values between two midpoints get interpolated linearly,
+  // and values beyond the outermost midpoints get interpolated
+  // towards the minimum or maximum.
+  double target = q * total_weight;
+  const Centroid &first = centroids_.front();
+  if (target < first.weight / 2) {
+    return min_ + (first.mean - min_) * target / (first.weight / 2);
+  }
+  double weight_before = 0.0;
+  for (size_t i = 0; i + 1 < centroids_.size(); i++) {
+    const Centroid &left = centroids_[i];
+    const Centroid &right = centroids_[i + 1];
+    double left_midpoint = weight_before + left.weight / 2;
+    double right_midpoint = weight_before + left.weight + right.weight / 2;
+    if (target <= right_midpoint) {
+      return left.mean + (right.mean - left.mean) *
+                             (target - left_midpoint) /
+                             (right_midpoint - left_midpoint);
+    }
+    weight_before += left.weight;
+  }
+  const Centroid &last = centroids_.back();
+  double last_midpoint = total_weight - last.weight / 2;
+  return last.mean + (max_ - last.mean) *
+                         std::min(1.0, (target - last_midpoint) /
+                                           (last.weight / 2));
+}
+
+void T_Digest::save(Binary_Writer &writer) const {
+  writer.write<double>(min_);
+  writer.write<double>(max_);
+  writer.write<uint64_t>(centroids_.size() + buffer_.size());
+  for (const std::vector<Centroid> *centroids : {&centroids_, &buffer_}) {
+    for (const Centroid &centroid : *centroids) {
+      writer.write<double>(centroid.mean);
+      writer.write<double>(centroid.weight);
+    }
+  }
+}
+
+void T_Digest::load(Binary_Reader &reader) {
+  T_Digest other;
+  other.min_ = reader.read<double>();
+  other.max_ = reader.read<double>();
+  uint64_t centroid_count = reader.read<uint64_t>();
+  for (uint64_t i = 0; i < centroid_count; i++) {
+    double mean = reader.read<double>();
+    double weight = reader.read<double>();
+    other.buffer_.push_back({mean, weight});
+  }
+  merge(other);
+}
+
+// Value_Aggregates:
+
+void Value_Aggregates::add(double value, const Aggregate_Set &set) {
+  if (set.min) {
+    min = std::min(min, value);
+  }
+  if (set.max) {
+    max = std::max(max, value);
+  }
+  if (set.variance || set.stddev) {
+    welford_count++;
+    double delta = value - welford_mean;
+    welford_mean += delta / welford_count;
+    welford_m2 += delta * (value - welford_mean);
+  }
+  if (set.distinct_count) {
+    distinct_values.add(value);
+  }
+  if (!set.quantiles.empty()) {
+    digest.add(value);
+  }
+}
+
+void Value_Aggregates::merge(const Value_Aggregates &other,
+                             const Aggregate_Set &set) {
+  min = std::min(min, other.min);
+  max = std::max(max, other.max);
+  if (other.welford_count > 0) {
+    long combined_count = welford_count + other.welford_count;
+    double delta = other.welford_mean - welford_mean;
+    welford_m2 += other.welford_m2 + delta * delta * welford_count *
+                                         other.welford_count /
+                                         combined_count;
+    welford_mean += delta * other.welford_count / combined_count;
+    welford_count = combined_count;
+  }
+  if (set.distinct_count) {
+    distinct_values.merge(other.distinct_values);
+  }
+  if (!set.quantiles.empty()) {
+    digest.merge(other.digest);
+  }
+}
+
+void Value_Aggregates::write_fields(Csv_Output_Writer &writer,
+                                    const Aggregate_Set &set) {
+  /* Writing each requested aggregate (in the same order as
+  Aggregate_Set::column_names()). Aggregates of groups in which this
+  field had no values will be reported as nan. */
+  constexpr double nan = std::numeric_limits<double>::quiet_NaN();
+  if (set.min) {
+    writer.write_field(min <= max ? min : nan);
+  }
+  if (set.max) {
+    writer.write_field(min <= max ? max : nan);
+  }
+  double variance =
+      (welford_count > 1) ? welford_m2 / (welford_count - 1) : nan;
+  if (set.variance) {
+    writer.write_field(variance);
+  }
+  if (set.stddev) {
+    writer.write_field(std::sqrt(variance));
+  }
+  if (set.distinct_count) {
+    writer.write_field(long(std::llround(distinct_values.estimate())));
+  }
+  for (double q : set.quantiles) {
+    writer.write_field(digest.quantile(q));
+  }
+}
+
+void Value_Aggregates::save(Binary_Writer &writer,
+                            const Aggregate_Set &set) const {
+  writer.write<double>(min);
+  writer.write<double>(max);
+  writer.write<int64_t>(welford_count);
+  writer.write<double>(welford_mean);
+  writer.write<double>(welford_m2);
+  if (set.distinct_count) {
+    distinct_values.save(writer);
+  }
+  if (!set.quantiles.empty()) {
+    digest.save(writer);
+  }
+}
+
+void Value_Aggregates::load(Binary_Reader &reader, const Aggregate_Set &set) {
+  /* Merging the aggregates saved within reader into this object. */
+  Value_Aggregates saved;
+  saved.min = reader.read<double>();
+  saved.max = reader.read<double>();
+  saved.welford_count = reader.read<int64_t>();
+  saved.welford_mean = reader.read<double>();
+  saved.welford_m2 = reader.read<double>();
+  if (set.distinct_count) {
+    saved.distinct_values.load(reader);
+  }
+  if (!set.quantiles.empty()) {
+    saved.digest.load(reader);
+  }
+  merge(saved, set);
+}
+
+// Aggregate_Table:
+
+Aggregate_Table::Aggregate_Table(const std::vector<Aggregate_Set> &sets)
+    : sets_(sets), slots_(sets.size(), -1) {
+  for (size_t vfi = 0; vfi < sets_.size(); vfi++) {
+    for (double q : sets_[vfi].quantiles) {
+      if (!(q >= 0.0 && q <= 1.0)) {
+        throw std::runtime_error(
+            "Quantiles must be between 0 and 1 (e.g. 0.9 for the 90th "
+            "percentile).");
+      }
+    }
+    if (!sets_[vfi].empty()) {
+      slots_[vfi] = static_cast<int>(slot_count_++);
+    }
+  }
+}
+
+void Aggregate_Table::merge_group(size_t group, const Aggregate_Table &source,
+                                  size_t source_group) {
+  // (If the source group never received any values with additional
+  // aggregates, there's nothing to merge.)
+  if (source.values_.size() < (source_group + 1) * slot_count_) {
+    return;
+  }
+  Value_Aggregates *target_values = values(group);
+  const Value_Aggregates *source_values =
+      &source.values_[source_group * slot_count_];
+  for (size_t vfi = 0; vfi < sets_.size(); vfi++) {
+    if (slots_[vfi] >= 0) {
+      target_values[slots_[vfi]].merge(source_values[slots_[vfi]],
+                                       sets_[vfi]);
+    }
+  }
+}
+
+void Aggregate_Table::copy_group(size_t group, const Aggregate_Table &source,
+                                 size_t source_group) {
+  // (Unlike merge_group(), this doesn't recompress the source group's
+  // t-digests, so the copy's quantiles will match the original's.)
+  if (source.values_.size() < (source_group + 1) * slot_count_) {
+    reset_group(group);
+    return;
+  }
+  std::copy_n(&source.values_[source_group * slot_count_], slot_count_,
+              values(group));
+}
+
+size_t Aggregate_Table::approximate_group_bytes() const {
+  // A HyperLogLog sketch is a fixed-size array of registers, while a
+  // t-digest generally ends up with somewhat fewer centroids than its
+  // compression setting (plus whatever is still buffered).
+  size_t group_bytes = slot_count_ * sizeof(Value_Aggregates);
+  for (size_t vfi = 0; vfi < sets_.size(); vfi++) {
+    if (sets_[vfi].distinct_count) {
+      group_bytes += size_t(1) << Hyper_Log_Log::precision;
+    }
+    if (!sets_[vfi].quantiles.empty()) {
+      group_bytes +=
+          static_cast<size_t>(T_Digest::compression) * 2 * sizeof(double);
+    }
+  }
+  return group_bytes;
+}
+
+void Aggregate_Table::write_header(Csv_Output_Writer &writer, size_t vfi,
+                                   const std::string &value_field) const {
+  for (const std::string &name : sets_[vfi].column_names(value_field)) {
+    writer.write_field(name);
+  }
+}
+
+void Aggregate_Table::write_fields(Csv_Output_Writer &writer, size_t group,
+                                   size_t vfi) {
+  if (slots_[vfi] >= 0) {
+    values(group)[slots_[vfi]].write_fields(writer, sets_[vfi]);
+  }
+}
+
+void Aggregate_Table::save_group(Binary_Writer &writer, size_t group) {
+  Value_Aggregates *group_values = values(group);
+  for (size_t vfi = 0; vfi < sets_.size(); vfi++) {
+    if (slots_[vfi] >= 0) {
+      group_values[slots_[vfi]].save(writer, sets_[vfi]);
+    }
+  }
+}
+
+void Aggregate_Table::load_group(Binary_Reader &reader, size_t group) {
+  Value_Aggregates *group_values = values(group);
+  for (size_t vfi = 0; vfi < sets_.size(); vfi++) {
+    if (slots_[vfi] >= 0) {
+      group_values[slots_[vfi]].load(reader, sets_[vfi]);
+    }
+  }
+}
+
+std::string
+Aggregate_Table::description(const std::vector<std::string> &value_fields) const {
+  std::string description;
+  for (size_t vfi = 0; vfi < sets_.size(); vfi++) {
+    for (const std::string &name : sets_[vfi].column_names(value_fields[vfi])) {
+      description += name + ",";
+    }
+  }
+  return description;
+}
@@ -0,0 +1,185 @@
+// aggregates.h
+// Released under the MIT License
+
+// This header defines the optional aggregates (beyond sums, counts,
+// and means) that scan_to_multi_pivot() can calculate for each value
+// field, along with the sketches used to approximate some of them.
+// Documentation on these types is available within aggregates.cpp.
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+class Binary_Reader;
+class Binary_Writer;
+class Csv_Output_Writer;
+
+// The additional aggregates to calculate for one value field. Each
+// one adds its own column(s) to the pivot table's output.
+struct Aggregate_Set {
+  bool min{false};
+  bool max{false};
+  // The sample variance and standard deviation:
+  bool variance{false};
+  bool stddev{false};
+  // An approximate count of the field's distinct values:
+  bool distinct_count{false};
+  // Approximate quantiles to calculate, expressed as fractions
+  // between 0 and 1 (e.g. {0.5, 0.9, 0.99}):
+  std::vector<double> quantiles;
+
+  bool empty() const {
+    return !(min || max || variance || stddev || distinct_count) &&
+           quantiles.empty();
+  }
+  // The output column names for these aggregates (e.g.
+  // "PASSENGERS_Min" or "PASSENGERS_P90"):
+  std::vector<std::string> column_names(const std::string &value_field) const;
+};
+
+// A HyperLogLog sketch, which estimates the number of distinct values
+// that have been added to it.
+class Hyper_Log_Log {
+public:
+  // Each sketch contains 2^precision one-byte registers, resulting in
+  // a typical relative error of about 1.6%.
+  static constexpr int precision = 12;
+
+  void add(double value);
+  void merge(const Hyper_Log_Log &other);
+  double estimate() const;
+  void save(Binary_Writer &writer) const;
+  void load(Binary_Reader &reader);
+
+private:
+  // (This vector stays empty until the first value is added.)
+  std::vector<uint8_t> registers_;
+};
+
+// A merging t-digest, which approximates the distribution of the
+// values that have been added to it (and thus its quantiles).
+class T_Digest {
+public:
+  // Higher values result in more accurate quantiles, but also in more
+  // centroids per digest.
+  static constexpr double compression = 100.0;
+
+  void add(double value);
+  void merge(const T_Digest &other);
+  // Returns the approximate q quantile of this digest's values (or
+  // nan if it's empty).
+  double quantile(double q);
+  void save(Binary_Writer &writer) const;
+  void load(Binary_Reader &reader);
+
+private:
+  struct Centroid {
+    double mean;
+    double weight;
+  };
+  // Merges buffer_ into centroids_.
+  void compress();
+
+  std::vector<Centroid> centroids_;
+  // Values (or centroids from other digests) that haven't been merged
+  // into centroids_ yet:
+  std::vector<Centroid> buffer_;
+  double min_{0.0};
+  double max_{0.0};
+};
+
+// The state of one value field's additional aggregates within one
+// pivot table group. Only the members that the field's Aggregate_Set
+// requests get updated.
+struct Value_Aggregates {
+  double min{std::numeric_limits<double>::infinity()};
+  double max{-std::numeric_limits<double>::infinity()};
+  // Welford's running count, mean, and sum of squared deviations:
+  long welford_count{0};
+  double welford_mean{0.0};
+  double welford_m2{0.0};
+  Hyper_Log_Log distinct_values;
+  T_Digest digest;
+
+  void add(double value, const Aggregate_Set &set);
+  void merge(const Value_Aggregates &other, const Aggregate_Set &set);
+  void write_fields(Csv_Output_Writer &writer, const Aggregate_Set &set);
+  void save(Binary_Writer &writer, const Aggregate_Set &set) const;
+  void load(Binary_Reader &reader, const Aggregate_Set &set);
+};
+
+// Stores the additional aggregates for each group of a pivot table.
+// Groups are identified by the same numbers that the table's hash
+// table (or map) assigns them. Value fields whose Aggregate_Set is
+// empty don't receive any storage, and a table whose value fields
+// don't request any aggregates stores nothing at all.
+class Aggregate_Table {
+public:
+  // sets: one Aggregate_Set per value field. Throws a
+  // std::runtime_error if a quantile lies outside of [0, 1].
+  explicit Aggregate_Table(const std::vector<Aggregate_Set> &sets = {});
+
+  bool enabled() const { return slot_count_ > 0; }
+  const std::vector<Aggregate_Set> &sets() const { return sets_; }
+
+  // Adds value (which belongs to value field vfi) to group's aggregates.
+  void add(size_t group, size_t vfi, double value) {
+    int slot = slots_[vfi];
+    if (slot >= 0) {
+      values(group)[slot].add(value, sets_[vfi]);
+    }
+  }
+  // Merges source_group's aggregates within source (which must have
+  // been created with the same sets) into group's aggregates.
+  void merge_group(size_t group, const Aggregate_Table &source,
+                   size_t source_group);
+  // Replaces group's aggregates with a copy of source_group's.
+  void copy_group(size_t group, const Aggregate_Table &source,
+                  size_t source_group);
+
+  // Writes the header names (or group's values) of value field vfi's
+  // additional output columns.
+  void write_header(Csv_Output_Writer &writer, size_t vfi,
+                    const std::string &value_field) const;
+  void write_fields(Csv_Output_Writer &writer, size_t group, size_t vfi);
+
+  // Saves (or loads) all of group's aggregates.
+  void save_group(Binary_Writer &writer, size_t group);
+  void load_group(Binary_Reader &reader, size_t group);
+  // Describes these aggregates, so that saved groups can be checked
+  // against the current settings before they get loaded:
+  std::string description(const std::vector<std::string> &value_fields) const;
+
+  // Resets group's aggregates to their initial (empty) state.
+  void reset_group(size_t group) {
+    std::fill_n(values(group), slot_count_, Value_Aggregates{});
+  }
+  // Approximates the memory used by each group's aggregates. (Sketches
+  // are counted at their typical rather than their maximum size.)
+  size_t approximate_group_bytes() const;
+
+  // Removes every group, releasing the table's storage.
+  void clear() { values_ = {}; }
+
+private:
+  // Returns the slot_count_ Value_Aggregates objects that belong to
+  // group, first creating them if needed.
+  Value_Aggregates *values(size_t group) {
+    if (values_.size() < (group + 1) * slot_count_) {
+      values_.resize((group + 1) * slot_count_);
+    }
+    return &values_[group * slot_count_];
+  }
+
+  std::vector<Aggregate_Set> sets_;
+  // Each value field's position within a group's Value_Aggregates
+  // objects (or -1 if the field doesn't have any aggregates):
+  std::vector<int> slots_;
+  size_t slot_count_{0};
+  std::vector<Value_Aggregates> values_;
+};
@@ -0,0 +1,123 @@
+// binary_io.h
+// Released under the MIT License
+
+// This header defines Binary_Writer and Binary_Reader, two small
+// helpers for writing and reading the binary files (such as pivot
+// state files) that this project produces. Values are stored in the
+// native byte order of the machine that wrote them, so these files
+// are meant to be reused on the same machine (or on machines with
+// the same architecture) rather than exchanged between platforms.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+class Binary_Writer {
+public:
+  // Output is first written to a temporary file, which only replaces
+  // file_path once finish() gets called; that way, an interrupted
+  // write won't leave a truncated file behind.
+  explicit Binary_Writer(const std::string &file_path)
+      : file_path_(file_path), temp_path_(file_path + ".tmp"),
+        ofs_(temp_path_, std::ios::binary | std::ios::trunc) {
+    if (!ofs_) {
+      throw std::runtime_error("Unable to open " + temp_path_ +
+                               " for writing.");
+    }
+  }
+
+  template <typename T> void write(const T &value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    write_bytes(&value, sizeof(T));
+  }
+  void write_bytes(const void *data, size_t size) {
+    ofs_.write(static_cast<const char *>(data), size);
+    position_ += size;
+  }
+  void write_string(std::string_view text) {
+    write<uint64_t>(text.size());
+    write_bytes(text.data(), text.size());
+  }
+  // Writes zeros until position() reaches offset (which must not be
+  // less than position()).
+  void pad_to(uint64_t offset) {
+    static const char zeros[64] = {};
+    while (position_ < offset) {
+      write_bytes(zeros, std::min<uint64_t>(sizeof(zeros), offset - position_));
+    }
+  }
+  // The number of bytes written so far:
+  uint64_t position() const { return position_; }
+
+  // Closes the temporary file, then moves it to file_path. Throws a
+  // std::runtime_error if any write failed.
+  void finish() {
+    ofs_.close();
+    if (!ofs_) {
+      throw std::runtime_error("Unable to write to " + temp_path_ + ".");
+    }
+    std::filesystem::rename(temp_path_, file_path_);
+  }
+
+private:
+  std::string file_path_;
+  std::string temp_path_;
+  std::ofstream ofs_;
+  uint64_t position_{0};
+};
+
+class Binary_Reader {
+public:
+  explicit Binary_Reader(const std::string &file_path)
+      : file_path_(file_path), ifs_(file_path, std::ios::binary) {
+    if (!ifs_) {
+      throw std::runtime_error("Unable to open " + file_path + ".");
+    }
+    remaining_bytes_ = std::filesystem::file_size(file_path);
+  }
+
+  // These functions throw a std::runtime_error if the file ends
+  // before the requested data could be read.
+  template <typename T> T read() {
+    static_assert(std::is_trivially_copyable_v<T>);
+    T value;
+    read_bytes(&value, sizeof(T));
+    return value;
+  }
+  void read_bytes(void *data, size_t size) {
+    if (size > remaining_bytes_) {
+      throw std::runtime_error(file_path_ + " ended unexpectedly.");
+    }
+    ifs_.read(static_cast<char *>(data), size);
+    if (ifs_.gcount() != static_cast<std::streamsize>(size)) {
+      throw std::runtime_error(file_path_ + " ended unexpectedly.");
+    }
+    remaining_bytes_ -= size;
+  }
+  std::string read_string() {
+    uint64_t size = read<uint64_t>();
+    if (size > remaining_bytes_) {
+      throw std::runtime_error(file_path_ + " ended unexpectedly.");
+    }
+    std::string text(size, '\0');
+    read_bytes(text.data(), text.size());
+    return text;
+  }
+
+  // Returns true once every byte of the file has been read.
+  bool at_end() const { return remaining_bytes_ == 0; }
+  const std::string &file_path() const { return file_path_; }
+
+private:
+  std::string file_path_;
+  std::ifstream ifs_;
+  uint64_t remaining_bytes_{0};
+};
@@ -0,0 +1,263 @@
+// columnar_cache.cpp
+// Released under the MIT License
+
+/* Building a Columnar_Table from a .csv file requires tokenizing every
+row of that file, which can take a while for large datasets (e.g. the
+BTS T-100 extracts); this work then gets repeated every time the
+program starts. The functions within this file allow a table to be
+saved as a binary columnar cache file instead, so that later runs
+can skip the parsing phase entirely.
+
+Each cache file begins with a directory that stores, for each column,
+its name, its type, and the offset at which its data begins. (String
+columns also store their dictionary values in code order, so that the
+dictionary can be rebuilt with the same codes.) The data for each
+column (a uint32_t code or a double per row) is then stored as a
+single contiguous block that begins at a multiple of 8 bytes. When
+loading a cache, the directory gets read normally, and the file is
+then mapped into memory (see mapped_file.h) so that each requested
+column can be copied into its vector as a single block; columns that
+weren't requested aren't read at all.
+
+Each cache also records the size and last modification time of the
+.csv file that it was created from. If either of these has changed
+(or if the cache lacks one of the requested fields or can't be read),
+load_cached_columnar_table() will reload the .csv file and replace
+the cache. As with pivot state files, values are stored in the
+native byte order of the machine that created the cache. */
+
+#include "binary_io.h"
+#include "columnar_table.h"
+#include "mapped_file.h"
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+
+// The first bytes of each cache file: (The final digit is the file
+// format's version number.)
+constexpr std::string_view columnar_cache_magic = "CPTCOLS1";
+
+enum class Cached_Column_Type : uint64_t { string_codes = 0, doubles = 1 };
+
+// Identifies the version of the .csv file from which a cache was
+// created:
+struct Cache_Source_Stamp {
+  uint64_t file_size{0};
+  int64_t modification_time{0};
+
+  bool operator==(const Cache_Source_Stamp &) const = default;
+};
+
+static Cache_Source_Stamp source_stamp(const std::string &data_file_path) {
+  return {std::filesystem::file_size(data_file_path),
+          static_cast<int64_t>(std::filesystem::last_write_time(data_file_path)
+                                   .time_since_epoch()
+                                   .count())};
+}
+
+static uint64_t align_to_8(uint64_t offset) { return (offset + 7) & ~7ull; }
+
+// The size of a string as stored by Binary_Writer::write_string():
+static uint64_t stored_size(std::string_view text) {
+  return sizeof(uint64_t) + text.size();
+}
+
+void save_columnar_cache(const Columnar_Table &table,
+                         const std::string &data_file_path,
+                         const std::string &cache_file_path) {
+  /* Saving table (which should have been loaded from data_file_path)
+  to cache_file_path. The directory's size is calculated first so
+  that the offset of each column's data can be stored within it. */
+  uint64_t directory_size = columnar_cache_magic.size() +
+                            sizeof(Cache_Source_Stamp) +
+                            2 * sizeof(uint64_t); // Row and column counts
+  for (const auto &[field, column] : table.string_columns) {
+    directory_size += stored_size(field) + 3 * sizeof(uint64_t);
+    for (const std::string &value : column.dictionary.values) {
+      directory_size += stored_size(value);
+    }
+  }
+  for (const auto &[field, column] : table.double_columns) {
+    directory_size += stored_size(field) + 2 * sizeof(uint64_t);
+  }
+
+  // Determining where each column's data will begin:
+  std::vector<uint64_t> data_offsets;
+  uint64_t data_offset = align_to_8(directory_size);
+  for (const auto &[field, column] : table.string_columns) {
+    data_offsets.push_back(data_offset);
+    data_offset = align_to_8(data_offset + column.codes.size() *
+                                               sizeof(uint32_t));
+  }
+  for (const auto &[field, column] : table.double_columns) {
+    data_offsets.push_back(data_offset);
+    data_offset = align_to_8(data_offset + column.size() * sizeof(double));
+  }
+
+  Binary_Writer writer(cache_file_path);
+  writer.write_bytes(columnar_cache_magic.data(), columnar_cache_magic.size());
+  writer.write(source_stamp(data_file_path));
+  writer.write<uint64_t>(table.row_count);
+  writer.write<uint64_t>(data_offsets.size());
+  size_t column_index = 0;
+  for (const auto &[field, column] : table.string_columns) {
+    writer.write_string(field);
+    writer.write(Cached_Column_Type::string_codes);
+    writer.write<uint64_t>(data_offsets[column_index++]);
+    writer.write<uint64_t>(column.dictionary.size());
+    for (const std::string &value : column.dictionary.values) {
+      writer.write_string(value);
+    }
+  }
+  for (const auto &[field, column] : table.double_columns) {
+    writer.write_string(field);
+    writer.write(Cached_Column_Type::doubles);
+    writer.write<uint64_t>(data_offsets[column_index++]);
+  }
+  if (writer.position() != directory_size) {
+    throw std::logic_error("The columnar cache directory's size was "
+                           "calculated incorrectly.");
+  }
+
+  column_index = 0;
+  for (const auto &[field, column] : table.string_columns) {
+    writer.pad_to(data_offsets[column_index++]);
+    writer.write_bytes(column.codes.data(),
+                       column.codes.size() * sizeof(uint32_t));
+  }
+  for (const auto &[field, column] : table.double_columns) {
+    writer.pad_to(data_offsets[column_index++]);
+    writer.write_bytes(column.data(), column.size() * sizeof(double));
+  }
+  writer.finish();
+}
+
+// A column's entry within a cache file's directory:
+struct Cached_Column {
+  Cached_Column_Type type;
+  uint64_t data_offset;
+  std::vector<std::string> dictionary_values;
+};
+
+static std::optional<Columnar_Table>
+load_columnar_cache(const std::string &data_file_path,
+                    const std::vector<std::string> &string_fields,
+                    const std::vector<std::string> &double_fields,
+                    const std::string &cache_file_path) {
+  /* Loading the requested fields from cache_file_path. Returns an
+  empty optional if the cache is out of date or lacks one of these
+  fields; throws a std::runtime_error if the cache is corrupt. */
+  Binary_Reader reader(cache_file_path);
+  std::string magic(columnar_cache_magic.size(), '\0');
+  reader.read_bytes(magic.data(), magic.size());
+  if (magic != columnar_cache_magic) {
+    throw std::runtime_error(cache_file_path +
+                             " is not a columnar cache file.");
+  }
+  if (reader.read<Cache_Source_Stamp>() != source_stamp(data_file_path)) {
+    return std::nullopt;
+  }
+  Columnar_Table table;
+  table.row_count = reader.read<uint64_t>();
+  uint64_t column_count = reader.read<uint64_t>();
+  std::map<std::string, Cached_Column> directory;
+  for (uint64_t column = 0; column < column_count; column++) {
+    std::string field = reader.read_string();
+    Cached_Column &entry = directory[field];
+    entry.type = reader.read<Cached_Column_Type>();
+    entry.data_offset = reader.read<uint64_t>();
+    if (entry.type == Cached_Column_Type::string_codes) {
+      uint64_t dictionary_size = reader.read<uint64_t>();
+      for (uint64_t code = 0; code < dictionary_size; code++) {
+        entry.dictionary_values.push_back(reader.read_string());
+      }
+    }
+  }
+
+  // Each column's data will be copied directly out of the mapped file.
+  Mapped_File mapped_file(cache_file_path);
+  std::string_view file_data = mapped_file.data();
+  // Returns field's directory entry (after checking that its data lies
+  // within the file), or nullptr if the cache doesn't contain a column
+  // of this type for field.
+  auto column_data = [&](const std::string &field, Cached_Column_Type type,
+                         size_t value_size) -> const Cached_Column * {
+    auto entry_it = directory.find(field);
+    if ((entry_it == directory.end()) || (entry_it->second.type != type)) {
+      return nullptr;
+    }
+    if ((entry_it->second.data_offset > file_data.size()) ||
+        ((file_data.size() - entry_it->second.data_offset) / value_size <
+         table.row_count)) {
+      throw std::runtime_error(cache_file_path + " ended unexpectedly.");
+    }
+    return &entry_it->second;
+  };
+
+  for (const std::string &field : string_fields) {
+    const Cached_Column *entry =
+        column_data(field, Cached_Column_Type::string_codes, sizeof(uint32_t));
+    if (!entry) {
+      return std::nullopt;
+    }
+    String_Column &column = table.string_columns[field];
+    for (const std::string &value : entry->dictionary_values) {
+      column.dictionary.encode(value);
+    }
+    column.codes.resize(table.row_count);
+    std::memcpy(column.codes.data(), file_data.data() + entry->data_offset,
+                table.row_count * sizeof(uint32_t));
+    for (uint32_t code : column.codes) {
+      if (code >= column.dictionary.size()) {
+        throw std::runtime_error(cache_file_path + " contains an invalid "
+                                 "code within its " + field + " column.");
+      }
+    }
+  }
+  for (const std::string &field : double_fields) {
+    const Cached_Column *entry =
+        column_data(field, Cached_Column_Type::doubles, sizeof(double));
+    if (!entry) {
+      return std::nullopt;
+    }
+    std::vector<double> &column = table.double_columns[field];
+    column.resize(table.row_count);
+    std::memcpy(column.data(), file_data.data() + entry->data_offset,
+                table.row_count * sizeof(double));
+  }
+  return table;
+}
+
+Columnar_Table
+load_cached_columnar_table(std::string &data_file_path,
+                           std::vector<std::string> &string_fields,
+                           std::vector<std::string> &double_fields,
+                           const std::string &cache_file_path) {
+  /* Loading the requested fields from cache_file_path if it's up to
+  date; otherwise, loading them from data_file_path (via
+  load_columnar_table()) and then saving them to cache_file_path for
+  use by later runs. (Rebuild notices go to stderr, so that they never
+  get mixed into output that a caller such as pivot_server sends to
+  stdout.) */
+  if (std::filesystem::exists(cache_file_path)) {
+    try {
+      std::optional<Columnar_Table> cached_table = load_columnar_cache(
+          data_file_path, string_fields, double_fields, cache_file_path);
+      if (cached_table) {
+        return std::move(*cached_table);
+      }
+      std::cerr << cache_file_path << " is out of date and will be "
+                << "rebuilt.\n";
+    } catch (const std::runtime_error &error) {
+      // (Since the cache can always be recreated, a corrupt cache
+      // doesn't need to stop the program.)
+      std::cerr << error.what() << " The cache will be rebuilt.\n";
+    }
+  }
+  Columnar_Table table =
+      load_columnar_table(data_file_path, string_fields, double_fields);
+  save_columnar_cache(table, data_file_path, cache_file_path);
+  return table;
+}
@@ -0,0 +1,99 @@
+// columnar_table.cpp
+// Released under the MIT License
+
+/* This file defines functions for creating and accessing
+Columnar_Table objects. These tables serve as a more compact
+alternative to the std::vector<std::map<std::string,
+std::variant<std::string, double>>> table_rows format used by the
+original version of in_memory_pivot().
+
+Within that format, every row contains its own map (with its own
+copies of each field name), and every value access requires both a
+map lookup and a variant type check. A Columnar_Table instead stores
+each double-typed field as a single std::vector<double> and each
+string-typed field as a dictionary-encoded String_Column. Since
+fields like CARRIER and ORIGIN contain relatively few distinct
+values, each row of a String_Column only needs to store a 4-byte
+code; this reduces RAM usage considerably and allows in_memory_pivot()
+to read through each column sequentially. */
+
+#include "columnar_table.h"
+#include "csv.hpp"
+#include <limits>
+#include <stdexcept>
+
+using namespace csv;
+
+const String_Column &
+Columnar_Table::string_column(const std::string &field) const {
+  auto column_it = string_columns.find(field);
+  if (column_it == string_columns.end()) {
+    throw std::runtime_error("This table does not contain a string column "
+                             "named " + field + ".");
+  }
+  return column_it->second;
+}
+
+const std::vector<double> &
+Columnar_Table::double_column(const std::string &field) const {
+  auto column_it = double_columns.find(field);
+  if (column_it == double_columns.end()) {
+    throw std::runtime_error("This table does not contain a double column "
+                             "named " + field + ".");
+  }
+  return column_it->second;
+}
+
+Columnar_Table load_columnar_table(std::string &data_file_path,
+                                   std::vector<std::string> &string_fields,
+                                   std::vector<std::string> &double_fields) {
+  /* Reading the specified string and double fields within a .csv file
+  into a Columnar_Table.
+
+  string_fields: Fields that will be stored as dictionary-encoded
+  String_Column objects. (These will generally be the fields that you
+  plan to use as pivot indexes or filters.)
+
+  double_fields: Fields that will be stored as std::vector<double>
+  columns. (These will generally be your value fields.) Blank values
+  are stored as nan, so that in_memory_pivot() can filter them out
+  (or in) via Range_Test::not_null (or is_null).
+  */
+  Columnar_Table table;
+  CSVReader reader(data_file_path);
+
+  // Resolving each field's column position (and the column that it
+  // will be stored in) ahead of time so that these lookups don't need
+  // to be repeated for every row:
+  auto column_index = [&](const std::string &field) -> int {
+    int index = reader.index_of(field);
+    if (index == CSV_NOT_FOUND) {
+      throw std::runtime_error(field + " is not present within " +
+                               data_file_path + ".");
+    }
+    return index;
+  };
+  std::vector<std::pair<int, String_Column *>> string_targets;
+  for (std::string &string_field : string_fields) {
+    string_targets.emplace_back(column_index(string_field),
+                                &table.string_columns[string_field]);
+  }
+  std::vector<std::pair<int, std::vector<double> *>> double_targets;
+  for (std::string &double_field : double_fields) {
+    double_targets.emplace_back(column_index(double_field),
+                                &table.double_columns[double_field]);
+  }
+
+  for (CSVRow &row : reader) {
+    for (auto &[index, column] : string_targets) {
+      column->push_back(row[index].get_sv());
+    }
+    for (auto &[index, column] : double_targets) {
+      column->push_back(row[index].get_sv().empty()
+                            ? std::numeric_limits<double>::quiet_NaN()
+                            : row[index].get<double>());
+    }
+    table.row_count++;
+  }
+  return table;
+}
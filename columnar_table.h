@@ -0,0 +1,87 @@
+// columnar_table.h
+// Released under the MIT License
+
+// This header defines Columnar_Table, an in-memory table that stores
+// each field as its own contiguous column (rather than storing each
+// row as a map of field names to values). Documentation on these
+// types and functions is available within columnar_table.cpp.
+
+#pragma once
+
+#include "dictionary_encoding.h"
+#include "pivot_compressors.h"
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A dictionary-encoded string column: each distinct value is stored
+// only once (within dictionary), and each row stores the small
+// integer code that corresponds to its value.
+struct String_Column {
+  String_Dictionary dictionary;
+  std::vector<uint32_t> codes;
+
+  // Adds a row containing value to the column, first adding value to
+  // the dictionary if it hasn't been encountered yet.
+  void push_back(std::string_view value) {
+    codes.push_back(dictionary.encode(value));
+  }
+  const std::string &value(size_t row) const {
+    return dictionary.values[codes[row]];
+  }
+};
+
+struct Columnar_Table {
+  size_t row_count{0};
+  std::map<std::string, String_Column> string_columns;
+  std::map<std::string, std::vector<double>> double_columns;
+
+  // These functions throw a std::runtime_error if the table doesn't
+  // contain the requested column.
+  const String_Column &string_column(const std::string &field) const;
+  const std::vector<double> &double_column(const std::string &field) const;
+};
+
+Columnar_Table load_columnar_table(std::string &data_file_path,
+                                   std::vector<std::string> &string_fields,
+                                   std::vector<std::string> &double_fields);
+
+// Saves table (which should have been loaded from data_file_path) to a
+// binary columnar cache file. (Documentation on these cache files is
+// available within columnar_cache.cpp.)
+void save_columnar_cache(const Columnar_Table &table,
+                         const std::string &data_file_path,
+                         const std::string &cache_file_path);
+
+// Loads the specified fields from cache_file_path if this cache is up
+// to date with data_file_path; otherwise, loads them from
+// data_file_path and then saves them to cache_file_path.
+Columnar_Table
+load_cached_columnar_table(std::string &data_file_path,
+                           std::vector<std::string> &string_fields,
+                           std::vector<std::string> &double_fields,
+                           const std::string &cache_file_path);
+
+// An in_memory_pivot() overload that processes a Columnar_Table; its
+// arguments and output are otherwise identical to those of the
+// original version. (The definition of this function is found within
+// pivot_compressors.cpp.)
+std::map<std::string, std::map<std::string, Pivot_Vals>> in_memory_pivot(
+    const Columnar_Table &table, std::vector<std::string> &index_fields,
+    std::vector<std::string> &value_fields, bool save_to_csv,
+    std::string &pivot_file_path,
+    std::map<std::string, std::vector<std::string>> &string_include_map,
+    std::map<std::string, std::vector<std::string>> &string_exclude_map,
+    std::map<std::string, std::vector<double>> &double_include_map,
+    std::map<std::string, std::vector<double>> &double_exclude_map,
+    Pivot_Backend backend = Pivot_Backend::ordered_map,
+    int output_precision = 6, int thread_count = 1,
+    Pivot_Stats *stats = nullptr, bool log_to_stdout = true,
+    const std::vector<Pivot_Rollup> &rollups = {},
+    Pivot_Columns *columns = nullptr,
+    const Pivot_Selection &selection = {},
+    const std::vector<Double_Range_Filter> &double_range_filters = {},
+    Missing_Value_Policy missing_values = Missing_Value_Policy::error,
+    std::string *csv_output = nullptr);
@@ -0,0 +1,235 @@
+// compressed_input.cpp
+// Released under the MIT License
+
+/* The BTS archives are often kept compressed, and decompressing one to
+disk before scanning it doubles both the storage it requires and the
+I/O needed to pivot it. A Decompressing_Reader instead decompresses the
+file as it gets read, a block at a time, so only the compressed bytes
+ever need to be read from storage. (Since .csv files tend to compress
+by a factor of 5-10, this can make a scan faster overall on hosts
+whose storage is slower than their decompressor.)
+
+The format is identified by the file's magic number rather than its
+extension: gzip files begin with 1f 8b, and zstd frames begin with
+28 b5 2f fd. Files that contain several gzip members or zstd frames
+(such as those produced by pigz, bgzip, or pzstd, or by concatenating
+compressed files) are decompressed one member or frame after another,
+as if they had been decompressed separately and then concatenated.
+
+gzip support requires zlib, and zstd support requires libzstd; the
+CMake build enables each one (via CPP_PT_HAVE_ZLIB and
+CPP_PT_HAVE_ZSTD) when that library is found. Opening a file whose
+format wasn't enabled throws a std::runtime_error. */
+
+#include "compressed_input.h"
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+
+#ifdef CPP_PT_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef CPP_PT_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+// The number of compressed bytes that get read from the file at a time:
+constexpr size_t compressed_block_bytes = 1024 * 1024;
+
+Input_Compression detect_compression(const std::string &file_path) {
+  std::ifstream file(file_path, std::ios::binary);
+  if (!file) {
+    throw std::runtime_error("Unable to open " + file_path);
+  }
+  std::array<unsigned char, 4> magic{};
+  file.read(reinterpret_cast<char *>(magic.data()), magic.size());
+  size_t magic_size = file.gcount();
+  if ((magic_size >= 2) && (magic[0] == 0x1f) && (magic[1] == 0x8b)) {
+    return Input_Compression::gzip;
+  }
+  if ((magic_size == 4) && (magic[0] == 0x28) && (magic[1] == 0xb5) &&
+      (magic[2] == 0x2f) && (magic[3] == 0xfd)) {
+    return Input_Compression::zstd;
+  }
+  return Input_Compression::none;
+}
+
+Decompressing_Reader::Decompressing_Reader(const std::string &file_path)
+    : file_path_(file_path), file_(file_path, std::ios::binary),
+      compression_(detect_compression(file_path)) {
+  if (!file_) {
+    throw std::runtime_error("Unable to open " + file_path);
+  }
+  if (compression_ == Input_Compression::none) {
+    return;
+  }
+  input_.resize(compressed_block_bytes);
+  if (compression_ == Input_Compression::gzip) {
+#ifdef CPP_PT_HAVE_ZLIB
+    gzip_stream_ = new z_stream{};
+    // (Adding 16 to the window size tells zlib to expect a gzip
+    // header and trailer rather than a raw zlib stream.)
+    if (inflateInit2(gzip_stream_, 15 + 16) != Z_OK) {
+      delete gzip_stream_;
+      throw std::runtime_error("Unable to initialize zlib for " + file_path);
+    }
+#else
+    throw std::runtime_error(file_path + " is compressed via gzip, but this "
+                             "build doesn't include zlib.");
+#endif
+  } else {
+#ifdef CPP_PT_HAVE_ZSTD
+    zstd_context_ = ZSTD_createDCtx();
+    if (zstd_context_ == nullptr) {
+      throw std::runtime_error("Unable to initialize zstd for " + file_path);
+    }
+#else
+    throw std::runtime_error(file_path + " is compressed via zstd, but this "
+                             "build doesn't include libzstd.");
+#endif
+  }
+}
+
+Decompressing_Reader::~Decompressing_Reader() {
+#ifdef CPP_PT_HAVE_ZLIB
+  if (gzip_stream_ != nullptr) {
+    inflateEnd(gzip_stream_);
+    delete gzip_stream_;
+  }
+#endif
+#ifdef CPP_PT_HAVE_ZSTD
+  if (zstd_context_ != nullptr) {
+    ZSTD_freeDCtx(zstd_context_);
+  }
+#endif
+}
+
+bool Decompressing_Reader::fill_input() {
+  if (input_position_ < input_size_) {
+    return true;
+  }
+  file_.read(input_.data(), input_.size());
+  input_size_ = file_.gcount();
+  input_position_ = 0;
+  bytes_read_ += input_size_;
+  return input_size_ > 0;
+}
+
+size_t Decompressing_Reader::read(char *buffer, size_t size) {
+  if (finished_ || (size == 0)) {
+    return 0;
+  }
+  if (compression_ == Input_Compression::none) {
+    file_.read(buffer, size);
+    size_t bytes_copied = file_.gcount();
+    bytes_read_ += bytes_copied;
+    finished_ = (bytes_copied < size);
+    return bytes_copied;
+  }
+  return (compression_ == Input_Compression::gzip) ? read_gzip(buffer, size)
+                                                   : read_zstd(buffer, size);
+}
+
+size_t Decompressing_Reader::read_gzip(char *buffer, size_t size) {
+#ifdef CPP_PT_HAVE_ZLIB
+  /* Inflating input_ into buffer until buffer is full or the file
+  ends. Each time a gzip member ends, the stream gets reset so that
+  any following member will be decompressed as well. */
+  size_t bytes_copied = 0;
+  while (bytes_copied < size) {
+    // (Once the file has been read in its entirety, the current member
+    // may still have output to flush.)
+    bool has_input = fill_input();
+    if (!has_input && !within_frame_) {
+      finished_ = true;
+      break;
+    }
+    gzip_stream_->next_in =
+        reinterpret_cast<Bytef *>(input_.data() + input_position_);
+    gzip_stream_->avail_in = static_cast<uInt>(input_size_ - input_position_);
+    gzip_stream_->next_out = reinterpret_cast<Bytef *>(buffer + bytes_copied);
+    gzip_stream_->avail_out = static_cast<uInt>(
+        std::min<size_t>(size - bytes_copied, UINT32_MAX));
+    uInt available_out = gzip_stream_->avail_out;
+    int result = inflate(gzip_stream_, Z_NO_FLUSH);
+    if ((result != Z_OK) && (result != Z_STREAM_END) &&
+        (result != Z_BUF_ERROR)) {
+      throw std::runtime_error(file_path_ + " contains corrupt gzip data.");
+    }
+    input_position_ = input_size_ - gzip_stream_->avail_in;
+    bytes_copied += available_out - gzip_stream_->avail_out;
+    if (!has_input && (available_out == gzip_stream_->avail_out)) {
+      throw std::runtime_error(file_path_ + " ends partway through a "
+                               "gzip member.");
+    }
+    within_frame_ = (result != Z_STREAM_END);
+    if (result == Z_STREAM_END) {
+      inflateReset(gzip_stream_);
+    }
+  }
+  return bytes_copied;
+#else
+  // (The constructor rejects compressed files in builds without this
+  // library, so this branch is never reached.)
+  (void)buffer;
+  (void)size;
+  return 0;
+#endif
+}
+
+size_t Decompressing_Reader::read_zstd(char *buffer, size_t size) {
+#ifdef CPP_PT_HAVE_ZSTD
+  /* Decompressing input_ into buffer until buffer is full or the file
+  ends. (ZSTD_decompressStream() moves on to the next frame by itself;
+  it returns 0 whenever a frame has been completely decoded.) */
+  ZSTD_outBuffer output{buffer, size, 0};
+  while (output.pos < output.size) {
+    bool has_input = fill_input();
+    if (!has_input && !within_frame_) {
+      finished_ = true;
+      break;
+    }
+    ZSTD_inBuffer input{input_.data(), input_size_, input_position_};
+    size_t previous_output = output.pos;
+    size_t result = ZSTD_decompressStream(zstd_context_, &output, &input);
+    if (ZSTD_isError(result)) {
+      throw std::runtime_error(file_path_ + " contains corrupt zstd data (" +
+                               ZSTD_getErrorName(result) + ").");
+    }
+    input_position_ = input.pos;
+    if (!has_input && (output.pos == previous_output)) {
+      throw std::runtime_error(file_path_ + " ends partway through a "
+                               "zstd frame.");
+    }
+    within_frame_ = (result != 0);
+  }
+  return output.pos;
+#else
+  // (The constructor rejects compressed files in builds without this
+  // library, so this branch is never reached.)
+  (void)buffer;
+  (void)size;
+  return 0;
+#endif
+}
+
+// The number of decompressed bytes that a Decompressing_Streambuf
+// requests from its reader at a time:
+constexpr size_t streambuf_bytes = 256 * 1024;
+
+Decompressing_Streambuf::Decompressing_Streambuf(Decompressing_Reader &reader)
+    : reader_(reader), buffer_(streambuf_bytes) {
+  setg(buffer_.data(), buffer_.data(), buffer_.data());
+}
+
+Decompressing_Streambuf::int_type Decompressing_Streambuf::underflow() {
+  if (gptr() < egptr()) {
+    return traits_type::to_int_type(*gptr());
+  }
+  size_t bytes_copied = reader_.read(buffer_.data(), buffer_.size());
+  setg(buffer_.data(), buffer_.data(), buffer_.data() + bytes_copied);
+  if (bytes_copied == 0) {
+    return traits_type::eof();
+  }
+  return traits_type::to_int_type(*gptr());
+}
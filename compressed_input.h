@@ -0,0 +1,86 @@
+// compressed_input.h
+// Released under the MIT License
+
+// This header defines Decompressing_Reader, which streams the
+// decompressed contents of a gzip or zstd file (or, for uncompressed
+// files, the file's own contents), along with a std::streambuf that
+// allows a CSVReader to read through one. Documentation on these
+// classes is available within compressed_input.cpp.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+// (These are the underlying types of zlib's z_stream and zstd's
+// ZSTD_DCtx, which only compressed_input.cpp needs to know about.)
+struct z_stream_s;
+struct ZSTD_DCtx_s;
+
+enum class Input_Compression { none, gzip, zstd };
+
+// Returns the compression format of the file at file_path, as
+// identified by its first few bytes (rather than by its extension).
+// Throws a std::runtime_error if the file can't be opened.
+Input_Compression detect_compression(const std::string &file_path);
+
+class Decompressing_Reader {
+public:
+  // Throws a std::runtime_error if the file can't be opened, or if its
+  // format is one that this build doesn't support.
+  explicit Decompressing_Reader(const std::string &file_path);
+  ~Decompressing_Reader();
+  Decompressing_Reader(const Decompressing_Reader &) = delete;
+  Decompressing_Reader &operator=(const Decompressing_Reader &) = delete;
+
+  // Copies up to size decompressed bytes into buffer, returning the
+  // number of bytes copied; this will only be less than size once the
+  // end of the data has been reached. Throws a std::runtime_error if
+  // the file is corrupt or truncated.
+  size_t read(char *buffer, size_t size);
+
+  Input_Compression compression() const { return compression_; }
+  // The number of (compressed) bytes read from the file so far:
+  uint64_t bytes_read() const { return bytes_read_; }
+
+private:
+  // Refills input_ from the file once its contents have all been
+  // consumed, returning false at the end of the file.
+  bool fill_input();
+  size_t read_gzip(char *buffer, size_t size);
+  size_t read_zstd(char *buffer, size_t size);
+
+  std::string file_path_;
+  std::ifstream file_;
+  Input_Compression compression_;
+  std::vector<char> input_;
+  size_t input_position_{0};
+  size_t input_size_{0};
+  uint64_t bytes_read_{0};
+  bool finished_{false};
+  z_stream_s *gzip_stream_{nullptr};
+  ZSTD_DCtx_s *zstd_context_{nullptr};
+  // Whether the decompressor is partway through a gzip member or a
+  // zstd frame (in which case the file mustn't end yet):
+  bool within_frame_{false};
+};
+
+// A read-only stream buffer whose contents come from a
+// Decompressing_Reader, so that a std::istream (and therefore a
+// CSVReader) can read a compressed file without decompressing it to
+// disk first.
+class Decompressing_Streambuf : public std::streambuf {
+public:
+  explicit Decompressing_Streambuf(Decompressing_Reader &reader);
+
+protected:
+  int_type underflow() override;
+
+private:
+  Decompressing_Reader &reader_;
+  std::vector<char> buffer_;
+};
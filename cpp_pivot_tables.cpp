@@ -35,7 +35,9 @@ and convert it into a function.
 
 4. Download data from other years also so that you end up with
 a very large file; that will make it easier to determine how
-well your program limits memory usage.
+well your program limits memory usage. (These files won't need to
+be concatenated, since scan_to_multi_pivot() also accepts a glob
+pattern such as T_T100_SEGMENT_ALL_CARRIER_*.csv.)
 
 5. Add in a Python-based comparison program.
 
@@ -51,6 +53,7 @@ fu146_anzr=Nv4+Pn44vr45
 
 */
 
+#include "columnar_table.h"
 #include "csv.hpp"
 #include "pivot_compressors.h"
 #include <chrono>
@@ -58,6 +61,7 @@ fu146_anzr=Nv4+Pn44vr45
 #include <iostream>
 #include <map>
 #include <string>
+#include <thread>
 #include <variant>
 #include <vector>
 
@@ -67,13 +71,11 @@ int main() {
   auto program_start_time = std::chrono::high_resolution_clock::now();
   std::string data_file_path{"/home/kjb3/D1V1/Documents/\
 Large_Datasets/BTS/T_T100_SEGMENT_ALL_CARRIER_2024.csv"};
-  std::string index_headers{"CARRIER|ORIGIN|REGION"};
   std::vector<std::string> value_fields{"PASSENGERS", "SEATS",
                                         "DEPARTURES_PERFORMED"};
   long rows_to_scan{-1}; // Use -1 to scan all rows
 
-  std::string pivot_file_path{
-      "../Output/pax_seats_deps_by_carrier_origin_region_filtered.csv"};
+  std::string pivot_file_path;
 
   // Defining maps that will allow us to determine which values to include
   // or exclude for various fields:
@@ -88,96 +90,75 @@ Large_Datasets/BTS/T_T100_SEGMENT_ALL_CARRIER_2024.csv"};
       {"ORIGIN", {"JFK", "LAX", "ORD", "MIA", "ATL"}}};
   std::map<std::string, std::vector<std::string>> exclude_map{
       {"DEST_COUNTRY", {"US"}}};
-
-  // Calling scan_to_pivot to calculate values
-  // by carrier, origin, and region:
-  scan_to_pivot(
-      data_file_path, value_fields, index_headers, rows_to_scan,
-      pivot_file_path,
-      [&](CSVRow row) -> std::string {
-        return {row["CARRIER"].get() + "|" + row["ORIGIN"].get() + "|" +
-                row["REGION"].get()};
-      },
-      include_map, exclude_map);
-
-  // Unfiltered equivalent:
-
-  pivot_file_path = "../Output/pax_seats_deps_by_carrier_origin_region.csv";
   std::map<std::string, std::vector<std::string>> unfiltered_string_map{};
 
-  // Calling scan_to_pivot to calculate values
-  // by carrier, origin, and region:
-  scan_to_pivot(
-      data_file_path, value_fields, index_headers, rows_to_scan,
-      pivot_file_path,
-      [&](CSVRow row) -> std::string {
-        return {row["CARRIER"].get() + "|" + row["ORIGIN"].get() + "|" +
-                row["REGION"].get()};
-      },
-      unfiltered_string_map, unfiltered_string_map);
-
-  // Updating several variables, then calling scan_to_pivot a
-  // second time to calculate metrics by
-  // carrier and origin only:
-
-  pivot_file_path = "../Output/pax_seats_deps_by_carrier_origin_filtered.csv";
-  index_headers = "CARRIER|ORIGIN";
-
-  scan_to_pivot(
-      data_file_path, value_fields, index_headers, rows_to_scan,
-      pivot_file_path,
-      [&](CSVRow row) -> std::string {
-        return {row["CARRIER"].get() + "|" + row["ORIGIN"].get()};
-      },
-      include_map, exclude_map);
-
-  // Producing an unfiltered equivalent:
-  pivot_file_path = "../Output/pax_seats_deps_by_carrier_origin.csv";
-
-  scan_to_pivot(
-      data_file_path, value_fields, index_headers, rows_to_scan,
-      pivot_file_path,
-      [&](CSVRow row) -> std::string {
-        return {row["CARRIER"].get() + "|" + row["ORIGIN"].get()};
-      },
-      unfiltered_string_map, unfiltered_string_map);
+  // Specifying the index fields for pivot tables by carrier, origin,
+  // and region: (Since these are specified as field names rather than
+  // as index_gen lambdas, scan_to_multi_pivot() can group rows by
+  // dictionary codes rather than by newly-created strings.)
+  std::vector<std::string> carrier_origin_region_fields{"CARRIER", "ORIGIN",
+                                                        "REGION"};
+  std::vector<std::string> carrier_origin_fields{"CARRIER", "ORIGIN"};
+
+  // Calling scan_to_multi_pivot to calculate filtered and
+  // unfiltered values by carrier, origin, and region and by carrier
+  // and origin only:
+  // (I had previously called scan_to_pivot() once for each of these
+  // four tables, but since they all come from the same .csv file,
+  // scan_to_multi_pivot() can produce all of them during a single
+  // scan of that file--which is much faster. The carrier and origin
+  // tables are rollups of the region-level ones, so they get derived
+  // from those tables' groups rather than aggregated from every row.)
+  std::vector<Pivot_Spec> pivot_specs{
+      {value_fields, "", {}, include_map, exclude_map,
+       "../Output/pax_seats_deps_by_carrier_origin_region_filtered.csv",
+       carrier_origin_region_fields, "", {},
+       {{carrier_origin_fields,
+         "../Output/pax_seats_deps_by_carrier_origin_filtered.csv"}},
+       {}},
+      {value_fields, "", {}, unfiltered_string_map, unfiltered_string_map,
+       "../Output/pax_seats_deps_by_carrier_origin_region.csv",
+       carrier_origin_region_fields, "", {},
+       {{carrier_origin_fields,
+         "../Output/pax_seats_deps_by_carrier_origin.csv"}},
+       {}}};
+
+  // Scanning the file in parallel (using one thread per core),
+  // reading it via mmap(), and aggregating the results within hash
+  // tables in order to further reduce this function's runtime:
+  Scan_Options scan_options{
+      .thread_count = static_cast<int>(std::thread::hardware_concurrency()),
+      .backend = Pivot_Backend::hash_table,
+      .memory_map = true};
+
+  scan_to_multi_pivot(data_file_path, pivot_specs, rows_to_scan,
+                      scan_options);
 
   // Testing out in-memory pivot tables (either via a function or
   // through a set of pre-defined code)
   // (Consider looking into templates as a way to allow various
   // structs to get passed to this function)
 
-  std::vector<std::map<std::string, std::variant<std::string, double>>>
-      table_rows;
-
   std::vector<std::string> string_fields{"CARRIER", "ORIGIN", "REGION",
                                          "DEST_COUNTRY"};
   std::vector<std::string> double_fields{"PASSENGERS", "SEATS",
                                          "DEPARTURES_PERFORMED"};
 
-  CSVReader reader(data_file_path);
-
-  // Reading CSV data into table_rows so that the data will be
+  // Reading CSV data into a Columnar_Table so that the data will be
   // available in RAM for further analyses:
-
+  // (I originally stored each row as a
+  // std::map<std::string, std::variant<std::string, double>>, and
+  // in_memory_pivot() still accepts a vector of these maps. However,
+  // a Columnar_Table, which stores each field as a single
+  // contiguous column and dictionary-encodes its string fields,
+  // requires far less RAM and can be pivoted more quickly.)
+  // The table also gets saved as a binary columnar cache, allowing
+  // later runs to skip parsing the .csv file until it changes.
 
 auto import_start_time = std::chrono::high_resolution_clock::now();
-  for (CSVRow &row : reader) {
-    // Initializing a new map that will hold the string- and double-typed
-    // column values that we wish to include within our in-memory table:
-    std::map<std::string, std::variant<std::string, double>> table_row;
-    for (std::string &string_field : string_fields) {
-      table_row[string_field] = row[string_field].get();
-    }
-    for (std::string &double_field : double_fields) {
-      table_row[double_field] = row[double_field].get<double>();
-      // std::cout << row[double_field].get<double>() << "\t";
-    }
-    // Adding this completed map (which represents a single row of data)
-    // to our vector of rows:
-    table_rows.push_back(table_row);
-  }
-
+  Columnar_Table table = load_cached_columnar_table(
+      data_file_path, string_fields, double_fields,
+      "../Output/t100_segment_columns.cache");
 
   auto import_end_time = std::chrono::high_resolution_clock::now();
   auto import_run_time =
@@ -186,25 +167,6 @@ auto import_start_time = std::chrono::high_resolution_clock::now();
   std::cout << "The dataset got loaded into memory in " << import_run_time
             << " seconds.\n";
 
-  // I originally used the following approach to populate this table, but I
-  // realized that this code could be simplified using the approach shown above.
-
-  // table_rows.push_back({{"CARRIER", row["CARRIER"].get()},
-  //                       {"ORIGIN", row["ORIGIN"].get()},
-  //                       {"REGION", row["REGION"].get()},
-  //                       {"DEST_COUNTRY", row["DEST_COUNTRY"].get()},
-  //                       {"PASSENGERS", row["PASSENGERS"].get<double>()},
-  //                       {"SEATS", row["SEATS"].get<double>()},
-  //                       {"DEPARTURES_PERFORMED",
-  //                       row["DEPARTURES_PERFORMED"].get<double>()}});}
-
-  // Confirming that the following code will allow me to access variants:
-  // for (int i = 0; i < 10; i++) {
-  //   std::cout << "\n"
-  //             << std::get<std::string>(table_rows[i]["CARRIER"]) << "\t"
-  //             << std::get<double>(table_rows[i]["PASSENGERS"]);
-  // }
-
   // Creating a pivot table: (Port this code into a function
   // once you've finished working on it.)
 
@@ -217,22 +179,24 @@ pivot_file_path = "../Output/pax_seats_deps_by_carrier_origin_in_memory.csv";
 
 std::map<std::string, std::vector<double>> unfiltered_double_map {};
 
-std::map<std::string, std::vector<double>> double_include_map {
-  {"PASSENGERS",{1, 2, 3, 4, 5, 6, 7, 8, 9, 10}}};
-
-std::map<std::string, std::vector<double>> double_exclude_map {{"PASSENGERS",{0}}};
+// Only including rows with at least one passenger: (This had
+// previously been approximated by an include list of 1 through 10,
+// since the double maps can only match exact values.)
+std::vector<Double_Range_Filter> passenger_filters{
+    {"PASSENGERS", Range_Test::greater, 0}};
 
 
 
 
 std::cout << "Now running unfiltered in-memory pivot.\n";
 
-// Unfiltered function:
+// Unfiltered function: (Since this table will contain many distinct
+// carrier/origin pairs, it will be aggregated via a hash table.)
 std::map<std::string, std::map<std::string, Pivot_Vals>> output_map = (
 in_memory_pivot(
-  table_rows, index_fields, value_fields, true,
+  table, index_fields, value_fields, true,
   pivot_file_path, unfiltered_string_map, unfiltered_string_map, 
-unfiltered_double_map, unfiltered_double_map));
+unfiltered_double_map, unfiltered_double_map, Pivot_Backend::hash_table));
 
 std::cout << "Now running filtered in-memory pivot.\n";
 
@@ -241,9 +205,10 @@ pivot_file_path = "../Output/pax_seats_deps_by_carrier_origin_in_memory_filtered
 // Testing out double-typed filters:
 output_map = (
 in_memory_pivot(
-  table_rows, index_fields, value_fields, true,
+  table, index_fields, value_fields, true,
   pivot_file_path, unfiltered_string_map, unfiltered_string_map, 
-double_include_map, double_exclude_map));
+unfiltered_double_map, unfiltered_double_map, Pivot_Backend::ordered_map,
+  6, 1, nullptr, true, {}, nullptr, {}, passenger_filters));
 
   
 
@@ -0,0 +1,81 @@
+// csv_output.h
+// Released under the MIT License
+
+// This header defines Csv_Output_Writer, a buffered .csv writer that
+// the pivot functions use to save their output. Documentation on this
+// class is available within csv_output.cpp.
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct Pivot_Columns;
+
+// The format in which pivot tables get saved: csv writes .csv text,
+// whereas arrow writes typed columns to an Arrow IPC file (see
+// pivot_columns.cpp).
+enum class Output_Format { csv, arrow };
+
+class Csv_Output_Writer {
+public:
+  // precision: the number of decimal places with which doubles will
+  // be written, or -1 to write each double using the shortest
+  // representation that will round-trip back to the same value.
+  // Throws a std::runtime_error if file_path can't be opened.
+  // (When format is Output_Format::arrow, precision is ignored, and
+  // the file only gets written once flush() is called; see flush().)
+  explicit Csv_Output_Writer(const std::string &file_path,
+                             int precision = 6,
+                             Output_Format format = Output_Format::csv);
+  // Appends the output to *output (which must outlive the writer)
+  // rather than writing it to a file. (This constructor accepts a
+  // pointer so that it can't be mistaken for the one above.)
+  explicit Csv_Output_Writer(std::string *output, int precision = 6);
+  // Adds the output to columns (which must outlive the writer) as
+  // typed values rather than text.
+  explicit Csv_Output_Writer(Pivot_Columns &columns);
+  ~Csv_Output_Writer();
+  Csv_Output_Writer(const Csv_Output_Writer &) = delete;
+  Csv_Output_Writer &operator=(const Csv_Output_Writer &) = delete;
+
+  // Adds a field to the current row. (Text fields that contain
+  // delimiters, quotes, or line breaks will get quoted.)
+  void write_field(std::string_view text);
+  void write_field(double value);
+  void write_field(long value);
+  // Ends the current row.
+  void end_row();
+
+  // Writes any buffered output to the file; throws a
+  // std::runtime_error if the write fails. (This also happens
+  // automatically whenever the buffer fills up and when the writer
+  // gets destroyed.) Since an Arrow file can't be written until all
+  // of its rows are known, Arrow output is instead written in its
+  // entirety by each flush() call, which should therefore take place
+  // once the last row has been added.
+  void flush();
+
+private:
+  void start_field();
+  // Returns a pointer to at least size bytes of writable space at
+  // the end of the buffer.
+  char *reserve(size_t size);
+
+  std::string file_path_;
+  std::FILE *file_{nullptr};
+  std::string *output_{nullptr};
+  Pivot_Columns *columns_{nullptr};
+  // The columns that will be saved as an Arrow file, if any, and
+  // whether they've changed since they were last saved:
+  std::unique_ptr<Pivot_Columns> arrow_columns_;
+  bool arrow_file_current_{false};
+  int precision_;
+  bool row_started_{false};
+  std::vector<char> buffer_;
+  size_t buffer_used_{0};
+};
@@ -0,0 +1,188 @@
+// csv_projection.cpp
+// Released under the MIT License
+
+/* The BTS T-100 segment files contain dozens of columns, but a given
+set of pivot tables will generally only use a handful of them (their
+index, value, and filter fields). CSVReader tokenizes and stores every
+field of every row regardless, so much of its parsing work goes to
+waste.
+
+When all of a scan's pivot specs define their indexes via
+index_fields (rather than via index_gen functions, which need access
+to an entire CSVRow), scan_to_multi_pivot() can use a
+Column_Projection to split each line instead. This class only
+stores views of the projected fields: everything between them is
+skipped over by searching for the next delimiter, and everything after
+the last projected field isn't examined at all. Quoted fields are
+supported (including those that contain delimiters or escaped
+quotes), but, as with scan_to_multi_pivot()'s parallel mode, quoted
+fields may not contain line breaks. Delimiters and quotes are located
+64 bytes at a time via a vectorized kernel (see structural_scan.cpp).
+
+Note that, unlike CSVReader, this class doesn't check whether each
+line contains the same number of fields as the header row; lines that
+are too short to contain every projected field are skipped, but
+lines with extra fields are processed normally. */
+
+#include "csv_projection.h"
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <functional>
+#include <stdexcept>
+
+Column_Projection::Column_Projection(const std::vector<size_t> &columns,
+                                     char delimiter, char quote_char)
+    : delimiter_(delimiter), quote_char_(quote_char),
+      kernel_(structural_kernel()), columns_(columns) {
+  std::ranges::sort(columns_);
+  auto duplicates = std::ranges::unique(columns_);
+  columns_.erase(duplicates.begin(), duplicates.end());
+  slots_.assign(columns_.empty() ? 0 : columns_.back() + 1, 0);
+  for (size_t slot = 0; slot < columns_.size(); slot++) {
+    slots_[columns_[slot]] = slot;
+  }
+  fields_.resize(columns_.size());
+  unescaped_fields_.resize(columns_.size());
+}
+
+bool Column_Projection::split(std::string_view line) {
+  /* Walking through each delimiter and quote within line (as located
+  by kernel_, 64 bytes at a time) until every projected field has
+  been found. */
+  size_t column = 0;
+  size_t slot = 0; // The index of the next projected column
+  size_t field_start = 0;
+  // The state of the current field:
+  bool quoted = false;      // The field began with a quote.
+  bool in_quotes = false;   // We're currently between its quotes.
+  size_t quote_end = 0;     // The position of its closing quote
+  bool has_escaped_quotes = false;
+  size_t escaped_quote_pos = std::string_view::npos;
+
+  // Stores the field that ends at field_end (if it's projected), then
+  // resets the state for the following field. Returns true once all
+  // projected fields have been stored.
+  auto end_field = [&](size_t field_end) {
+    if (column == columns_[slot]) {
+      std::string_view value;
+      if (quoted) {
+        size_t value_end = in_quotes ? field_end : quote_end;
+        value = line.substr(field_start + 1, value_end - field_start - 1);
+        if (has_escaped_quotes) {
+          std::string &unescaped_field = unescaped_fields_[slot];
+          unescaped_field.clear();
+          for (size_t i = 0; i < value.size(); i++) {
+            unescaped_field += value[i];
+            if (value[i] == quote_char_) {
+              i++; // Skipping the second quote of this pair
+            }
+          }
+          value = unescaped_field;
+        }
+      } else {
+        value = line.substr(field_start, field_end - field_start);
+      }
+      fields_[slot] = value;
+      slot++;
+    }
+    column++;
+    field_start = field_end + 1;
+    quoted = false;
+    in_quotes = false;
+    has_escaped_quotes = false;
+    return slot == columns_.size();
+  };
+
+  if (columns_.empty()) {
+    return true;
+  }
+  // The final partial chunk of each line gets copied into this
+  // buffer so that the kernel never reads past the end of line.
+  char tail_chunk[structural_chunk_bytes];
+  for (size_t chunk_start = 0; chunk_start < line.size();
+       chunk_start += structural_chunk_bytes) {
+    size_t chunk_size =
+        std::min<size_t>(structural_chunk_bytes, line.size() - chunk_start);
+    const char *chunk = line.data() + chunk_start;
+    uint64_t mask;
+    if (chunk_size == structural_chunk_bytes) {
+      mask = kernel_(chunk, delimiter_, quote_char_);
+    } else {
+      std::copy_n(chunk, chunk_size, tail_chunk);
+      std::fill(tail_chunk + chunk_size, tail_chunk + structural_chunk_bytes,
+                char(0));
+      mask = kernel_(tail_chunk, delimiter_, quote_char_) &
+             ((uint64_t(1) << chunk_size) - 1);
+    }
+    while (mask != 0) {
+      size_t pos = chunk_start + std::countr_zero(mask);
+      mask &= mask - 1;
+      if (line[pos] == delimiter_) {
+        if (!in_quotes && end_field(pos)) {
+          return true;
+        }
+      } else if (pos == escaped_quote_pos) {
+        continue; // The second quote of an escaped pair
+      } else if (in_quotes) {
+        // Within a quoted field, a pair of quotes represents a literal
+        // quote; any other quote closes the field.
+        if ((pos + 1 < line.size()) && (line[pos + 1] == quote_char_)) {
+          has_escaped_quotes = true;
+          escaped_quote_pos = pos + 1;
+        } else {
+          in_quotes = false;
+          quote_end = pos;
+        }
+      } else if (pos == field_start) {
+        quoted = true;
+        in_quotes = true;
+      }
+      // (Quotes that appear elsewhere within unquoted fields are
+      // treated as regular characters.)
+    }
+  }
+  // The last field within the line ends at the end of the line:
+  return end_field(line.size());
+}
+
+void Projected_Batch::add_line(const Column_Projection &projection) {
+  field_count_ = projection.field_count();
+  std::less<const char *> precedes;
+  const char *text_start = text_->data();
+  const char *text_end = text_start + text_->size();
+  for (size_t slot = 0; slot < field_count_; slot++) {
+    std::string_view field = projection.slot_field(slot);
+    // Fields that had to be unescaped are stored within the
+    // projection rather than within the text, so they get copied.
+    if (precedes(field.data(), text_start) ||
+        precedes(text_end, field.data())) {
+      field = unescaped_fields_.emplace_back(field);
+    }
+    fields_.push_back(field);
+  }
+  line_count_++;
+}
+
+bool is_blank(std::string_view text) {
+  return text.find_first_not_of(' ') == std::string_view::npos;
+}
+
+bool parse_double(std::string_view text, double &value) {
+  size_t first = text.find_first_not_of(' ');
+  if (first == std::string_view::npos) {
+    return false;
+  }
+  text = text.substr(first, text.find_last_not_of(' ') - first + 1);
+  if ((text.front() == '+') && (text.size() > 1) && (text[1] != '-')) {
+    text.remove_prefix(1);
+  }
+  double parsed_value = 0.0;
+  auto [end, error] = std::from_chars(text.data(), text.data() + text.size(),
+                                      parsed_value);
+  if ((error != std::errc{}) || (end != text.data() + text.size())) {
+    return false;
+  }
+  value = parsed_value;
+  return true;
+}
@@ -0,0 +1,101 @@
+// csv_projection.h
+// Released under the MIT License
+
+// This header defines Column_Projection, a lightweight .csv line
+// splitter that only extracts the fields that a set of pivot tables
+// actually uses. Documentation on this class is available within
+// csv_projection.cpp.
+
+#pragma once
+
+#include "structural_scan.h"
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class Column_Projection {
+public:
+  // columns: the positions of the fields that will be extracted from
+  // each line. (These can be listed in any order, and duplicates
+  // are ignored.)
+  explicit Column_Projection(const std::vector<size_t> &columns,
+                             char delimiter = ',', char quote_char = '"');
+
+  // Splits line (which shouldn't include its newline character) into
+  // its projected fields. Returns false if line contains too few
+  // fields to include every projected column.
+  bool split(std::string_view line);
+
+  // Returns the text of the field at column (which must be one of the
+  // projected columns) within the most recently split line. Surrounding
+  // quotes are removed, and escaped quotes are unescaped.
+  std::string_view field(size_t column) const {
+    return fields_[slots_[column]];
+  }
+
+  // The number of projected columns, the position (between 0 and
+  // field_count() - 1) at which column's value gets stored, and the
+  // most recently split line's value at that position:
+  size_t field_count() const { return fields_.size(); }
+  size_t slot(size_t column) const { return slots_[column]; }
+  std::string_view slot_field(size_t slot) const { return fields_[slot]; }
+
+private:
+  char delimiter_;
+  char quote_char_;
+  Structural_Kernel kernel_;
+  // The projected columns in ascending order:
+  std::vector<size_t> columns_;
+  // The position within fields_ of each column's value:
+  std::vector<size_t> slots_;
+  std::vector<std::string_view> fields_;
+  // Storage for quoted fields whose escaped quotes needed to be
+  // removed (and thus couldn't be viewed in place):
+  std::vector<std::string> unescaped_fields_;
+};
+
+// A block of lines, along with the projected fields of the lines
+// within it that have been split so far. This allows lines to be split
+// on one thread and then processed on another (see
+// scan_to_multi_pivot()'s pipelined mode).
+class Projected_Batch {
+public:
+  Projected_Batch() = default;
+  explicit Projected_Batch(std::string text)
+      : text_(std::make_unique<std::string>(std::move(text))) {}
+
+  std::string_view text() const { return *text_; }
+  // Adds the fields of the line that projection most recently split
+  // (which should be located within text()) to the batch.
+  void add_line(const Column_Projection &projection);
+
+  // The number of lines within the batch:
+  size_t size() const { return line_count_; }
+  // Returns the field at slot (see Column_Projection::slot()) within
+  // the specified line.
+  std::string_view field(size_t line, size_t slot) const {
+    return fields_[line * field_count_ + slot];
+  }
+
+private:
+  // (The text is stored via a pointer, and unescaped fields within a
+  // deque, so that the views within fields_ stay valid when the batch
+  // gets moved.)
+  std::unique_ptr<std::string> text_;
+  std::deque<std::string> unescaped_fields_;
+  std::vector<std::string_view> fields_;
+  size_t field_count_{0};
+  size_t line_count_{0};
+};
+
+// Converts text into a double via std::from_chars (which, unlike
+// std::stod(), doesn't depend on the current locale). Leading and
+// trailing spaces and a leading '+' are allowed. Returns false (without
+// modifying value) if text doesn't contain a valid number.
+bool parse_double(std::string_view text, double &value);
+
+// Returns true if text is empty or only contains spaces.
+bool is_blank(std::string_view text);
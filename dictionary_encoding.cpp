@@ -0,0 +1,202 @@
+// dictionary_encoding.cpp
+// Released under the MIT License
+
+/* Fields such as CARRIER, ORIGIN, REGION and DEST_COUNTRY contain
+relatively few distinct values. Rather than concatenating these values
+into a new pipe-separated std::string for every row (then hashing or
+comparing that string), the pivot functions can instead convert each
+value into a small integer code via a String_Dictionary, then pack the
+codes for all index fields into one 64-bit group key via a
+Coded_Group_Table. Hashing and comparing these keys only requires
+integer operations, and no memory needs to be allocated for rows whose
+group has already been encountered. The pipe-separated strings are
+only created once per group, when the pivot table is written out.
+
+Each field receives its own range of bits within the key. When the
+number of distinct values within each field is known ahead of time
+(as is the case for Columnar_Table columns), these ranges are sized
+exactly. Otherwise, each field starts out with an equal share of the
+key's 64 bits; if a field later runs out of room, the layout gets
+recalculated and all existing keys get repacked. (If no layout can
+fit every field's codes, a std::runtime_error is thrown; use an
+index_gen function for such pivot tables instead.) */
+
+#include "dictionary_encoding.h"
+#include <algorithm>
+#include <bit>
+#include <numeric>
+#include <stdexcept>
+
+uint32_t String_Dictionary::encode(std::string_view value) {
+  auto code_it = code_lookup.find(value);
+  if (code_it != code_lookup.end()) {
+    return code_it->second;
+  }
+  // This is the first time that this value has been encountered,
+  // so it will be assigned the next available code.
+  uint32_t code = static_cast<uint32_t>(values.size());
+  values.emplace_back(value);
+  code_lookup.emplace(values.back(), code);
+  return code;
+}
+
+// The number of bits needed to store codes 0 through
+// (cardinality - 1): (At least one bit is always used.)
+static int bits_needed(size_t cardinality) {
+  return std::max(1, static_cast<int>(std::bit_width(
+                         cardinality > 0 ? cardinality - 1 : 0)));
+}
+
+Coded_Group_Table::Coded_Group_Table(size_t field_count, size_t vals_per_key)
+    : table_(vals_per_key) {
+  if (field_count > 64) {
+    throw std::runtime_error("At most 64 index fields can be packed into a "
+                             "group key.");
+  }
+  std::vector<int> bit_widths(field_count,
+                              field_count > 0 ? 64 / int(field_count) : 0);
+  set_layout(bit_widths);
+}
+
+Coded_Group_Table::Coded_Group_Table(const std::vector<size_t> &cardinalities,
+                                     size_t vals_per_key)
+    : table_(vals_per_key) {
+  if (can_pack(cardinalities) == false) {
+    throw std::runtime_error("These index fields contain too many distinct "
+                             "values to be packed into a 64-bit key.");
+  }
+  std::vector<int> bit_widths;
+  for (size_t cardinality : cardinalities) {
+    bit_widths.push_back(bits_needed(cardinality));
+  }
+  set_layout(bit_widths);
+}
+
+bool Coded_Group_Table::can_pack(const std::vector<size_t> &cardinalities) {
+  int total_bits = 0;
+  for (size_t cardinality : cardinalities) {
+    total_bits += bits_needed(cardinality);
+  }
+  return total_bits <= 64;
+}
+
+void Coded_Group_Table::set_layout(const std::vector<int> &bit_widths) {
+  bit_widths_ = bit_widths;
+  bit_offsets_.assign(bit_widths.size(), 0);
+  for (size_t field = 1; field < bit_widths.size(); field++) {
+    bit_offsets_[field] = bit_offsets_[field - 1] + bit_widths[field - 1];
+  }
+  max_codes_.resize(bit_widths.size(), 0);
+}
+
+uint64_t Coded_Group_Table::pack(const uint32_t *codes) const {
+  uint64_t key = 0;
+  for (size_t field = 0; field < bit_widths_.size(); field++) {
+    key |= uint64_t(codes[field]) << bit_offsets_[field];
+  }
+  return key;
+}
+
+uint32_t Coded_Group_Table::code(size_t group, size_t field) const {
+  uint64_t mask = (bit_widths_[field] == 64)
+                      ? UINT64_MAX
+                      : ((uint64_t(1) << bit_widths_[field]) - 1);
+  return static_cast<uint32_t>((table_.key(group) >> bit_offsets_[field]) &
+                               mask);
+}
+
+Pivot_Vals *Coded_Group_Table::find_or_insert(const uint32_t *codes) {
+  for (size_t field = 0; field < bit_widths_.size(); field++) {
+    if (codes[field] > max_codes_[field]) {
+      if ((bit_widths_[field] < 32) &&
+          (codes[field] >> bit_widths_[field]) != 0) {
+        repack(field, codes[field]);
+      }
+      max_codes_[field] = codes[field];
+    }
+  }
+  return table_.find_or_insert(pack(codes));
+}
+
+void Coded_Group_Table::repack(size_t overflowing_field, uint32_t code) {
+  /* Choosing a new layout that leaves room for code within
+  overflowing_field, then repacking each existing group's key. */
+  std::vector<size_t> cardinalities;
+  for (uint32_t max_code : max_codes_) {
+    cardinalities.push_back(size_t(max_code) + 1);
+  }
+  cardinalities[overflowing_field] = size_t(code) + 1;
+
+  // Ideally, the overflowing field will receive enough bits for
+  // twice its current number of codes (so that it won't need to get
+  // repacked again right away), the other fields will keep their
+  // current widths, and any remaining bits will go to the overflowing
+  // field. If that's not possible, each field will instead receive
+  // only as many bits as its current codes require (with any remaining
+  // bits again going to the overflowing field).
+  std::vector<int> bit_widths = bit_widths_;
+  bit_widths[overflowing_field] =
+      bits_needed(cardinalities[overflowing_field] * 2);
+  if (std::accumulate(bit_widths.begin(), bit_widths.end(), 0) > 64) {
+    for (size_t field = 0; field < bit_widths.size(); field++) {
+      bit_widths[field] = bits_needed(cardinalities[field]);
+    }
+  }
+  int total_bits = std::accumulate(bit_widths.begin(), bit_widths.end(), 0);
+  if (total_bits > 64) {
+    throw std::runtime_error(
+        "The index fields for this pivot table contain too many distinct "
+        "values to be packed into a 64-bit key; consider using an index_gen "
+        "function instead.");
+  }
+  bit_widths[overflowing_field] += 64 - total_bits;
+
+  // Decoding each existing key using the old layout, then inserting
+  // it (along with its accumulators) into a table that uses the new one:
+  std::vector<std::vector<uint32_t>> group_codes(table_.size());
+  for (size_t group = 0; group < table_.size(); group++) {
+    for (size_t field = 0; field < bit_widths_.size(); field++) {
+      group_codes[group].push_back(this->code(group, field));
+    }
+  }
+  Pivot_Hash_Table<uint64_t, Integer_Hash> old_table = std::move(table_);
+  table_ = Pivot_Hash_Table<uint64_t, Integer_Hash>(old_table.vals_per_key());
+  set_layout(bit_widths);
+  for (size_t group = 0; group < old_table.size(); group++) {
+    Pivot_Vals *new_vals = table_.find_or_insert(pack(group_codes[group].data()));
+    std::copy_n(old_table.vals(group), old_table.vals_per_key(), new_vals);
+  }
+}
+
+void Coded_Group_Table::merge(Coded_Group_Table &source) {
+  /* Adding each of source's groups to this table. When both tables
+  use the same layout (as they will when both were created with the
+  same cardinalities), source's packed keys can be inserted as is;
+  otherwise, each key gets decoded and then repacked. */
+  if (source.bit_widths_ == bit_widths_) {
+    for (size_t field = 0; field < max_codes_.size(); field++) {
+      max_codes_[field] = std::max(max_codes_[field], source.max_codes_[field]);
+    }
+  }
+  std::vector<uint32_t> codes(source.field_count());
+  for (size_t group = 0; group < source.size(); group++) {
+    Pivot_Vals *target_vals;
+    if (source.bit_widths_ == bit_widths_) {
+      target_vals = table_.find_or_insert(source.table_.key(group));
+    } else {
+      for (size_t field = 0; field < codes.size(); field++) {
+        codes[field] = source.code(group, field);
+      }
+      target_vals = find_or_insert(codes.data());
+    }
+    const Pivot_Vals *source_vals = source.vals(group);
+    for (size_t vfi = 0; vfi < table_.vals_per_key(); vfi++) {
+      target_vals[vfi].pivot_sum += source_vals[vfi].pivot_sum;
+      target_vals[vfi].pivot_count += source_vals[vfi].pivot_count;
+    }
+  }
+}
+
+void Coded_Group_Table::clear() {
+  table_ = Pivot_Hash_Table<uint64_t, Integer_Hash>(table_.vals_per_key());
+}
@@ -0,0 +1,80 @@
+// dictionary_encoding.h
+// Released under the MIT License
+
+// This header defines types that allow categorical (string) values to
+// be replaced with small integer codes, and that allow the codes for
+// several index fields to be packed into a single 64-bit group key.
+// Documentation on these types is available within
+// dictionary_encoding.cpp.
+
+#pragma once
+
+#include "pivot_compressors.h"
+#include "pivot_hash_table.h"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Maps each distinct string value to a code (assigned in order of
+// first appearance) and each code back to its value.
+struct String_Dictionary {
+  std::vector<std::string> values;
+  std::unordered_map<std::string, uint32_t, String_Hash, std::equal_to<>>
+      code_lookup;
+
+  // Returns value's code, first adding value to the dictionary if it
+  // hasn't been encountered yet.
+  uint32_t encode(std::string_view value);
+  size_t size() const { return values.size(); }
+};
+
+// An aggregation table whose keys are combinations of dictionary
+// codes (one per index field) packed into a single uint64_t.
+class Coded_Group_Table {
+public:
+  // Use this constructor when the number of distinct values within
+  // each field isn't known ahead of time; each field will initially
+  // receive an equal share of the key's 64 bits.
+  Coded_Group_Table(size_t field_count, size_t vals_per_key);
+  // Use this constructor when each field's number of distinct values
+  // (and thus the number of bits needed for its codes) is already
+  // known; the resulting layout will never need to change.
+  Coded_Group_Table(const std::vector<size_t> &cardinalities,
+                    size_t vals_per_key);
+
+  // Returns true if fields with these numbers of distinct values
+  // can be packed into a single 64-bit key.
+  static bool can_pack(const std::vector<size_t> &cardinalities);
+
+  // Returns the accumulators that correspond to the combination of
+  // codes found at codes[0] through codes[field_count - 1].
+  Pivot_Vals *find_or_insert(const uint32_t *codes);
+
+  size_t size() const { return table_.size(); }
+  size_t field_count() const { return bit_widths_.size(); }
+  uint32_t code(size_t group, size_t field) const;
+  Pivot_Vals *vals(size_t group) { return table_.vals(group); }
+  // (Group numbers are assigned in order of insertion, and they don't
+  // change when the table's keys get repacked.)
+  size_t group_of(const Pivot_Vals *vals) const {
+    return table_.group_of(vals);
+  }
+  // Adds the sums and counts of each of source's groups (whose codes
+  // must refer to the same dictionaries as this table's) to this
+  // table's corresponding groups.
+  void merge(Coded_Group_Table &source);
+  void clear();
+
+private:
+  uint64_t pack(const uint32_t *codes) const;
+  void repack(size_t overflowing_field, uint32_t code);
+  void set_layout(const std::vector<int> &bit_widths);
+
+  std::vector<int> bit_widths_;
+  std::vector<int> bit_offsets_;
+  // The largest code that has been packed for each field so far:
+  std::vector<uint32_t> max_codes_;
+  Pivot_Hash_Table<uint64_t, Integer_Hash> table_;
+};
@@ -0,0 +1,53 @@
+// mapped_file.cpp
+// Released under the MIT License
+
+/* Reading a file through a std::ifstream (or a CSVReader) copies its
+contents from the operating system's page cache into the program's own
+buffers, and CSVRow::get() then copies each field into a new
+std::string. When a large .csv file is already cached in memory (as is
+often the case for datasets that get pivoted repeatedly), these copies
+can take up a considerable share of a scan's runtime.
+
+A Mapped_File instead maps the file directly into the program's
+address space, so its contents can be tokenized in place and passed
+around as std::string_view slices. The mapping is read-only, and the
+kernel is advised that it will be read sequentially so that pages
+get read ahead of the scan. */
+
+#include "mapped_file.h"
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+Mapped_File::Mapped_File(const std::string &file_path) {
+  int fd = open(file_path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    throw std::runtime_error("Unable to open " + file_path);
+  }
+  struct stat file_stats;
+  if (fstat(fd, &file_stats) == -1) {
+    close(fd);
+    throw std::runtime_error("Unable to determine the size of " + file_path);
+  }
+  size_ = static_cast<size_t>(file_stats.st_size);
+  // (Empty files can't be mapped, but they also don't need to be.)
+  if (size_ > 0) {
+    void *mapping = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) {
+      close(fd);
+      throw std::runtime_error("Unable to memory-map " + file_path);
+    }
+    madvise(mapping, size_, MADV_SEQUENTIAL);
+    data_ = static_cast<const char *>(mapping);
+  }
+  // The mapping will remain valid after the file descriptor is closed.
+  close(fd);
+}
+
+Mapped_File::~Mapped_File() {
+  if (data_ != nullptr) {
+    munmap(const_cast<char *>(data_), size_);
+  }
+}
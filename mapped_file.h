@@ -0,0 +1,29 @@
+// mapped_file.h
+// Released under the MIT License
+
+// This header defines Mapped_File, which maps a file into memory
+// (via POSIX mmap()) so that its contents can be read in place.
+// Documentation on this class is available within mapped_file.cpp.
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+class Mapped_File {
+public:
+  // Throws a std::runtime_error if the file can't be opened or mapped.
+  explicit Mapped_File(const std::string &file_path);
+  ~Mapped_File();
+  Mapped_File(const Mapped_File &) = delete;
+  Mapped_File &operator=(const Mapped_File &) = delete;
+
+  // The file's contents, which remain valid for as long as this
+  // object exists:
+  std::string_view data() const { return {data_, size_}; }
+
+private:
+  const char *data_{nullptr};
+  size_t size_{0};
+};
@@ -0,0 +1,675 @@
+// pivot_benchmark.cpp
+// Released under the MIT License
+
+/* This program provides a repeatable benchmark for the pivot functions
+within this project. It first generates a synthetic .csv file that
+follows the layout of the BTS T-100 segment extracts (the same columns,
+in the same order, with quoted carrier and city names), then runs
+each pivot path against that file and reports its throughput, peak
+memory usage, and allocation counts as machine-readable JSON.
+
+The generated data can be configured via the following arguments:
+
+--rows N: the number of rows to generate (default: 1000000)
+--carriers N: the number of distinct carriers (default: 100)
+--airports N: the number of distinct origin and destination airports
+(default: 1000)
+--skew S: the exponent of the Zipf distribution from which carriers
+and airports are drawn; 0 results in uniformly distributed values,
+whereas larger values concentrate rows within fewer groups
+(default: 1.0)
+--extra-columns N: the number of additional numeric columns to append
+to each row, which makes the file wider without affecting the pivot
+tables (default: 0)
+--seed N: the random seed (default: 2024)
+
+The benchmark itself can be configured via these arguments:
+
+--threads N: the thread count for the parallel paths (default: the
+number of hardware threads)
+--repeat N: the number of times to run each path (default: 3)
+--paths A,B,...: the paths to run (default: all of them; see
+benchmark_paths() for their names)
+--data PATH: the path of the generated .csv file; if this file
+already exists, it will be reused rather than regenerated
+(default: a file within the system's temporary directory, which gets
+deleted afterwards)
+--json PATH: the file to which the results will be written (default:
+pivot_benchmark.json)
+
+Each run takes place within its own child process (via fork()), so
+that its peak resident set size and allocation counts reflect that run
+alone. Every path produces the same two pivot tables (one indexed by
+CARRIER|ORIGIN and one by CARRIER|ORIGIN|DEST|MONTH, each with three
+value fields), and the fastest of each path's runs is used to calculate
+its row and byte throughput. */
+
+#include "columnar_table.h"
+#include "csv_output.h"
+#include "pivot_compressors.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Allocation counters: (These are updated by the replacement global
+// operator new overloads below, including the array, aligned, and
+// nothrow versions, so they include allocations made by the CSV
+// parser and by the standard library.)
+static std::atomic<uint64_t> allocation_count{0};
+static std::atomic<uint64_t> allocated_bytes{0};
+
+static void *counted_allocation(size_t size, size_t alignment = 0) {
+  /* Allocating size bytes (aligned to alignment, if it's specified)
+  and counting the allocation, or returning nullptr if it fails. Every
+  replacement operator new below calls this function, and every
+  replacement operator delete frees its memory via std::free(). */
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+  size = size ? size : 1;
+  if (alignment == 0) {
+    return std::malloc(size);
+  }
+  // (std::aligned_alloc() requires a multiple of the alignment.)
+  return std::aligned_alloc(alignment,
+                            (size + alignment - 1) / alignment * alignment);
+}
+
+static void *checked_allocation(size_t size, size_t alignment = 0) {
+  if (void *memory = counted_allocation(size, alignment)) {
+    return memory;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new(size_t size) { return checked_allocation(size); }
+void *operator new[](size_t size) { return checked_allocation(size); }
+void *operator new(size_t size, std::align_val_t alignment) {
+  return checked_allocation(size, static_cast<size_t>(alignment));
+}
+void *operator new[](size_t size, std::align_val_t alignment) {
+  return checked_allocation(size, static_cast<size_t>(alignment));
+}
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  return counted_allocation(size);
+}
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+  return counted_allocation(size);
+}
+void *operator new(size_t size, std::align_val_t alignment,
+                   const std::nothrow_t &) noexcept {
+  return counted_allocation(size, static_cast<size_t>(alignment));
+}
+void *operator new[](size_t size, std::align_val_t alignment,
+                     const std::nothrow_t &) noexcept {
+  return counted_allocation(size, static_cast<size_t>(alignment));
+}
+
+// (Since every replacement operator new above allocates via malloc() or
+// aligned_alloc(), freeing its memory via std::free() is correct; GCC's
+// -Wmismatched-new-delete can't see this once the overloads get
+// inlined, so it is disabled for them.)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete(void *memory) noexcept { std::free(memory); }
+void operator delete[](void *memory) noexcept { std::free(memory); }
+void operator delete(void *memory, size_t) noexcept { std::free(memory); }
+void operator delete[](void *memory, size_t) noexcept { std::free(memory); }
+void operator delete(void *memory, std::align_val_t) noexcept {
+  std::free(memory);
+}
+void operator delete[](void *memory, std::align_val_t) noexcept {
+  std::free(memory);
+}
+void operator delete(void *memory, size_t, std::align_val_t) noexcept {
+  std::free(memory);
+}
+void operator delete[](void *memory, size_t, std::align_val_t) noexcept {
+  std::free(memory);
+}
+void operator delete(void *memory, const std::nothrow_t &) noexcept {
+  std::free(memory);
+}
+void operator delete[](void *memory, const std::nothrow_t &) noexcept {
+  std::free(memory);
+}
+void operator delete(void *memory, std::align_val_t,
+                     const std::nothrow_t &) noexcept {
+  std::free(memory);
+}
+void operator delete[](void *memory, std::align_val_t,
+                       const std::nothrow_t &) noexcept {
+  std::free(memory);
+}
+#pragma GCC diagnostic pop
+
+struct Data_Settings {
+  long rows{1000000};
+  int carriers{100};
+  int airports{1000};
+  double skew{1.0};
+  int extra_columns{0};
+  unsigned seed{2024};
+};
+
+static std::string letter_code(size_t index, size_t length) {
+  /* Converting index into an uppercase code with the specified number
+  of letters (e.g. 0 -> "AA", 27 -> "BB" for length 2), with a numeric
+  suffix added once the codes run out. */
+  std::string code(length, 'A');
+  size_t remaining = index;
+  for (size_t position = length; position-- > 0;) {
+    code[position] = char('A' + remaining % 26);
+    remaining /= 26;
+  }
+  if (remaining > 0) {
+    code += std::to_string(remaining);
+  }
+  return code;
+}
+
+static std::discrete_distribution<size_t> zipf_distribution(size_t count,
+                                                             double skew) {
+  /* Returning a distribution over 0 through (count - 1) in which
+  value k is drawn with a probability proportional to 1 / (k + 1)^skew. */
+  std::vector<double> weights(count);
+  for (size_t k = 0; k < count; k++) {
+    weights[k] = 1.0 / std::pow(double(k + 1), skew);
+  }
+  return std::discrete_distribution<size_t>(weights.begin(), weights.end());
+}
+
+static void generate_t100_file(const std::string &data_file_path,
+                               const Data_Settings &settings) {
+  /* Writing a synthetic T-100 segment file with settings.rows rows to
+  data_file_path. */
+  if ((settings.rows < 0) || (settings.carriers < 1) ||
+      (settings.airports < 1) || (settings.skew < 0) ||
+      (settings.extra_columns < 0)) {
+    throw std::runtime_error(
+        "Row and column counts and the skew must not be negative, and "
+        "there must be at least one carrier and one airport.");
+  }
+  std::vector<std::string> carriers;
+  for (int carrier = 0; carrier < settings.carriers; carrier++) {
+    carriers.push_back(letter_code(carrier, 2));
+  }
+  std::vector<std::string> airports;
+  for (int airport = 0; airport < settings.airports; airport++) {
+    airports.push_back(letter_code(airport, 3));
+  }
+  static const std::array<std::string_view, 6> regions{"D", "A", "L",
+                                                       "P", "I", "S"};
+  static const std::array<std::string_view, 6> countries{"US", "CA", "MX",
+                                                         "GB", "JP", "DE"};
+
+  std::mt19937_64 generator(settings.seed);
+  std::discrete_distribution<size_t> carrier_distribution =
+      zipf_distribution(carriers.size(), settings.skew);
+  std::discrete_distribution<size_t> airport_distribution =
+      zipf_distribution(airports.size(), settings.skew);
+  std::uniform_int_distribution<int> month_distribution(1, 12);
+  std::uniform_int_distribution<int> departure_distribution(1, 120);
+  std::uniform_int_distribution<int> seat_distribution(9, 400);
+  std::uniform_real_distribution<double> load_distribution(0.0, 1.0);
+
+  Csv_Output_Writer writer(data_file_path, 2);
+  for (std::string_view column :
+       {"DEPARTURES_SCHEDULED", "DEPARTURES_PERFORMED", "PAYLOAD", "SEATS",
+        "PASSENGERS", "FREIGHT", "UNIQUE_CARRIER", "UNIQUE_CARRIER_NAME",
+        "CARRIER", "CARRIER_NAME", "ORIGIN", "ORIGIN_CITY_NAME", "DEST",
+        "DEST_CITY_NAME", "DEST_COUNTRY", "REGION", "MONTH"}) {
+    writer.write_field(column);
+  }
+  for (int column = 0; column < settings.extra_columns; column++) {
+    writer.write_field("EXTRA_" + std::to_string(column + 1));
+  }
+  writer.end_row();
+
+  for (long row = 0; row < settings.rows; row++) {
+    size_t carrier = carrier_distribution(generator);
+    size_t origin = airport_distribution(generator);
+    size_t dest = airport_distribution(generator);
+    long departures = departure_distribution(generator);
+    long performed = departures - (load_distribution(generator) < 0.1);
+    long seats = performed * seat_distribution(generator);
+    double passengers = std::floor(seats * load_distribution(generator));
+    writer.write_field(departures);
+    writer.write_field(performed);
+    writer.write_field(seats * 210.0);
+    writer.write_field(seats);
+    writer.write_field(passengers);
+    writer.write_field(std::floor(1000 * load_distribution(generator)));
+    writer.write_field(carriers[carrier]);
+    writer.write_field(carriers[carrier] + " Airlines \"X\" Inc.");
+    writer.write_field(carriers[carrier]);
+    writer.write_field(carriers[carrier] + " Air, Inc.");
+    writer.write_field(airports[origin]);
+    writer.write_field("City " + airports[origin] + ", ST");
+    writer.write_field(airports[dest]);
+    writer.write_field("City " + airports[dest] + ", ST");
+    writer.write_field(countries[dest % countries.size()]);
+    writer.write_field(regions[carrier % regions.size()]);
+    writer.write_field(long(month_distribution(generator)));
+    for (int column = 0; column < settings.extra_columns; column++) {
+      writer.write_field(load_distribution(generator));
+    }
+    writer.end_row();
+  }
+  writer.flush();
+}
+
+// The measurements taken during a single run of a pivot path:
+struct Run_Measurement {
+  bool succeeded{false};
+  double seconds{0.0};
+  long rows{0};
+  uint64_t bytes{0};
+  long peak_rss_bytes{0};
+  uint64_t allocations{0};
+  uint64_t allocated_bytes{0};
+};
+
+// Passed to each pivot path so that it can exclude its setup work
+// (such as loading a Columnar_Table) from its measurements.
+class Run_Clock {
+public:
+  // Restarts the timer and the allocation counters.
+  void start() {
+    allocation_count = 0;
+    allocated_bytes = 0;
+    start_time_ = std::chrono::steady_clock::now();
+  }
+  double elapsed_seconds() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start_time_)
+        .count();
+  }
+
+private:
+  std::chrono::steady_clock::time_point start_time_;
+};
+
+// A pivot path: its function runs the path, then stores the number of
+// rows that it processed (and the number of input bytes that these
+// rows occupied) within the measurement.
+struct Benchmark_Path {
+  std::string name;
+  std::function<void(Run_Clock &, Run_Measurement &)> run;
+};
+
+static Run_Measurement run_in_child(const Benchmark_Path &path) {
+  /* Running path within a child process, then returning the
+  measurements that the child sent back through a pipe. */
+  int pipe_fds[2];
+  if (pipe(pipe_fds) == -1) {
+    throw std::runtime_error("Unable to create a pipe.");
+  }
+  std::cout.flush();
+  pid_t child = fork();
+  if (child == -1) {
+    throw std::runtime_error("Unable to fork a benchmark process.");
+  }
+  if (child == 0) {
+    close(pipe_fds[0]);
+    Run_Measurement measurement;
+    try {
+      Run_Clock clock;
+      clock.start();
+      path.run(clock, measurement);
+      measurement.seconds = clock.elapsed_seconds();
+      measurement.allocations = allocation_count;
+      measurement.allocated_bytes = allocated_bytes;
+      rusage usage;
+      getrusage(RUSAGE_SELF, &usage);
+      measurement.peak_rss_bytes = usage.ru_maxrss * 1024L;
+      measurement.succeeded = true;
+    } catch (const std::exception &error) {
+      std::cerr << path.name << " failed: " << error.what() << "\n";
+    }
+    std::cout.flush();
+    ssize_t written = write(pipe_fds[1], &measurement, sizeof(measurement));
+    _exit(written == sizeof(measurement) ? 0 : 1);
+  }
+  close(pipe_fds[1]);
+  Run_Measurement measurement;
+  ssize_t bytes_read = read(pipe_fds[0], &measurement, sizeof(measurement));
+  close(pipe_fds[0]);
+  int status = 0;
+  waitpid(child, &status, 0);
+  if (bytes_read != sizeof(measurement)) {
+    measurement = Run_Measurement{};
+  }
+  return measurement;
+}
+
+static std::vector<Benchmark_Path>
+benchmark_paths(std::string data_file_path, const std::string &output_dir,
+                int thread_count) {
+  /* Defining every pivot path that this program can benchmark. */
+  const std::vector<std::string> value_fields{"PASSENGERS", "SEATS",
+                                              "DEPARTURES_PERFORMED"};
+  const std::vector<std::vector<std::string>> index_field_sets{
+      {"CARRIER", "ORIGIN"}, {"CARRIER", "ORIGIN", "DEST", "MONTH"}};
+  uint64_t file_bytes = std::filesystem::file_size(data_file_path);
+
+  // Returns the pivot specs for a scan, using index_fields (which
+  // allows projected scans) or, if use_index_gen is true, index_gen
+  // functions (which require a CSVReader).
+  auto scan_specs = [=](bool use_index_gen) {
+    std::vector<Pivot_Spec> specs;
+    for (size_t set = 0; set < index_field_sets.size(); set++) {
+      Pivot_Spec &spec = specs.emplace_back();
+      spec.value_fields = value_fields;
+      spec.pivot_file_path =
+          output_dir + "/scan_" + std::to_string(set) + ".csv";
+      spec.index_fields = index_field_sets[set];
+      if (use_index_gen) {
+        std::vector<std::string> index_fields = spec.index_fields;
+        spec.index_fields.clear();
+        spec.index_headers = "";
+        for (const std::string &field : index_fields) {
+          spec.index_headers += (spec.index_headers.empty() ? "" : "|") + field;
+        }
+        spec.index_gen = [index_fields](const CSVRow &row) {
+          std::string pivot_index;
+          for (const std::string &field : index_fields) {
+            if (!pivot_index.empty()) {
+              pivot_index += "|";
+            }
+            pivot_index += row[field].get_sv();
+          }
+          return pivot_index;
+        };
+      }
+    }
+    return specs;
+  };
+  auto scan_path = [=](std::string name, bool use_index_gen,
+                       Scan_Options options) {
+    return Benchmark_Path{
+        name, [=](Run_Clock &, Run_Measurement &measurement) mutable {
+          std::vector<Pivot_Spec> specs = scan_specs(use_index_gen);
+          long rows_to_scan = -1;
+          std::string path = data_file_path;
+          Pivot_Stats stats;
+          scan_to_multi_pivot(path, specs, rows_to_scan, options, &stats);
+          measurement.rows = stats.rows_scanned;
+          measurement.bytes = stats.bytes_read;
+        }};
+  };
+
+  // (The benchmark prints its own progress, so the pivot functions'
+  // messages are turned off.)
+  Scan_Options serial;
+  serial.log_to_stdout = false;
+  Scan_Options hash_options = serial;
+  hash_options.backend = Pivot_Backend::hash_table;
+  Scan_Options parallel = hash_options;
+  parallel.thread_count = thread_count;
+  Scan_Options mapped = parallel;
+  mapped.memory_map = true;
+  Scan_Options pipelined = hash_options;
+  pipelined.pipeline = true;
+
+  // In-memory paths load their Columnar_Table before the clock gets
+  // restarted, so only the pivots themselves are measured.
+  auto in_memory_path = [=](std::string name, Pivot_Backend backend,
+                            int threads, bool use_row_maps) {
+    return Benchmark_Path{
+        name, [=](Run_Clock &clock, Run_Measurement &measurement) mutable {
+          std::vector<std::string> string_fields{"CARRIER", "ORIGIN", "DEST",
+                                                 "MONTH"};
+          std::vector<std::string> double_fields = value_fields;
+          std::string path = data_file_path;
+          Columnar_Table table =
+              load_columnar_table(path, string_fields, double_fields);
+          std::vector<std::map<std::string, std::variant<std::string, double>>>
+              table_rows;
+          if (use_row_maps) {
+            table_rows.resize(table.row_count);
+            for (size_t row = 0; row < table.row_count; row++) {
+              for (const std::string &field : string_fields) {
+                table_rows[row][field] =
+                    std::string(table.string_column(field).value(row));
+              }
+              for (const std::string &field : double_fields) {
+                table_rows[row][field] = table.double_column(field)[row];
+              }
+            }
+          }
+          std::map<std::string, std::vector<std::string>> no_strings;
+          std::map<std::string, std::vector<double>> no_doubles;
+          clock.start();
+          for (size_t set = 0; set < index_field_sets.size(); set++) {
+            std::vector<std::string> index_fields = index_field_sets[set];
+            std::vector<std::string> pivot_values = value_fields;
+            std::string pivot_file_path =
+                output_dir + "/in_memory_" + std::to_string(set) + ".csv";
+            if (use_row_maps) {
+              in_memory_pivot(table_rows, index_fields, pivot_values, true,
+                              pivot_file_path, no_strings, no_strings,
+                              no_doubles, no_doubles, backend, 6, threads,
+                              nullptr, false);
+            } else {
+              in_memory_pivot(table, index_fields, pivot_values, true,
+                              pivot_file_path, no_strings, no_strings,
+                              no_doubles, no_doubles, backend, 6, threads,
+                              nullptr, false);
+            }
+          }
+          measurement.rows = table.row_count;
+          measurement.bytes =
+              table.row_count * (string_fields.size() * sizeof(uint32_t) +
+                                 double_fields.size() * sizeof(double));
+        }};
+  };
+
+  return {
+      scan_path("scan_index_gen", true, serial),
+      scan_path("scan_projected", false, serial),
+      scan_path("scan_projected_hash", false, hash_options),
+      scan_path("scan_parallel_hash", false, parallel),
+      scan_path("scan_mapped_parallel_hash", false, mapped),
+      scan_path("scan_pipelined_hash", false, pipelined),
+      Benchmark_Path{"columnar_load",
+                     [=](Run_Clock &, Run_Measurement &measurement) {
+                       std::vector<std::string> string_fields{
+                           "CARRIER", "ORIGIN", "DEST", "MONTH"};
+                       std::vector<std::string> double_fields = value_fields;
+                       std::string path = data_file_path;
+                       Columnar_Table table = load_columnar_table(
+                           path, string_fields, double_fields);
+                       measurement.rows = table.row_count;
+                       measurement.bytes = file_bytes;
+                     }},
+      in_memory_path("in_memory_columnar", Pivot_Backend::ordered_map, 1,
+                     false),
+      in_memory_path("in_memory_columnar_hash", Pivot_Backend::hash_table, 1,
+                     false),
+      in_memory_path("in_memory_columnar_parallel", Pivot_Backend::hash_table,
+                     thread_count, false),
+      in_memory_path("in_memory_row_maps_hash", Pivot_Backend::hash_table, 1,
+                     true),
+      in_memory_path("in_memory_row_maps_parallel", Pivot_Backend::hash_table,
+                     thread_count, true)};
+}
+
+static long count_data_rows(const std::string &data_file_path) {
+  /* Returning the number of lines (other than the header row) within
+  data_file_path. */
+  std::ifstream ifs(data_file_path, std::ios::binary);
+  long lines = 0;
+  std::string line;
+  while (std::getline(ifs, line)) {
+    lines++;
+  }
+  return std::max(lines - 1, 0L);
+}
+
+static std::string json_string(std::string_view text) {
+  std::string quoted = "\"";
+  for (char character : text) {
+    if ((character == '"') || (character == '\\')) {
+      quoted += '\\';
+    }
+    quoted += character;
+  }
+  return quoted + "\"";
+}
+
+static std::string json_number(double value, bool valid) {
+  /* Returning value as a JSON number, or null if it isn't valid (such
+  as the throughput of a path whose runs failed, which would otherwise
+  be written as inf or nan). */
+  if (!valid || !std::isfinite(value)) {
+    return "null";
+  }
+  std::ostringstream number;
+  number << value;
+  return number.str();
+}
+
+int main(int argc, char **argv) {
+  try {
+    Data_Settings settings;
+    int thread_count =
+        std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    int repeat_count = 3;
+    std::string selected_paths;
+    std::string data_file_path;
+    std::string json_file_path = "pivot_benchmark.json";
+
+    for (int arg = 1; arg < argc; arg++) {
+      std::string option = argv[arg];
+      if (arg + 1 >= argc) {
+        throw std::runtime_error("The " + option + " option requires a value.");
+      }
+      std::string value = argv[++arg];
+      if (option == "--rows") {
+        settings.rows = std::stol(value);
+      } else if (option == "--carriers") {
+        settings.carriers = std::stoi(value);
+      } else if (option == "--airports") {
+        settings.airports = std::stoi(value);
+      } else if (option == "--skew") {
+        settings.skew = std::stod(value);
+      } else if (option == "--extra-columns") {
+        settings.extra_columns = std::stoi(value);
+      } else if (option == "--seed") {
+        settings.seed = static_cast<unsigned>(std::stoul(value));
+      } else if (option == "--threads") {
+        thread_count = std::max(1, std::stoi(value));
+      } else if (option == "--repeat") {
+        repeat_count = std::max(1, std::stoi(value));
+      } else if (option == "--paths") {
+        selected_paths = "," + value + ",";
+      } else if (option == "--data") {
+        data_file_path = value;
+      } else if (option == "--json") {
+        json_file_path = value;
+      } else {
+        throw std::runtime_error("Unknown option: " + option);
+      }
+    }
+
+    // Each run's pivot tables get written to this directory, which is
+    // removed once the benchmark finishes:
+    std::filesystem::path output_dir =
+        std::filesystem::temp_directory_path() /
+        ("pivot_benchmark_" + std::to_string(getpid()));
+    std::filesystem::create_directories(output_dir);
+    bool delete_data_file = data_file_path.empty();
+    if (delete_data_file) {
+      data_file_path = (output_dir / "t100_synthetic.csv").string();
+    }
+    if (!std::filesystem::exists(data_file_path)) {
+      std::cout << "Generating " << settings.rows << " rows within "
+                << data_file_path << ".\n";
+      generate_t100_file(data_file_path, settings);
+    }
+    long data_rows = count_data_rows(data_file_path);
+
+    std::ostringstream results;
+    bool first_result = true;
+    for (const Benchmark_Path &path :
+         benchmark_paths(data_file_path, output_dir.string(), thread_count)) {
+      if (!selected_paths.empty() &&
+          (selected_paths.find("," + path.name + ",") == std::string::npos)) {
+        continue;
+      }
+      std::cout << "Running " << path.name << ".\n";
+      std::vector<Run_Measurement> runs;
+      for (int run = 0; run < repeat_count; run++) {
+        runs.push_back(run_in_child(path));
+      }
+      bool succeeded = std::ranges::all_of(
+          runs, [](const Run_Measurement &run) { return run.succeeded; });
+      std::vector<double> seconds;
+      long peak_rss_bytes = 0;
+      for (const Run_Measurement &run : runs) {
+        seconds.push_back(run.seconds);
+        peak_rss_bytes = std::max(peak_rss_bytes, run.peak_rss_bytes);
+      }
+      std::ranges::sort(seconds);
+      const Run_Measurement &last_run = runs.back();
+      long rows = last_run.rows;
+
+      results << (first_result ? "" : ",") << "\n    {\"path\": "
+              << json_string(path.name)
+              << ", \"succeeded\": " << (succeeded ? "true" : "false")
+              << ", \"runs\": " << runs.size()
+              << ", \"seconds_min\": "
+              << json_number(seconds.front(), succeeded)
+              << ", \"seconds_median\": "
+              << json_number(seconds[seconds.size() / 2], succeeded)
+              << ", \"rows\": " << rows << ", \"rows_per_second\": "
+              << json_number(rows / seconds.front(), succeeded)
+              << ", \"bytes\": " << last_run.bytes
+              << ", \"bytes_per_second\": "
+              << json_number(last_run.bytes / seconds.front(), succeeded)
+              << ", \"peak_rss_bytes\": " << peak_rss_bytes
+              << ", \"allocations\": " << last_run.allocations
+              << ", \"allocated_bytes\": " << last_run.allocated_bytes << "}";
+      first_result = false;
+    }
+
+    std::ofstream json_file(json_file_path);
+    json_file << "{\n  \"data\": {\"path\": " << json_string(data_file_path)
+              << ", \"rows\": " << data_rows << ", \"bytes\": "
+              << std::filesystem::file_size(data_file_path)
+              << ", \"carriers\": " << settings.carriers
+              << ", \"airports\": " << settings.airports
+              << ", \"skew\": " << settings.skew
+              << ", \"extra_columns\": " << settings.extra_columns
+              << ", \"seed\": " << settings.seed << "},\n  \"threads\": "
+              << thread_count << ",\n  \"results\": [" << results.str()
+              << "\n  ]\n}\n";
+    if (!json_file) {
+      throw std::runtime_error("Unable to write to " + json_file_path + ".");
+    }
+    std::cout << "The results were saved to " << json_file_path << ".\n";
+
+    std::filesystem::remove_all(output_dir);
+    return 0;
+  } catch (const std::exception &error) {
+    std::cerr << error.what() << "\n";
+    return 1;
+  }
+}
@@ -0,0 +1,566 @@
+// pivot_columns.cpp
+// Released under the MIT License
+
+/* The pivot functions' .csv output stores each group's index values
+within a single pipe-separated column, and every sum, count, and mean
+as text. Each program that loads this output then has to parse every
+number again and split every pivot index at its pipes. Pivot_Columns
+instead stores the output as typed columns: each index field becomes
+its own dictionary-encoded String_Column (so that repeated values such
+as carrier codes are only stored once), counts become int64 columns,
+and all other aggregates become float64 columns. (The type of each
+aggregate column is taken from its first row; the columns of a table
+without any rows are all stored as doubles.)
+
+These columns are collected by a Csv_Output_Writer (see csv_output.h),
+so every pivot path (including rollup levels, additional aggregates,
+and sampled estimates) can produce them without any changes of its
+own. They can be returned from in_memory_pivot() directly or saved via
+write_arrow_file() (which scan_to_multi_pivot() uses when
+Scan_Options::output_format is Output_Format::arrow).
+
+write_arrow_file() produces an Arrow IPC file (also known as a Feather
+version 2 file), which contains the following encapsulated messages:
+
+1. A schema message that lists each column's name and type. Index
+fields are declared as dictionary-encoded utf8 columns with int32
+indices.
+2. One dictionary batch for each index field, which stores the
+field's distinct values (in order of first appearance; the
+dictionaries aren't sorted).
+3. A single record batch that stores every column: the dictionary
+code of each row's index values, followed by each aggregate column's
+values.
+
+These are followed by an end-of-stream marker and then by a footer
+that locates each batch within the file. Each message's metadata is a
+flatbuffer; since this project doesn't depend on the flatbuffers
+library, Flatbuffer_Builder (below) lays out the handful of tables
+that Arrow's schema requires. No columns contain nulls, so each
+validity buffer is left empty, and every buffer is padded to a
+multiple of 8 bytes as the format requires. */
+
+#include "pivot_columns.h"
+#include "binary_io.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+// (Arrow files store their values in little-endian order, so they can
+// be copied directly out of each column on little-endian machines.)
+static_assert(std::endian::native == std::endian::little,
+              "write_arrow_file() requires a little-endian machine.");
+
+const String_Column &
+Pivot_Columns::index_column(const std::string &field) const {
+  auto field_it = std::ranges::find(index_fields, field);
+  if (field_it == index_fields.end()) {
+    throw std::runtime_error("This pivot table does not contain an index "
+                             "column named " +
+                             field + ".");
+  }
+  return index_columns[field_it - index_fields.begin()];
+}
+
+const Pivot_Value_Column &
+Pivot_Columns::value_column(const std::string &name) const {
+  auto column_it = std::ranges::find(value_columns, name,
+                                     &Pivot_Value_Column::name);
+  if (column_it == value_columns.end()) {
+    throw std::runtime_error("This pivot table does not contain a value "
+                             "column named " +
+                             name + ".");
+  }
+  return *column_it;
+}
+
+void Pivot_Columns::add_text(std::string_view text) {
+  /* The header's first field is the pipe-separated list of index
+  fields, and each of its other fields names a value column. Within
+  each row, the first field is the group's pivot index, which gets
+  split at each pipe. */
+  size_t field = row_fields_++;
+  if (!header_complete_) {
+    if (field > 0) {
+      value_columns.emplace_back().name = text;
+      return;
+    }
+    size_t field_start = 0;
+    while (true) {
+      size_t field_end = text.find('|', field_start);
+      index_fields.emplace_back(
+          text.substr(field_start, field_end - field_start));
+      if (field_end == std::string_view::npos) {
+        break;
+      }
+      field_start = field_end + 1;
+    }
+    index_columns.resize(index_fields.size());
+    return;
+  }
+  if (field > 0) {
+    throw std::runtime_error("Pivot table values must be numeric in order "
+                             "to be stored as columns.");
+  }
+  size_t field_start = 0;
+  for (size_t ifi = 0; ifi < index_columns.size(); ifi++) {
+    size_t field_end = text.find('|', field_start);
+    bool last_field = (ifi + 1 == index_columns.size());
+    if (last_field != (field_end == std::string_view::npos)) {
+      throw std::runtime_error(
+          "Unable to store the pivot index " + std::string(text) +
+          " as columns, since it does not contain exactly one value "
+          "(separated by pipes) for each index field.");
+    }
+    index_columns[ifi].push_back(
+        text.substr(field_start, field_end - field_start));
+    field_start = field_end + 1;
+  }
+}
+
+Pivot_Value_Column &Pivot_Columns::next_value_column() {
+  if (!header_complete_ || (row_fields_ == 0) ||
+      (row_fields_ > value_columns.size())) {
+    throw std::runtime_error("This pivot table's rows don't match its "
+                             "header.");
+  }
+  return value_columns[row_fields_++ - 1];
+}
+
+void Pivot_Columns::add_value(double value) {
+  Pivot_Value_Column &column = next_value_column();
+  if (column.is_integer) {
+    throw std::runtime_error("The " + column.name + " column contains "
+                             "both integers and doubles.");
+  }
+  column.doubles.push_back(value);
+}
+
+void Pivot_Columns::add_value(int64_t value) {
+  Pivot_Value_Column &column = next_value_column();
+  if (row_count == 0) {
+    column.is_integer = true;
+  }
+  if (column.is_integer) {
+    column.integers.push_back(value);
+  } else {
+    column.doubles.push_back(static_cast<double>(value));
+  }
+}
+
+void Pivot_Columns::end_row() {
+  if (!header_complete_) {
+    header_complete_ = true;
+  } else if (row_fields_ != value_columns.size() + 1) {
+    throw std::runtime_error("This pivot table's rows don't match its "
+                             "header.");
+  } else {
+    row_count++;
+  }
+  row_fields_ = 0;
+}
+
+// A flatbuffer table, string, or vector that hasn't been laid out yet.
+// (Tables refer to their child objects by index within children.)
+struct Flatbuffer_Object {
+  enum class Kind { table, string, table_vector, struct_vector };
+  struct Field {
+    int slot;
+    size_t size;
+    uint64_t value;
+    // The index within children of the object that this field refers
+    // to, or -1 for scalar fields:
+    int child{-1};
+  };
+
+  Kind kind{Kind::table};
+  std::vector<Field> fields;
+  std::vector<Flatbuffer_Object> children;
+  // The contents of a string, or the elements of a struct vector:
+  std::string bytes;
+  size_t element_count{0};
+
+  Flatbuffer_Object &add_scalar(int slot, size_t size, uint64_t value) {
+    fields.push_back(Field{slot, size, value});
+    return *this;
+  }
+  Flatbuffer_Object &add_child(int slot, Flatbuffer_Object child) {
+    fields.push_back(Field{slot, 4, 0, static_cast<int>(children.size())});
+    children.push_back(std::move(child));
+    return *this;
+  }
+};
+
+static Flatbuffer_Object flatbuffer_string(std::string_view text) {
+  Flatbuffer_Object object;
+  object.kind = Flatbuffer_Object::Kind::string;
+  object.bytes = text;
+  return object;
+}
+
+static Flatbuffer_Object
+flatbuffer_vector(std::vector<Flatbuffer_Object> tables) {
+  Flatbuffer_Object object;
+  object.kind = Flatbuffer_Object::Kind::table_vector;
+  object.children = std::move(tables);
+  return object;
+}
+
+// (Each of Arrow's structs contains 8-byte fields, so struct vectors
+// are always aligned to 8 bytes.)
+static Flatbuffer_Object flatbuffer_struct_vector(std::string elements,
+                                                  size_t element_count) {
+  Flatbuffer_Object object;
+  object.kind = Flatbuffer_Object::Kind::struct_vector;
+  object.bytes = std::move(elements);
+  object.element_count = element_count;
+  return object;
+}
+
+class Flatbuffer_Builder {
+public:
+  // Returns the bytes of a flatbuffer whose root table is root, padded
+  // to a multiple of 8 bytes.
+  std::string finish(const Flatbuffer_Object &root) {
+    bytes_.assign(sizeof(uint32_t), '\0');
+    patch_offset(0, write(root));
+    pad_to(8);
+    return std::move(bytes_);
+  }
+
+private:
+  /* Objects are laid out front to back: each table comes right after
+  its vtable, and each child object gets written after the object
+  that refers to it (since flatbuffer offsets can only point forward).
+  Every scalar is aligned to its own size relative to the start of the
+  buffer. */
+  size_t write(const Flatbuffer_Object &object) {
+    size_t position = 0;
+    switch (object.kind) {
+    case Flatbuffer_Object::Kind::string:
+      pad_to(4);
+      position = bytes_.size();
+      append<uint32_t>(object.bytes.size());
+      bytes_ += object.bytes;
+      bytes_ += '\0';
+      return position;
+    case Flatbuffer_Object::Kind::struct_vector:
+      while (bytes_.size() % 8 != 4) {
+        bytes_ += '\0';
+      }
+      position = bytes_.size();
+      append<uint32_t>(object.element_count);
+      bytes_ += object.bytes;
+      return position;
+    case Flatbuffer_Object::Kind::table_vector: {
+      pad_to(4);
+      position = bytes_.size();
+      append<uint32_t>(object.children.size());
+      size_t offsets_position = bytes_.size();
+      bytes_.append(object.children.size() * sizeof(uint32_t), '\0');
+      for (size_t ci = 0; ci < object.children.size(); ci++) {
+        patch_offset(offsets_position + ci * sizeof(uint32_t),
+                     write(object.children[ci]));
+      }
+      return position;
+    }
+    case Flatbuffer_Object::Kind::table:
+      return write_table(object);
+    }
+    return position;
+  }
+
+  size_t write_table(const Flatbuffer_Object &table) {
+    // Placing the largest fields first (after the table's vtable
+    // offset) minimizes the padding between them:
+    std::vector<const Flatbuffer_Object::Field *> fields;
+    int slot_count = 0;
+    size_t alignment = 4;
+    for (const Flatbuffer_Object::Field &field : table.fields) {
+      fields.push_back(&field);
+      slot_count = std::max(slot_count, field.slot + 1);
+      alignment = std::max(alignment, field.size);
+    }
+    std::ranges::stable_sort(fields, std::greater<>(),
+                             &Flatbuffer_Object::Field::size);
+    std::vector<uint16_t> vtable(2 + slot_count, 0);
+    size_t table_size = sizeof(int32_t);
+    std::vector<size_t> field_offsets;
+    for (const Flatbuffer_Object::Field *field : fields) {
+      table_size = (table_size + field->size - 1) / field->size * field->size;
+      field_offsets.push_back(table_size);
+      vtable[2 + field->slot] = static_cast<uint16_t>(table_size);
+      table_size += field->size;
+    }
+    vtable[0] = static_cast<uint16_t>(vtable.size() * sizeof(uint16_t));
+    vtable[1] = static_cast<uint16_t>(table_size);
+
+    pad_to(2);
+    size_t vtable_position = bytes_.size();
+    bytes_.append(reinterpret_cast<const char *>(vtable.data()),
+                  vtable.size() * sizeof(uint16_t));
+    pad_to(alignment);
+    size_t table_position = bytes_.size();
+    bytes_.append(table_size, '\0');
+    // (A table's vtable is found by subtracting this offset from the
+    // table's own position.)
+    int32_t vtable_offset =
+        static_cast<int32_t>(table_position - vtable_position);
+    std::memcpy(&bytes_[table_position], &vtable_offset, sizeof(int32_t));
+    for (size_t fi = 0; fi < fields.size(); fi++) {
+      if (fields[fi]->child < 0) {
+        std::memcpy(&bytes_[table_position + field_offsets[fi]],
+                    &fields[fi]->value, fields[fi]->size);
+      }
+    }
+    for (size_t fi = 0; fi < fields.size(); fi++) {
+      if (fields[fi]->child >= 0) {
+        patch_offset(table_position + field_offsets[fi],
+                     write(table.children[fields[fi]->child]));
+      }
+    }
+    return table_position;
+  }
+
+  template <typename T> void append(T value) {
+    bytes_.append(reinterpret_cast<const char *>(&value), sizeof(T));
+  }
+  void pad_to(size_t alignment) {
+    bytes_.resize((bytes_.size() + alignment - 1) / alignment * alignment,
+                  '\0');
+  }
+  void patch_offset(size_t position, size_t target) {
+    uint32_t offset = static_cast<uint32_t>(target - position);
+    std::memcpy(&bytes_[position], &offset, sizeof(uint32_t));
+  }
+
+  std::string bytes_;
+};
+
+// The identifiers that Arrow's Schema.fbs and Message.fbs assign to
+// the types and values used below:
+constexpr uint64_t arrow_metadata_v5 = 4;
+constexpr uint64_t arrow_type_int = 2;
+constexpr uint64_t arrow_type_floating_point = 3;
+constexpr uint64_t arrow_type_utf8 = 5;
+constexpr uint64_t arrow_precision_double = 2;
+constexpr uint64_t arrow_header_schema = 1;
+constexpr uint64_t arrow_header_dictionary_batch = 2;
+constexpr uint64_t arrow_header_record_batch = 3;
+
+static Flatbuffer_Object arrow_int_type(int bit_width) {
+  Flatbuffer_Object int_type;
+  // (bitWidth, then is_signed)
+  int_type.add_scalar(0, 4, bit_width).add_scalar(1, 1, 1);
+  return int_type;
+}
+
+static Flatbuffer_Object arrow_field(std::string_view name,
+                                     uint64_t type_id,
+                                     Flatbuffer_Object type,
+                                     int64_t dictionary_id = -1) {
+  /* Creating a Field table (whose slots are name, nullable, type_type,
+  type, dictionary, and children). */
+  Flatbuffer_Object field;
+  field.add_child(0, flatbuffer_string(name))
+      .add_scalar(1, 1, 0)
+      .add_scalar(2, 1, type_id)
+      .add_child(3, std::move(type));
+  if (dictionary_id >= 0) {
+    // (DictionaryEncoding's slots are id, indexType, and isOrdered.)
+    Flatbuffer_Object dictionary;
+    dictionary.add_scalar(0, 8, dictionary_id)
+        .add_child(1, arrow_int_type(32))
+        .add_scalar(2, 1, 0);
+    field.add_child(4, std::move(dictionary));
+  }
+  field.add_child(5, flatbuffer_vector({}));
+  return field;
+}
+
+static Flatbuffer_Object arrow_schema(const Pivot_Columns &columns) {
+  std::vector<Flatbuffer_Object> fields;
+  for (size_t ifi = 0; ifi < columns.index_fields.size(); ifi++) {
+    fields.push_back(arrow_field(columns.index_fields[ifi], arrow_type_utf8,
+                                 Flatbuffer_Object{}, ifi));
+  }
+  for (const Pivot_Value_Column &column : columns.value_columns) {
+    if (column.is_integer) {
+      fields.push_back(
+          arrow_field(column.name, arrow_type_int, arrow_int_type(64)));
+    } else {
+      Flatbuffer_Object floating_point;
+      floating_point.add_scalar(0, 2, arrow_precision_double);
+      fields.push_back(arrow_field(column.name, arrow_type_floating_point,
+                                   std::move(floating_point)));
+    }
+  }
+  // (Schema's slots are endianness, which defaults to little-endian,
+  // and fields.)
+  Flatbuffer_Object schema;
+  schema.add_child(1, flatbuffer_vector(std::move(fields)));
+  return schema;
+}
+
+// The body of a record batch, along with the field nodes and buffer
+// locations that its metadata will describe:
+struct Arrow_Body {
+  std::string bytes;
+  std::string nodes;
+  size_t node_count{0};
+  std::string buffers;
+  size_t buffer_count{0};
+
+  void add_node(int64_t length) {
+    int64_t node[2] = {length, 0}; // (length, then null_count)
+    nodes.append(reinterpret_cast<const char *>(node), sizeof(node));
+    node_count++;
+  }
+  void add_buffer(const void *data, size_t size) {
+    int64_t buffer[2] = {static_cast<int64_t>(bytes.size()),
+                         static_cast<int64_t>(size)};
+    buffers.append(reinterpret_cast<const char *>(buffer), sizeof(buffer));
+    buffer_count++;
+    if (size > 0) {
+      bytes.append(static_cast<const char *>(data), size);
+    }
+    bytes.resize((bytes.size() + 7) / 8 * 8, '\0');
+  }
+  // Adds a column without nulls (and thus with an empty validity
+  // buffer) whose values are stored within a single buffer.
+  template <typename T> void add_column(const std::vector<T> &values) {
+    add_node(values.size());
+    add_buffer(nullptr, 0);
+    add_buffer(values.data(), values.size() * sizeof(T));
+  }
+
+  Flatbuffer_Object record_batch(int64_t length) const {
+    // (RecordBatch's slots are length, nodes, and buffers.)
+    Flatbuffer_Object batch;
+    batch.add_scalar(0, 8, length)
+        .add_child(1, flatbuffer_struct_vector(nodes, node_count))
+        .add_child(2, flatbuffer_struct_vector(buffers, buffer_count));
+    return batch;
+  }
+};
+
+// The location of a message within an Arrow file, as recorded within
+// the file's footer:
+struct Arrow_Block {
+  int64_t offset;
+  int32_t metadata_length;
+  int32_t padding{0};
+  int64_t body_length;
+};
+
+static Arrow_Block write_arrow_message(Binary_Writer &writer,
+                                       uint64_t header_type,
+                                       Flatbuffer_Object header,
+                                       const std::string &body) {
+  /* Writing an encapsulated message: a continuation marker, the size
+  of the message's (padded) metadata, the metadata itself, and then
+  the message's body. (Message's slots are version, header_type,
+  header, and bodyLength.) */
+  Flatbuffer_Object message;
+  message.add_scalar(0, 2, arrow_metadata_v5)
+      .add_scalar(1, 1, header_type)
+      .add_child(2, std::move(header))
+      .add_scalar(3, 8, body.size());
+  std::string metadata = Flatbuffer_Builder().finish(message);
+  Arrow_Block block{static_cast<int64_t>(writer.position()),
+                    static_cast<int32_t>(8 + metadata.size()), 0,
+                    static_cast<int64_t>(body.size())};
+  writer.write<uint32_t>(0xFFFFFFFF);
+  writer.write<int32_t>(static_cast<int32_t>(metadata.size()));
+  writer.write_bytes(metadata.data(), metadata.size());
+  writer.write_bytes(body.data(), body.size());
+  return block;
+}
+
+void write_arrow_file(const Pivot_Columns &columns,
+                      const std::string &file_path) {
+  // (Dictionary codes are stored as int32 values, and utf8 offsets
+  // are int32 values as well.)
+  constexpr size_t max_int32 = std::numeric_limits<int32_t>::max();
+  if (columns.row_count > max_int32) {
+    throw std::runtime_error("Pivot tables with more than 2^31 rows can't "
+                             "be saved as Arrow files.");
+  }
+
+  Binary_Writer writer(file_path);
+  static const char magic[8] = {'A', 'R', 'R', 'O', 'W', '1', 0, 0};
+  writer.write_bytes(magic, sizeof(magic));
+  write_arrow_message(writer, arrow_header_schema, arrow_schema(columns),
+                      "");
+
+  std::vector<Arrow_Block> dictionary_blocks;
+  for (size_t ifi = 0; ifi < columns.index_columns.size(); ifi++) {
+    const std::vector<std::string> &values =
+        columns.index_columns[ifi].dictionary.values;
+    std::vector<int32_t> offsets{0};
+    std::string data;
+    for (const std::string &value : values) {
+      data += value;
+      if (data.size() > max_int32) {
+        throw std::runtime_error("The " + columns.index_fields[ifi] +
+                                 " column is too large to be saved as an "
+                                 "Arrow file.");
+      }
+      offsets.push_back(static_cast<int32_t>(data.size()));
+    }
+    Arrow_Body body;
+    body.add_node(values.size());
+    body.add_buffer(nullptr, 0);
+    body.add_buffer(offsets.data(), offsets.size() * sizeof(int32_t));
+    body.add_buffer(data.data(), data.size());
+    // (DictionaryBatch's slots are id and data.)
+    Flatbuffer_Object dictionary_batch;
+    dictionary_batch.add_scalar(0, 8, ifi).add_child(
+        1, body.record_batch(values.size()));
+    dictionary_blocks.push_back(
+        write_arrow_message(writer, arrow_header_dictionary_batch,
+                            std::move(dictionary_batch), body.bytes));
+  }
+
+  // (The codes of each String_Column can be written as they are, since
+  // they never exceed the dictionary's size.)
+  Arrow_Body body;
+  for (const String_Column &index_column : columns.index_columns) {
+    body.add_column(index_column.codes);
+  }
+  for (const Pivot_Value_Column &column : columns.value_columns) {
+    if (column.is_integer) {
+      body.add_column(column.integers);
+    } else {
+      body.add_column(column.doubles);
+    }
+  }
+  Arrow_Block record_batch_block =
+      write_arrow_message(writer, arrow_header_record_batch,
+                          body.record_batch(columns.row_count), body.bytes);
+
+  // Writing the end-of-stream marker, then the footer (whose slots are
+  // version, schema, dictionaries, and recordBatches), its size, and
+  // the closing magic number:
+  writer.write<uint32_t>(0xFFFFFFFF);
+  writer.write<int32_t>(0);
+  std::string dictionary_block_bytes(
+      reinterpret_cast<const char *>(dictionary_blocks.data()),
+      dictionary_blocks.size() * sizeof(Arrow_Block));
+  std::string record_batch_block_bytes(
+      reinterpret_cast<const char *>(&record_batch_block),
+      sizeof(Arrow_Block));
+  Flatbuffer_Object footer;
+  footer.add_scalar(0, 2, arrow_metadata_v5)
+      .add_child(1, arrow_schema(columns))
+      .add_child(2, flatbuffer_struct_vector(dictionary_block_bytes,
+                                             dictionary_blocks.size()))
+      .add_child(3, flatbuffer_struct_vector(record_batch_block_bytes, 1));
+  std::string footer_bytes = Flatbuffer_Builder().finish(footer);
+  writer.write_bytes(footer_bytes.data(), footer_bytes.size());
+  writer.write<int32_t>(static_cast<int32_t>(footer_bytes.size()));
+  writer.write_bytes(magic, 6);
+  writer.finish();
+}
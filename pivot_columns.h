@@ -0,0 +1,63 @@
+// pivot_columns.h
+// Released under the MIT License
+
+// This header defines Pivot_Columns, which stores a pivot table's
+// output as typed columns (rather than as .csv text), along with a
+// function that saves these columns as an Arrow IPC file.
+// Documentation on these types is available within pivot_columns.cpp.
+
+#pragma once
+
+#include "columnar_table.h"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// One of a pivot table's aggregate columns (such as PASSENGERS_Sum).
+// Counts are stored as integers; all other aggregates are stored as
+// doubles.
+struct Pivot_Value_Column {
+  std::string name;
+  bool is_integer{false};
+  std::vector<double> doubles;
+  std::vector<int64_t> integers;
+};
+
+struct Pivot_Columns {
+  size_t row_count{0};
+  // Each index field is stored as its own dictionary-encoded column
+  // (rather than as part of a pipe-separated pivot index).
+  std::vector<std::string> index_fields;
+  std::vector<String_Column> index_columns;
+  std::vector<Pivot_Value_Column> value_columns;
+
+  // These functions throw a std::runtime_error if the table doesn't
+  // contain the requested column.
+  const String_Column &index_column(const std::string &field) const;
+  const Pivot_Value_Column &value_column(const std::string &name) const;
+
+  // A Csv_Output_Writer that collects columns (see csv_output.h) adds
+  // each field of the table's header and rows via these functions.
+  // Throws a std::runtime_error if a row's pivot index doesn't contain
+  // one value for each index field, or if its values don't match the
+  // header's columns.
+  void add_text(std::string_view text);
+  void add_value(double value);
+  void add_value(int64_t value);
+  void end_row();
+
+private:
+  Pivot_Value_Column &next_value_column();
+
+  bool header_complete_{false};
+  // The number of fields added to the current row so far:
+  size_t row_fields_{0};
+};
+
+// Saves columns to file_path in the Arrow IPC file format (which
+// pyarrow, pandas, Polars, DuckDB, and R's arrow package can all read
+// without any parsing). Throws a std::runtime_error if the file can't
+// be written.
+void write_arrow_file(const Pivot_Columns &columns,
+                      const std::string &file_path);
@@ -7,24 +7,56 @@
 // a dataset into a smaller, easier-to-handle file.
 
 #include "pivot_compressors.h"
+#include "columnar_table.h"
+#include "compressed_input.h"
+#include "csv_output.h"
+#include "binary_io.h"
+#include "csv_projection.h"
+#include "dictionary_encoding.h"
+#include "mapped_file.h"
+#include "pivot_columns.h"
+#include "pivot_hash_table.h"
+#include "row_filter.h"
+#include "sample_estimator.h"
+#include "spsc_queue.h"
 #include "csv.hpp"
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <exception>
+#include <filesystem>
+#include <fstream>
 #include <functional>
+#include <glob.h>
+#include <iterator>
 #include <iostream>
+#include <istream>
+#include <limits>
 #include <map>
+#include <memory>
+#include <memory_resource>
 #include <numeric> // for std::accumulate
+#include <optional>
+#include <queue>
+#include <random>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
 
 using namespace csv;
 
 void scan_to_pivot(
     std::string &data_file_path, std::vector<std::string> &value_fields,
     std::string index_headers, long &rows_to_scan, std::string &pivot_file_path,
-    std::function<std::string(CSVRow)> index_gen,
+    std::function<std::string(const CSVRow &)> index_gen,
     std::map<std::string, std::vector<std::string>> &include_map,
-    std::map<std::string, std::vector<std::string>> &exclude_map) {
+    std::map<std::string, std::vector<std::string>> &exclude_map,
+    const Scan_Options &options, Pivot_Stats *stats) {
   /*This function creates a pivot table by scanning through a
   .csv file (rather than importing all of it into your RAM), thus making
   it more feasible to process very large .csv files on computers with
@@ -58,7 +90,7 @@ void scan_to_pivot(
   as your pivot index, you would pass the following argument to the
   pivot_gen parameter:
 
-  [&](CSVRow row) -> std::string {
+  [&](const CSVRow &row) -> std::string {
         return {row["CARRIER"].get() + "|" + row["ORIGIN"].get()};
       }
 
@@ -89,20 +121,2890 @@ void scan_to_pivot(
   std::map<std::string, std::vector<std::string>> exclude_map{
       {"DEST_COUNTRY", {"US"}}};
 
+  options (optional): A Scan_Options struct that allows the file to get
+  scanned in parallel. See scan_to_multi_pivot() for more details.
 
+  stats (optional): A pointer to a Pivot_Stats struct that will receive
+  a breakdown of this function's running time. (See
+  scan_to_multi_pivot().)
+
+  If you need several pivot tables from the same .csv file, consider
+  calling scan_to_multi_pivot() instead; it will produce all of them
+  while reading through the file only once.
 
 
   (More documentation to come)
   */
 
+  // Packaging these arguments into a single Pivot_Spec so that
+  // scan_to_multi_pivot() (which contains the actual scanning code)
+  // can process them:
+  std::vector<Pivot_Spec> pivot_specs{{value_fields, index_headers, index_gen,
+                                       include_map, exclude_map,
+                                       pivot_file_path, {}, {}, {}, {}, {}}};
+  scan_to_multi_pivot(data_file_path, pivot_specs, rows_to_scan, options,
+                      stats);
+}
+
+// The maximum number of run files that a k-way merge will read at
+// once; if a table has spilled more runs than this, groups of runs get
+// merged into larger runs first. (This limits the number of files
+// that need to be open simultaneously.)
+constexpr size_t max_merged_runs = 64;
+
+// The size of the first block that each Pivot_Table_State's key arena
+// will request; each later block will be larger than the last.
+constexpr size_t key_arena_block_bytes = 64 * 1024;
+
+// The sorted runs that a Pivot_Table_State has spilled to disk (see
+// Pivot_Table_State::spill()). These files get deleted once the state
+// that owns them is destroyed.
+class Spill_Files {
+public:
+  Spill_Files() = default;
+  Spill_Files(Spill_Files &&other) noexcept
+      : paths(std::exchange(other.paths, {})) {}
+  Spill_Files &operator=(Spill_Files &&other) noexcept {
+    remove_all();
+    paths = std::exchange(other.paths, {});
+    return *this;
+  }
+  ~Spill_Files() { remove_all(); }
+
+  // Returns (and takes ownership of) a new file path within directory,
+  // or within the system's temporary directory if directory is empty.
+  std::string new_path(const std::string &directory) {
+    // (The random component keeps separate processes that share a
+    // directory from colliding, while the counter does the same for
+    // states within this process.)
+    static const unsigned process_id = std::random_device{}();
+    static std::atomic<uint64_t> spill_count{0};
+    std::filesystem::path spill_directory =
+        directory.empty() ? std::filesystem::temp_directory_path()
+                          : std::filesystem::path(directory);
+    paths.push_back(
+        (spill_directory / ("cpp_pt_spill_" + std::to_string(process_id) +
+                            "_" + std::to_string(spill_count++) + ".bin"))
+            .string());
+    return paths.back();
+  }
+  // Takes ownership of all of other's files.
+  void take(Spill_Files &other) {
+    paths.insert(paths.end(), other.paths.begin(), other.paths.end());
+    other.paths.clear();
+  }
+
+  std::vector<std::string> paths;
+
+private:
+  void remove_all() {
+    std::error_code error; // (Cleanup failures are ignored.)
+    for (const std::string &path : paths) {
+      std::filesystem::remove(path, error);
+    }
+    paths.clear();
+  }
+};
+
+// A run file that's being read back during a k-way merge, along with
+// its current group:
+struct Spilled_Run {
+  Binary_Reader reader;
+  std::string pivot_index;
+  std::vector<Pivot_Vals> vals;
+};
+
+// The per-row phases whose time Row_Phase_Timer can measure:
+enum class Row_Phase { filter, key_build, aggregate };
+
+// Measures the time that a pivot table spends within each Row_Phase
+// (see Pivot_Stats). Reading the clock several times for every row
+// would noticeably slow down the scan, so only one in every
+// sample_interval rows gets timed; each phase's total is then
+// extrapolated from these samples. (Timing is disabled unless
+// enable() gets called.)
+class Row_Phase_Timer {
+public:
+  static constexpr long sample_interval = 64;
+
+  void enable() { enabled_ = true; }
+
+  // Called before each row gets processed; determines whether this
+  // row's phases will be timed.
+  void start_row() {
+    if (!enabled_) {
+      return;
+    }
+    rows_++;
+    sampling_ = (--countdown_ == 0);
+    if (sampling_) {
+      countdown_ = sample_interval;
+      sampled_rows_++;
+      phase_start_ = std::chrono::steady_clock::now();
+    }
+  }
+  // Called once the current row's phase has finished; the next phase
+  // (if any) begins at this point.
+  void end_phase(Row_Phase phase) {
+    if (sampling_) {
+      auto now = std::chrono::steady_clock::now();
+      sampled_seconds_[static_cast<size_t>(phase)] +=
+          std::chrono::duration<double>(now - phase_start_).count();
+      phase_start_ = now;
+    }
+  }
+
+  // Adds the time that an entire block of rows spent within phase (for
+  // phases that process rows a block at a time rather than one by one).
+  void add_block_seconds(Row_Phase phase, double seconds) {
+    if (enabled_) {
+      block_seconds_[static_cast<size_t>(phase)] += seconds;
+    }
+  }
+
+  // Returns the estimated total time spent within phase.
+  double seconds(Row_Phase phase) const {
+    double block_seconds = block_seconds_[static_cast<size_t>(phase)];
+    return (sampled_rows_ == 0) ? block_seconds
+                                : sampled_seconds_[static_cast<size_t>(phase)] *
+                                          rows_ / sampled_rows_ +
+                                      block_seconds;
+  }
+
+  // Adds other's samples (e.g. from another thread) to this timer's.
+  void merge(const Row_Phase_Timer &other) {
+    rows_ += other.rows_;
+    sampled_rows_ += other.sampled_rows_;
+    for (size_t phase = 0; phase < sampled_seconds_.size(); phase++) {
+      sampled_seconds_[phase] += other.sampled_seconds_[phase];
+      block_seconds_[phase] += other.block_seconds_[phase];
+    }
+  }
+
+private:
+  bool enabled_{false};
+  bool sampling_{false};
+  // (The first row gets sampled, so that short scans still produce
+  // an estimate.)
+  long countdown_{1};
+  long rows_{0};
+  long sampled_rows_{0};
+  std::array<double, 3> sampled_seconds_{};
+  std::array<double, 3> block_seconds_{};
+  std::chrono::steady_clock::time_point phase_start_;
+};
+
+// The in-progress results of a single pivot table: (Only the member
+// that corresponds to the selected Pivot_Backend will actually get used.)
+struct Pivot_Table_State {
+  Pivot_Table_State(Pivot_Backend backend, size_t value_count,
+                    size_t index_field_count = 0,
+                    Missing_Value_Policy missing_values =
+                        Missing_Value_Policy::error,
+                    const std::vector<Aggregate_Set> &aggregate_sets = {})
+      : backend(backend), value_count(value_count),
+        key_arena(std::make_unique<std::pmr::monotonic_buffer_resource>(
+            key_arena_block_bytes)),
+        pivot_map(key_arena.get()), hash_table(value_count, key_arena.get()),
+        index_dictionaries(index_field_count), index_codes(index_field_count),
+        coded_table(index_field_count, value_count),
+        missing_values(missing_values), missing_counts(value_count, 0),
+        aggregates(aggregate_sets), coded_aggregates(aggregate_sets) {}
+
+  // Returns the value_count accumulators that correspond to
+  // pivot_index (stored contiguously and in the same order as
+  // value_fields), first creating them if this pivot_index hasn't
+  // been encountered yet. Either way, only one search is needed.
+  // (As with Pivot_Hash_Table, this pointer will be invalidated by
+  // the next insertion.)
+  Pivot_Vals *find_or_insert(std::string_view pivot_index) {
+    if (backend == Pivot_Backend::hash_table) {
+      size_t group_count = hash_table.size();
+      Pivot_Vals *pivot_vals = hash_table.find_or_insert(pivot_index);
+      if (hash_table.size() != group_count) {
+        key_bytes += pivot_index.size();
+      }
+      return pivot_vals;
+    }
+    // lower_bound() finds either pivot_index's group or the position
+    // at which a new group (whose value_count zero-initialized
+    // Pivot_Vals objects get appended to map_vals) should be inserted.
+    // (I had previously called contains(), then added these objects
+    // one at a time, then looked up pivot_index twice more for each
+    // value field.)
+    auto map_it = pivot_map.lower_bound(pivot_index);
+    if ((map_it == pivot_map.end()) || (map_it->first != pivot_index)) {
+      map_it = pivot_map.emplace_hint(map_it, pivot_index, pivot_map.size());
+      map_vals.resize(map_vals.size() + value_count);
+      key_bytes += pivot_index.size();
+    }
+    return &map_vals[map_it->second * value_count];
+  }
+
+  // Returns the number of the group whose accumulators were just
+  // returned by find_or_insert(). (These numbers identify each group's
+  // additional aggregates.)
+  size_t group_of(const Pivot_Vals *pivot_vals) const {
+    if (backend == Pivot_Backend::hash_table) {
+      return hash_table.group_of(pivot_vals);
+    }
+    return (pivot_vals - map_vals.data()) / value_count;
+  }
+
+  // Adding the sums and counts (and additional aggregates) of a group
+  // from another table to the group that corresponds to pivot_index.
+  void add_group(std::string_view pivot_index, const Pivot_Vals *source_vals,
+                 const Aggregate_Table &source_aggregates,
+                 size_t source_group) {
+    Pivot_Vals *target_vals = find_or_insert(pivot_index);
+    for (int vfi = 0; vfi < value_count; vfi++) {
+      target_vals[vfi].pivot_sum += source_vals[vfi].pivot_sum;
+      target_vals[vfi].pivot_count += source_vals[vfi].pivot_count;
+    }
+    if (aggregates.enabled()) {
+      aggregates.merge_group(group_of(target_vals), source_aggregates,
+                             source_group);
+    }
+  }
+
+  // Adding each group within coded_groups (whose dictionary codes
+  // can be converted back into strings via dictionaries, and whose
+  // additional aggregates are stored within group_aggregates) to this
+  // state's string-keyed table. This is the point at which each
+  // group's pipe-separated pivot index finally gets created.
+  void add_coded_groups(Coded_Group_Table &coded_groups,
+                        const std::vector<const String_Dictionary *>
+                            &dictionaries,
+                        const Aggregate_Table &group_aggregates) {
+    for (size_t group = 0; group < coded_groups.size(); group++) {
+      std::string pivot_index;
+      for (size_t field = 0; field < dictionaries.size(); field++) {
+        if (field > 0) {
+          pivot_index += "|";
+        }
+        pivot_index +=
+            dictionaries[field]->values[coded_groups.code(group, field)];
+      }
+      add_group(pivot_index, coded_groups.vals(group), group_aggregates,
+                group);
+    }
+  }
+
+  // Moving any groups within coded_table (along with their
+  // accumulators) into the string-keyed table. This needs to happen
+  // before a state gets merged or written out.
+  void finish_coded_groups() {
+    note_peak_bytes();
+    std::vector<const String_Dictionary *> dictionaries;
+    for (String_Dictionary &dictionary : index_dictionaries) {
+      dictionaries.push_back(&dictionary);
+    }
+    add_coded_groups(coded_table, dictionaries, coded_aggregates);
+    coded_table.clear();
+    coded_aggregates.clear();
+  }
+
+  // The number of groups within the string-keyed table:
+  size_t size() const {
+    return (backend == Pivot_Backend::hash_table) ? hash_table.size()
+                                                  : pivot_map.size();
+  }
+
+  // Calling function(pivot_index, pivot_vals, group) for each row of
+  // the pivot table in alphabetical order: (If any groups have been
+  // spilled, the remaining groups get spilled as well, and all runs
+  // are then merged; group will then refer to a scratch group within
+  // aggregates that's overwritten for each row.)
+  template <typename Function> void for_each_sorted(Function function) {
+    if (spilled()) {
+      spill();
+      compact_spilled_runs();
+      merge_spilled_runs(spill_files.paths, function);
+      return;
+    }
+    for_each_sorted_in_memory(function);
+  }
+
+  // Calling function(pivot_index, pivot_vals, group) for each group
+  // within the string-keyed table in alphabetical order:
+  template <typename Function>
+  void for_each_sorted_in_memory(Function function) {
+    if (backend == Pivot_Backend::hash_table) {
+      // Sorting the hash table's keys so that the output will match
+      // that of the ordered_map backend:
+      for (size_t group : hash_table.sorted_groups()) {
+        function(hash_table.key(group), hash_table.vals(group), group);
+      }
+    } else {
+      for (auto &[pivot_index, group] : pivot_map) {
+        function(pivot_index, &map_vals[group * value_count], group);
+      }
+    }
+  }
+
+  // Calling function(pivot_index, pivot_vals, group) for each row of
+  // the pivot table in no particular order, which spares a hash table
+  // from sorting its keys. (Spilled groups still get merged in order,
+  // as they are within for_each_sorted().)
+  template <typename Function> void for_each_group(Function function) {
+    if (spilled() || (backend != Pivot_Backend::hash_table)) {
+      for_each_sorted(function);
+      return;
+    }
+    for (size_t group = 0; group < hash_table.size(); group++) {
+      function(hash_table.key(group), hash_table.vals(group), group);
+    }
+  }
+
+  // Approximates the memory used by this state's groups. Each
+  // string-keyed group needs its key plus roughly 64 bytes of
+  // bookkeeping (a map node, or a hash table's key object, hash, and
+  // slots), whereas each coded group needs about 24. (The index
+  // dictionaries aren't counted, since they can't be spilled.)
+  size_t approximate_bytes() const {
+    size_t group_bytes = value_count * sizeof(Pivot_Vals) +
+                         aggregates.approximate_group_bytes();
+    return size() * (group_bytes + 64) + key_bytes +
+           coded_table.size() * (group_bytes + 24);
+  }
+
+  // Updating peak_bytes with the state's current size. (Since
+  // tables only shrink when they're spilled or merged, this gets
+  // called beforehand.)
+  void note_peak_bytes() {
+    peak_bytes = std::max(peak_bytes, approximate_bytes());
+  }
+
+  // Spilling this state's groups if they've exceeded memory_budget.
+  void check_memory_budget() {
+    if ((memory_budget > 0) && (approximate_bytes() > memory_budget)) {
+      spill();
+    }
+  }
+
+  bool spilled() const { return !spill_files.paths.empty(); }
+
+  // Writing every group (in sorted order) to a new run file, then
+  // emptying the in-memory tables (and the key arena) so that their
+  // memory can be reused.
+  void spill() {
+    finish_coded_groups();
+    note_peak_bytes();
+    if (size() == 0) {
+      return;
+    }
+    Binary_Writer writer(spill_files.new_path(spill_directory));
+    for_each_sorted_in_memory([&](std::string_view pivot_index,
+                                  Pivot_Vals *pivot_vals, size_t group) {
+      write_spilled_group(writer, pivot_index, pivot_vals, group);
+    });
+    writer.finish();
+    // (The containers must release their keys before the arena does.)
+    pivot_map.clear();
+    map_vals = {};
+    hash_table.clear();
+    aggregates.clear();
+    key_arena->release();
+    key_bytes = 0;
+  }
+
+  // Each run file simply stores one group after another (in sorted
+  // order): its key, then its sums and counts, then its additional
+  // aggregates (from the specified group of this state's aggregates).
+  void write_spilled_group(Binary_Writer &writer, std::string_view pivot_index,
+                           const Pivot_Vals *pivot_vals, size_t group) {
+    writer.write_string(pivot_index);
+    for (int vfi = 0; vfi < value_count; vfi++) {
+      writer.write<double>(pivot_vals[vfi].pivot_sum);
+      writer.write<int64_t>(pivot_vals[vfi].pivot_count);
+    }
+    if (aggregates.enabled()) {
+      aggregates.save_group(writer, group);
+    }
+  }
+
+  // Merging the oldest max_merged_runs runs into a single run until
+  // no more than max_merged_runs remain.
+  void compact_spilled_runs() {
+    while (spill_files.paths.size() > max_merged_runs) {
+      Spill_Files merged_runs; // (These get deleted once they're merged.)
+      merged_runs.paths.assign(spill_files.paths.begin(),
+                               spill_files.paths.begin() + max_merged_runs);
+      spill_files.paths.erase(spill_files.paths.begin(),
+                              spill_files.paths.begin() + max_merged_runs);
+      Binary_Writer writer(spill_files.new_path(spill_directory));
+      merge_spilled_runs(merged_runs.paths,
+                         [&](std::string_view pivot_index,
+                             Pivot_Vals *pivot_vals, size_t group) {
+                           write_spilled_group(writer, pivot_index,
+                                               pivot_vals, group);
+                         });
+      writer.finish();
+    }
+  }
+
+  // Merging the sorted runs within run_paths via a k-way merge: only
+  // the current group of each run is held in memory, and groups with
+  // the same key (which will have come from different runs) get
+  // combined before function(pivot_index, pivot_vals, group) is called
+  // for them. (group always refers to group 0 of this state's
+  // aggregates, which gets overwritten for each merged group.)
+  template <typename Function>
+  void merge_spilled_runs(const std::vector<std::string> &run_paths,
+                          Function function) {
+    std::vector<Spilled_Run> runs;
+    runs.reserve(run_paths.size());
+    // Each run's current aggregates are stored within the group of
+    // run_aggregates that matches the run's position within runs.
+    Aggregate_Table run_aggregates = aggregates;
+    // Reads the next group of runs[run_index], returning false once
+    // the run is exhausted.
+    auto read_group = [&](size_t run_index) {
+      Spilled_Run &run = runs[run_index];
+      if (run.reader.at_end()) {
+        return false;
+      }
+      run.pivot_index = run.reader.read_string();
+      for (Pivot_Vals &pivot_vals : run.vals) {
+        pivot_vals.pivot_sum = run.reader.read<double>();
+        pivot_vals.pivot_count = run.reader.read<int64_t>();
+      }
+      if (run_aggregates.enabled()) {
+        run_aggregates.reset_group(run_index);
+        run_aggregates.load_group(run.reader, run_index);
+      }
+      return true;
+    };
+    // (std::priority_queue places its largest element on top, so runs
+    // are compared in reverse.)
+    auto later_run = [&](size_t a, size_t b) {
+      return runs[a].pivot_index > runs[b].pivot_index;
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(later_run)>
+        run_queue(later_run);
+    for (const std::string &path : run_paths) {
+      runs.emplace_back(Binary_Reader(path), std::string(),
+                        std::vector<Pivot_Vals>(value_count));
+      if (read_group(runs.size() - 1)) {
+        run_queue.push(runs.size() - 1);
+      }
+    }
+
+    std::string pivot_index;
+    std::vector<Pivot_Vals> merged_vals(value_count);
+    while (!run_queue.empty()) {
+      pivot_index = runs[run_queue.top()].pivot_index;
+      std::ranges::fill(merged_vals, Pivot_Vals{});
+      if (aggregates.enabled()) {
+        aggregates.reset_group(0);
+      }
+      while (!run_queue.empty() &&
+             (runs[run_queue.top()].pivot_index == pivot_index)) {
+        size_t run_index = run_queue.top();
+        run_queue.pop();
+        for (int vfi = 0; vfi < value_count; vfi++) {
+          merged_vals[vfi].pivot_sum += runs[run_index].vals[vfi].pivot_sum;
+          merged_vals[vfi].pivot_count +=
+              runs[run_index].vals[vfi].pivot_count;
+        }
+        if (aggregates.enabled()) {
+          aggregates.merge_group(0, run_aggregates, run_index);
+        }
+        if (read_group(run_index)) {
+          run_queue.push(run_index);
+        }
+      }
+      function(std::string_view(pivot_index), merged_vals.data(), 0);
+    }
+  }
+
+  // Adding the sum and count values (and additional aggregates)
+  // within source_state to those within this state. (This works
+  // because sums and counts can be combined in any order; means, on
+  // the other hand, only get calculated once all partial results
+  // have been merged.)
+  void merge(Pivot_Table_State &source_state) {
+    for (int vfi = 0; vfi < value_count; vfi++) {
+      missing_counts[vfi] += source_state.missing_counts[vfi];
+    }
+    rows_filtered_out += source_state.rows_filtered_out;
+    row_timer.merge(source_state.row_timer);
+    source_state.note_peak_bytes();
+    peak_bytes = std::max(peak_bytes, source_state.peak_bytes);
+    if (source_state.spilled()) {
+      // Rather than being read back in, the source's runs (including
+      // one for its remaining groups) get merged along with this
+      // state's own runs once the table is written out.
+      source_state.spill();
+      spill_files.take(source_state.spill_files);
+      return;
+    }
+    if (backend == Pivot_Backend::hash_table) {
+      Pivot_Hash_Table<std::pmr::string, String_Hash> &source_table =
+          source_state.hash_table;
+      for (size_t group = 0; group < source_table.size(); group++) {
+        add_group(source_table.key(group), source_table.vals(group),
+                  source_state.aggregates, group);
+        check_memory_budget();
+      }
+      return;
+    }
+    for (auto &[pivot_index, group] : source_state.pivot_map) {
+      add_group(pivot_index, &source_state.map_vals[group * value_count],
+                source_state.aggregates, group);
+      check_memory_budget();
+    }
+  }
+
+  Pivot_Backend backend;
+  size_t value_count;
+  // Each group's key (whenever it's too long to be stored within the
+  // string itself) and each node of pivot_map get carved out of this
+  // arena, which only returns its memory (all at once) when the state
+  // is destroyed. This avoids a separate heap allocation (and the
+  // resulting fragmentation) for each of these objects. (The arena is
+  // stored via a pointer so that states can still be moved.)
+  std::unique_ptr<std::pmr::monotonic_buffer_resource> key_arena;
+  // Each key will be a unique combination of pivot_index values;
+  // each corresponding value will be the number of that key's group.
+  // Each group's accumulators (an array of structs with the same
+  // length as that of value_fields) are stored contiguously within
+  // map_vals. That way, one struct can be created, and easily
+  // accessed, for each value.
+  // Note: although it results in longer processing time,
+  // I chose to use a regular map here, rather than an unordered
+  // map, because I wanted the final output to be in alphabetical order.
+  std::pmr::map<std::pmr::string, size_t, std::less<>> pivot_map;
+  std::vector<Pivot_Vals> map_vals;
+  // The hash_table backend instead stores its keys in arbitrary order,
+  // then sorts them once the table is ready to be written out.
+  Pivot_Hash_Table<std::pmr::string, String_Hash> hash_table;
+
+  // When a pivot spec's index is defined via index_fields, each
+  // row's index values will get converted into codes (via one
+  // dictionary per index field), and these codes will serve as
+  // the row's key within coded_table. (index_codes is a scratch
+  // buffer that stores the current row's codes.)
+  std::vector<String_Dictionary> index_dictionaries;
+  std::vector<uint32_t> index_codes;
+  Coded_Group_Table coded_table;
+
+  // How blank values will be handled, along with the number of blank
+  // values that have been found within each value field:
+  Missing_Value_Policy missing_values;
+  std::vector<long> missing_counts;
+
+  // The additional aggregates (see aggregates.cpp) of each group
+  // within the string-keyed table and within coded_table:
+  Aggregate_Table aggregates;
+  Aggregate_Table coded_aggregates;
+
+  // The total length of the keys within the string-keyed table:
+  size_t key_bytes{0};
+  // The approximate number of bytes (or 0 for no limit) that this
+  // state's groups may occupy before they get spilled to a run file
+  // within spill_directory (see Scan_Options::memory_budget_bytes):
+  size_t memory_budget{0};
+  std::string spill_directory;
+  Spill_Files spill_files;
+
+  // Measurements for Pivot_Stats: the number of rows that this
+  // table's filter excluded, the sampled time spent within each
+  // phase of add_row_to_pivot(), and the largest approximate size
+  // that the state has reached.
+  long rows_filtered_out{0};
+  Row_Phase_Timer row_timer;
+  size_t peak_bytes{0};
+};
+
+static void calculate_means(Pivot_Vals *pivot_vals, size_t value_count) {
+  /* Calculating means for one row of a pivot table (whose value
+  field accumulators are stored contiguously at pivot_vals). */
+  // (If every value for a given field was skipped, its mean will be
+  // reported as nan.)
+  for (int vfi = 0; vfi < value_count; vfi++) {
+    pivot_vals[vfi].pivot_mean =
+        (pivot_vals[vfi].pivot_count > 0)
+            ? pivot_vals[vfi].pivot_sum / pivot_vals[vfi].pivot_count
+            : std::numeric_limits<double>::quiet_NaN();
+  }
+}
+
+static void write_pivot_header(Csv_Output_Writer &writer,
+                               const std::string &index_headers,
+                               const std::vector<std::string> &value_fields,
+                               const Aggregate_Table *aggregates = nullptr) {
+  /* Writing the header row of a pivot table's .csv output. If
+  aggregates is specified, the names of each value field's additional
+  aggregates will follow its mean. */
+  writer.write_field(index_headers);
+  // Adding pivot value fields to this row: (These will be prefaced
+  // with value field names for easier identification.
+  static const std::array<std::string, 3> value_aggregates{"Sum", "Count",
+                                                           "Mean"};
+  for (const auto &value_field : value_fields) {
+    for (const std::string &aggregate : value_aggregates) {
+      writer.write_field(value_field + "_" + aggregate);
+    }
+    if (aggregates) {
+      aggregates->write_header(writer, &value_field - value_fields.data(),
+                               value_field);
+    }
+  }
+  writer.end_row();
+}
+
+static void write_pivot_row(Csv_Output_Writer &writer,
+                            std::string_view pivot_index,
+                            const Pivot_Vals *pivot_vals, size_t value_count,
+                            Aggregate_Table *aggregates = nullptr,
+                            size_t group = 0) {
+  /* Writing one row of a pivot table (whose value field accumulators
+  are stored contiguously at pivot_vals, and whose means have already
+  been calculated) to writer. If aggregates is specified, group's
+  additional aggregates will be written as well. */
+  writer.write_field(pivot_index);
+  // Adding the sum, count, and mean aggregate values for each
+  // value field to this row:
+  for (int vfi = 0; vfi < value_count; vfi++) {
+    writer.write_field(pivot_vals[vfi].pivot_sum);
+    writer.write_field(pivot_vals[vfi].pivot_count);
+    writer.write_field(pivot_vals[vfi].pivot_mean);
+    if (aggregates) {
+      aggregates->write_fields(writer, group, vfi);
+    }
+  }
+  writer.end_row();
+}
+
+static std::string join_with_pipes(const std::vector<std::string> &fields) {
+  std::string joined_fields = "";
+  for (int j = 0; j < fields.size(); j++) {
+    joined_fields += fields[j];
+    // Adding a spacer between fields:
+    if (j != (fields.size() - 1)) {
+      joined_fields += "|";
+    }
+  }
+  return joined_fields;
+}
+
+std::vector<Pivot_Rollup>
+rollup_levels(const std::vector<std::string> &index_fields) {
+  std::vector<Pivot_Rollup> rollups;
+  for (size_t field_count = index_fields.size(); field_count-- > 0;) {
+    rollups.push_back({std::vector<std::string>(
+                           index_fields.begin(),
+                           index_fields.begin() + field_count),
+                       ""});
+  }
+  return rollups;
+}
+
+// The value that takes the place of each rolled-up index field within
+// the rows that a rollup level appends to its table's own output:
+static constexpr std::string_view rollup_marker = "(All)";
+
+// One of a pivot table's rollup levels (see Pivot_Spec::rollups), whose
+// groups are aggregated within a state of its own:
+struct Rollup_Table {
+  Rollup_Table(const Pivot_Rollup &rollup,
+               const std::vector<std::string> &table_index_fields,
+               Pivot_Backend backend, size_t value_count,
+               const std::vector<Aggregate_Set> &aggregate_sets)
+      : rollup(rollup),
+        state(backend, value_count, 0, Missing_Value_Policy::error,
+              aggregate_sets) {
+    for (const std::string &field : rollup.index_fields) {
+      if (std::ranges::find(table_index_fields, field) ==
+          table_index_fields.end()) {
+        throw std::runtime_error("Unable to roll up " + field +
+                                 ", since it is not one of this pivot "
+                                 "table's index fields.");
+      }
+    }
+    if (appended()) {
+      // (Appended rows keep all of the table's index fields, so that
+      // they'll line up with its other rows.)
+      for (size_t fi = 0; fi < table_index_fields.size(); fi++) {
+        fields.push_back(std::ranges::find(rollup.index_fields,
+                                           table_index_fields[fi]) ==
+                                 rollup.index_fields.end()
+                             ? no_field
+                             : fi);
+      }
+      return;
+    }
+    for (const std::string &field : rollup.index_fields) {
+      fields.push_back(std::ranges::find(table_index_fields, field) -
+                       table_index_fields.begin());
+    }
+    if (fields.empty()) {
+      fields.push_back(no_field); // A grand total
+    }
+  }
+
+  // Whether this level's rows will be appended to the table's output:
+  bool appended() const { return rollup.pivot_file_path.empty(); }
+
+  // Adding a group of the finest table (whose pivot index has been
+  // split into index_values) to the corresponding group of this level.
+  void add_group(const std::vector<std::string_view> &index_values,
+                 const Pivot_Vals *pivot_vals,
+                 const Aggregate_Table &aggregates, size_t group) {
+    pivot_index.clear();
+    for (size_t fi = 0; fi < fields.size(); fi++) {
+      if (fi > 0) {
+        pivot_index += "|";
+      }
+      pivot_index +=
+          (fields[fi] == no_field) ? rollup_marker : index_values[fields[fi]];
+    }
+    state.add_group(pivot_index, pivot_vals, aggregates, group);
+  }
+
+  // For each field within this level's pivot indexes, the position of
+  // the corresponding value within the finest table's pivot indexes,
+  // or no_field if rollup_marker should be written in its place:
+  static constexpr size_t no_field = size_t(-1);
+  Pivot_Rollup rollup;
+  std::vector<size_t> fields;
+  Pivot_Table_State state;
+  std::string pivot_index;
+};
+
+// All of a pivot table's rollup levels:
+struct Rollup_Tables {
+  Rollup_Tables(const std::vector<Pivot_Rollup> &rollups,
+                const std::vector<std::string> &table_index_fields,
+                Pivot_Backend backend, size_t value_count,
+                const std::vector<Aggregate_Set> &aggregate_sets = {})
+      : index_field_count(table_index_fields.size()) {
+    for (const Pivot_Rollup &rollup : rollups) {
+      levels.emplace_back(rollup, table_index_fields, backend, value_count,
+                          aggregate_sets);
+    }
+  }
+
+  // Adding one of the finest table's groups to every level. (Because
+  // these levels are derived from the table's groups rather than from
+  // its rows, this only takes place once per group.)
+  void add_group(std::string_view pivot_index, const Pivot_Vals *pivot_vals,
+                 const Aggregate_Table &aggregates, size_t group) {
+    if (levels.empty()) {
+      return;
+    }
+    index_values.clear();
+    size_t field_start = 0;
+    while (true) {
+      size_t field_end = pivot_index.find('|', field_start);
+      index_values.push_back(pivot_index.substr(field_start,
+                                                field_end - field_start));
+      if (field_end == std::string_view::npos) {
+        break;
+      }
+      field_start = field_end + 1;
+    }
+    if (index_values.size() != index_field_count) {
+      throw std::runtime_error(
+          "Unable to roll up the pivot index " + std::string(pivot_index) +
+          ", since it does not contain exactly one value (separated by "
+          "pipes) for each index field.");
+    }
+    for (Rollup_Table &level : levels) {
+      level.add_group(index_values, pivot_vals, aggregates, group);
+    }
+  }
+
+  // Writing each level (once all of the table's groups have been added)
+  // either to table_writer (the table's own output, which may be null
+  // if it isn't being saved) or to its own file. Any appended rows are
+  // also passed to on_appended_row(pivot_index, pivot_vals).
+  template <typename Function>
+  void write(Csv_Output_Writer *table_writer,
+             const std::vector<std::string> &value_fields,
+             int output_precision, Output_Format output_format,
+             Function on_appended_row) {
+    for (Rollup_Table &level : levels) {
+      std::optional<Csv_Output_Writer> level_writer;
+      Csv_Output_Writer *writer = table_writer;
+      Aggregate_Table *aggregates =
+          level.state.aggregates.enabled() ? &level.state.aggregates
+                                           : nullptr;
+      if (!level.appended()) {
+        level_writer.emplace(level.rollup.pivot_file_path,
+                             output_precision, output_format);
+        writer = &*level_writer;
+        write_pivot_header(*writer,
+                           join_with_pipes(level.rollup.index_fields),
+                           value_fields, aggregates);
+      }
+      level.state.for_each_sorted([&](std::string_view pivot_index,
+                                      Pivot_Vals *pivot_vals,
+                                      size_t group) {
+        calculate_means(pivot_vals, value_fields.size());
+        if (writer) {
+          write_pivot_row(*writer, pivot_index, pivot_vals,
+                          value_fields.size(), aggregates, group);
+        }
+        if (level.appended()) {
+          on_appended_row(pivot_index, pivot_vals);
+        }
+      });
+      if (level_writer) {
+        level_writer->flush();
+      }
+    }
+  }
+
+  std::vector<Rollup_Table> levels;
+  size_t index_field_count{0};
+  // The current group's index values:
+  std::vector<std::string_view> index_values;
+};
+
+static std::vector<std::string>
+split_index_headers(const std::string &index_headers) {
+  /* Returning the pipe-separated field names within index_headers. */
+  std::vector<std::string> index_fields;
+  size_t field_start = 0;
+  while (true) {
+    size_t field_end = index_headers.find('|', field_start);
+    index_fields.push_back(
+        index_headers.substr(field_start, field_end - field_start));
+    if (field_end == std::string::npos) {
+      return index_fields;
+    }
+    field_start = field_end + 1;
+  }
+}
+
+static std::string spec_index_headers(const Pivot_Spec &spec) {
+  /* Returning the index column header for spec's output. */
+  return spec.index_headers.empty() ? join_with_pipes(spec.index_fields)
+                                    : spec.index_headers;
+}
+
+// Applies a table's Pivot_Selection (see pivot_compressors.h) as the
+// table gets written out:
+class Group_Selector {
+public:
+  // Throws a std::runtime_error if selection refers to a field that
+  // isn't one of value_fields, or if it has a limit but no
+  // order_by_field.
+  Group_Selector(const Pivot_Selection &selection,
+                 const std::vector<std::string> &value_fields)
+      : order_by_(selection.order_by), descending_(selection.descending),
+        limit_(selection.limit), value_count_(value_fields.size()) {
+    for (const Pivot_Condition &condition : selection.having) {
+      having_.push_back({value_field_position(condition.value_field,
+                                              value_fields),
+                         condition});
+    }
+    if (limit_ > 0) {
+      if (selection.order_by_field.empty()) {
+        throw std::runtime_error("A selection with a limit also needs an "
+                                 "order_by_field by which to rank groups.");
+      }
+      order_by_vfi_ =
+          value_field_position(selection.order_by_field, value_fields);
+    }
+  }
+
+  // Calculating the means of each of state's groups, then calling
+  // on_group(pivot_index, pivot_vals, group) for every group and
+  // on_selected(pivot_index, pivot_vals, aggregates, group) for each
+  // selected group, in the order in which they should be written. (The
+  // selected group's additional aggregates are found within aggregates,
+  // which may be either state.aggregates or a copy of them.)
+  template <typename Group_Function, typename Selected_Function>
+  void for_each_group(Pivot_Table_State &state, Group_Function on_group,
+                      Selected_Function on_selected) {
+    if (limit_ == 0) {
+      // Without a limit, every group that passes the conditions can be
+      // written as soon as it's reached:
+      state.for_each_sorted([&](std::string_view pivot_index,
+                                Pivot_Vals *pivot_vals, size_t group) {
+        calculate_means(pivot_vals, value_count_);
+        on_group(pivot_index, pivot_vals, group);
+        if (satisfies_having(pivot_vals)) {
+          on_selected(pivot_index, pivot_vals, state.aggregates, group);
+        }
+      });
+      return;
+    }
+
+    /* Otherwise, the best limit_ groups found so far are kept within a
+    heap whose root is the worst of them, so each remaining group only
+    needs to be compared against that root. Each kept group's
+    accumulators (and additional aggregates) are copied into a slot of
+    their own, since a spilled table's groups are only available while
+    they're being merged. (Because the heap's order doesn't depend on
+    the order in which groups arrive, the unsorted groups of a hash
+    table can be offered as they are.) */
+    std::vector<Top_Group> heap;
+    std::vector<Pivot_Vals> top_vals;
+    Aggregate_Table top_aggregates(state.aggregates.sets());
+    auto group_precedes = [&](const Top_Group &a, const Top_Group &b) {
+      return precedes(a.order_value, a.pivot_index, b.order_value,
+                      b.pivot_index);
+    };
+    state.for_each_group([&](std::string_view pivot_index,
+                             Pivot_Vals *pivot_vals, size_t group) {
+      calculate_means(pivot_vals, value_count_);
+      on_group(pivot_index, pivot_vals, group);
+      if (!satisfies_having(pivot_vals)) {
+        return;
+      }
+      double order_value =
+          aggregate_value(pivot_vals[order_by_vfi_], order_by_);
+      if (heap.size() < limit_) {
+        heap.push_back({0.0, "", heap.size()});
+        top_vals.resize(heap.size() * value_count_);
+      } else if (precedes(order_value, pivot_index,
+                          heap.front().order_value,
+                          heap.front().pivot_index)) {
+        // (The root's slot gets reused for this group.)
+        std::ranges::pop_heap(heap, group_precedes);
+      } else {
+        return;
+      }
+      Top_Group &top_group = heap.back();
+      top_group.order_value = order_value;
+      top_group.pivot_index.assign(pivot_index);
+      std::copy_n(pivot_vals, value_count_,
+                  &top_vals[top_group.slot * value_count_]);
+      if (top_aggregates.enabled()) {
+        top_aggregates.copy_group(top_group.slot, state.aggregates, group);
+      }
+      std::ranges::push_heap(heap, group_precedes);
+    });
+    std::ranges::sort(heap, group_precedes);
+    for (Top_Group &top_group : heap) {
+      on_selected(top_group.pivot_index,
+                  &top_vals[top_group.slot * value_count_], top_aggregates,
+                  top_group.slot);
+    }
+  }
+
+private:
+  static size_t value_field_position(
+      const std::string &field, const std::vector<std::string> &value_fields) {
+    auto field_it = std::ranges::find(value_fields, field);
+    if (field_it == value_fields.end()) {
+      throw std::runtime_error("Unable to select groups by " + field +
+                               ", since it is not one of this pivot "
+                               "table's value fields.");
+    }
+    return field_it - value_fields.begin();
+  }
+
+  static double aggregate_value(const Pivot_Vals &pivot_vals,
+                                Pivot_Aggregate aggregate) {
+    switch (aggregate) {
+    case Pivot_Aggregate::sum:
+      return pivot_vals.pivot_sum;
+    case Pivot_Aggregate::count:
+      return static_cast<double>(pivot_vals.pivot_count);
+    case Pivot_Aggregate::mean:
+      return pivot_vals.pivot_mean;
+    }
+    return pivot_vals.pivot_sum;
+  }
+
+  bool satisfies_having(const Pivot_Vals *pivot_vals) const {
+    // (Every comparison with nan is false, including not_equal's, which
+    // is why it's written as a negated equality test.)
+    for (const auto &[vfi, condition] : having_) {
+      double value = aggregate_value(pivot_vals[vfi], condition.aggregate);
+      bool satisfied = false;
+      switch (condition.comparison) {
+      case Pivot_Comparison::less:
+        satisfied = value < condition.threshold;
+        break;
+      case Pivot_Comparison::less_equal:
+        satisfied = value <= condition.threshold;
+        break;
+      case Pivot_Comparison::greater:
+        satisfied = value > condition.threshold;
+        break;
+      case Pivot_Comparison::greater_equal:
+        satisfied = value >= condition.threshold;
+        break;
+      case Pivot_Comparison::equal:
+        satisfied = value == condition.threshold;
+        break;
+      case Pivot_Comparison::not_equal:
+        satisfied = !std::isnan(value) && !(value == condition.threshold);
+        break;
+      }
+      if (!satisfied) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Whether a group whose order_by value is a_value (and whose pivot
+  // index is a_index) should be written before a group with b_value
+  // and b_index: (Groups whose value is nan always come last.)
+  bool precedes(double a_value, std::string_view a_index, double b_value,
+                std::string_view b_index) const {
+    bool a_nan = std::isnan(a_value);
+    bool b_nan = std::isnan(b_value);
+    if (a_nan != b_nan) {
+      return b_nan;
+    }
+    if (!a_nan && (a_value != b_value)) {
+      return descending_ ? (a_value > b_value) : (a_value < b_value);
+    }
+    return a_index < b_index;
+  }
+
+  // One of the best groups found so far by a limited selection, whose
+  // accumulators and additional aggregates are stored within slot:
+  struct Top_Group {
+    double order_value;
+    std::string pivot_index;
+    size_t slot;
+  };
+
+  // Each condition's value field position, followed by the condition:
+  std::vector<std::pair<size_t, Pivot_Condition>> having_;
+  Pivot_Aggregate order_by_;
+  bool descending_;
+  size_t limit_;
+  size_t order_by_vfi_{0};
+  size_t value_count_;
+};
+
+static size_t write_pivot_csv(Pivot_Table_State &state,
+                              const std::vector<std::string> &value_fields,
+                              const std::string &index_headers,
+                              const std::string &pivot_file_path,
+                              int output_precision,
+                              Output_Format output_format,
+                              Rollup_Tables &rollups,
+                              Group_Selector &selector) {
+  /* Calculating means within a pivot table produced by
+  scan_to_multi_pivot(), then writing the groups that selector chooses
+  to a .csv file. Each of the table's groups is also added to its
+  rollup levels, which then get written as well. Returns the number of
+  groups within the table (whether or not they were selected), not
+  including those of any rollup levels. */
+
+  // This export will take place on a row-by-row basis, thus
+  // preventing us from having to loop through our map twice
+  // (once to calculate our means and again to export the table).
+  // (See csv_output.cpp for more information on Csv_Output_Writer.)
+  Csv_Output_Writer writer(pivot_file_path, output_precision, output_format);
+  Aggregate_Table *aggregates =
+      state.aggregates.enabled() ? &state.aggregates : nullptr;
+  write_pivot_header(writer, index_headers, value_fields, aggregates);
+
+  size_t group_count = 0;
+  selector.for_each_group(
+      state,
+      [&](std::string_view pivot_index, Pivot_Vals *pivot_vals,
+          size_t group) {
+        rollups.add_group(pivot_index, pivot_vals, state.aggregates, group);
+        group_count++;
+      },
+      [&](std::string_view pivot_index, Pivot_Vals *pivot_vals,
+          Aggregate_Table &selected_aggregates, size_t group) {
+        // Writing this completed row to a .csv file:
+        write_pivot_row(writer, pivot_index, pivot_vals, value_fields.size(),
+                        aggregates ? &selected_aggregates : nullptr, group);
+      });
+  rollups.write(&writer, value_fields, output_precision, output_format,
+                [](std::string_view, const Pivot_Vals *) {});
+  writer.flush();
+  return group_count;
+}
+
+static void add_table_stats(Pivot_Stats &stats, Pivot_Table_State &state,
+                            const std::string &pivot_file_path,
+                            size_t distinct_groups) {
+  /* Adding the measurements that state collected (for the table that
+  was written to pivot_file_path) to stats, both as a new entry within
+  stats.tables and to stats' totals. */
+  state.note_peak_bytes();
+  Pivot_Table_Stats &table_stats = stats.tables.emplace_back();
+  table_stats.pivot_file_path = pivot_file_path;
+  table_stats.rows_filtered_out = state.rows_filtered_out;
+  table_stats.distinct_groups = distinct_groups;
+  table_stats.peak_table_bytes = state.peak_bytes;
+  table_stats.blank_values = state.missing_counts;
+  stats.rows_filtered_out += table_stats.rows_filtered_out;
+  stats.distinct_groups += table_stats.distinct_groups;
+  stats.peak_group_table_bytes += table_stats.peak_table_bytes;
+  stats.filter_seconds += state.row_timer.seconds(Row_Phase::filter);
+  stats.key_build_seconds += state.row_timer.seconds(Row_Phase::key_build);
+  stats.aggregate_seconds += state.row_timer.seconds(Row_Phase::aggregate);
+}
+
+// The in-progress results of each pivot table within a
+// scan_to_multi_pivot() call:
+using Pivot_Table_States = std::vector<Pivot_Table_State>;
+
+// These adapters allow add_row_to_pivot() to retrieve a row's fields
+// either from a CSVRow or from a line that was split by a
+// Column_Projection.
+struct CSV_Row_Fields {
+  CSVRow &row;
+  std::string_view text(size_t column) { return row[column].get_sv(); }
+  std::string index(Pivot_Spec &spec) { return spec.index_gen(row); }
+};
+
+struct Projected_Row_Fields {
+  Column_Projection &projection;
+  std::string_view text(size_t column) { return projection.field(column); }
+  std::string index(Pivot_Spec &) {
+    // Projected scans are only used when every pivot spec has
+    // index_fields, so this function should never get called.
+    throw std::logic_error("index_gen functions require a complete CSVRow.");
+  }
+};
+
+// (Lines that were split on another thread are stored within a
+// Projected_Batch; projection is only used to locate each column's
+// field within the batch.)
+struct Batched_Row_Fields {
+  const Projected_Batch &batch;
+  size_t line;
+  const Column_Projection &projection;
+  std::string_view text(size_t column) {
+    return batch.field(line, projection.slot(column));
+  }
+  std::string index(Pivot_Spec &) {
+    throw std::logic_error("index_gen functions require a complete CSVRow.");
+  }
+};
+
+struct Spec_Columns;
+
+// A function that adds one row's data to one pivot table: (See
+// add_row_to_pivot() and choose_row_kernel().)
+template <typename Row_Fields>
+using Row_Kernel = void (*)(Row_Fields &row_fields, Pivot_Spec &spec,
+                            const Spec_Columns &columns,
+                            Row_Filter &row_filter, Pivot_Table_State &state);
+
+// The column positions of a pivot spec's value fields and (if
+// specified) index fields: (Resolving these positions once, before any
+// rows get scanned, allows each value to be retrieved by index rather
+// than by name.) The kernels that will add each row to the spec's
+// pivot table also get chosen at this point.
+struct Spec_Columns {
+  std::vector<size_t> value_columns;
+  std::vector<size_t> index_columns;
+  Row_Kernel<CSV_Row_Fields> csv_row_kernel;
+  Row_Kernel<Projected_Row_Fields> projected_row_kernel;
+  Row_Kernel<Batched_Row_Fields> batched_row_kernel;
+};
+
+// Kernels whose Index_Count or Value_Count is dynamic_field_count will
+// determine the number of index or value fields at runtime.
+constexpr int dynamic_field_count = -1;
+// Specialized kernels get compiled for every combination of up to
+// this many index fields and value fields:
+constexpr int max_kernel_fields = 4;
+
+template <typename Row_Fields, int Index_Count, int Value_Count>
+static void add_row_to_pivot(Row_Fields &row_fields, Pivot_Spec &spec,
+                             const Spec_Columns &columns,
+                             Row_Filter &row_filter,
+                             Pivot_Table_State &state) {
+  /* Updating a single pivot table with a single row's data. This code
+  is shared by all versions of scan_to_multi_pivot().
+
+  Index_Count and Value_Count specify the number of index fields (with
+  0 indicating that the spec uses an index_gen function instead) and
+  value fields that this kernel handles. When these counts are known at
+  compile time, the compiler can fully unroll the loops below (and can
+  store the row's dictionary codes within a local array), so each
+  fixed schema effectively receives its own straight-line kernel. */
+  const size_t index_count = (Index_Count == dynamic_field_count)
+                                 ? columns.index_columns.size()
+                                 : size_t(Index_Count);
+  const size_t value_count = (Value_Count == dynamic_field_count)
+                                 ? columns.value_columns.size()
+                                 : size_t(Value_Count);
+  state.row_timer.start_row();
+  bool include_row = row_filter.passes(
+      [&](size_t column) { return row_fields.text(column); });
+  state.row_timer.end_phase(Row_Phase::filter);
+  if (include_row == false) {
+    state.rows_filtered_out++;
+    return; // This row will now be skipped for this spec.
+  }
+  // Retrieving (or, if needed, adding) the accumulators that
+  // correspond to this set of index variables:
+  Pivot_Vals *pivot_vals;
+  // The table that stores this group's additional aggregates (if
+  // any), along with the group's number within that table:
+  Aggregate_Table *aggregates = nullptr;
+  size_t group = 0;
+  if (index_count == 0) {
+    std::string pivot_index = row_fields.index(spec);
+    state.row_timer.end_phase(Row_Phase::key_build);
+    pivot_vals = state.find_or_insert(pivot_index);
+    if (state.aggregates.enabled()) {
+      aggregates = &state.aggregates;
+      group = state.group_of(pivot_vals);
+    }
+  } else {
+    // Converting each index value into its dictionary code: (Since
+    // text() returns a view of the row's data, no strings need to
+    // be created unless a value is being encountered for the first time.)
+    std::array<uint32_t, std::max(Index_Count, 1)> fixed_codes;
+    uint32_t *index_codes = (Index_Count == dynamic_field_count)
+                                ? state.index_codes.data()
+                                : fixed_codes.data();
+    for (size_t ifi = 0; ifi < index_count; ifi++) {
+      index_codes[ifi] = state.index_dictionaries[ifi].encode(
+          row_fields.text(columns.index_columns[ifi]));
+    }
+    state.row_timer.end_phase(Row_Phase::key_build);
+    pivot_vals = state.coded_table.find_or_insert(index_codes);
+    if (state.coded_aggregates.enabled()) {
+      aggregates = &state.coded_aggregates;
+      group = state.coded_table.group_of(pivot_vals);
+    }
+  }
+  // Updating the sum and count values within each value field's
+  // correponding Pivot_Vals struct:
+  for (size_t vfi = 0; vfi < value_count; vfi++)
+  // vfi = 'value field index'
+  {
+    std::string_view value_text = row_fields.text(columns.value_columns[vfi]);
+    double value = 0.0;
+    if (parse_double(value_text, value) == false) {
+      if (is_blank(value_text) == false) {
+        throw std::runtime_error("The " + spec.value_fields[vfi] +
+                                 " value '" + std::string(value_text) +
+                                 "' could not be converted into a number.");
+      }
+      state.missing_counts[vfi]++;
+      if (state.missing_values == Missing_Value_Policy::error) {
+        throw std::runtime_error(
+            "A blank " + spec.value_fields[vfi] +
+            " value was found. (To skip these values or treat them as "
+            "zeros, set Scan_Options::missing_values accordingly.)");
+      }
+      if (state.missing_values == Missing_Value_Policy::skip) {
+        continue;
+      }
+      // Otherwise, this value will be counted as a zero.
+    }
+    pivot_vals[vfi].pivot_sum += value;
+    pivot_vals[vfi].pivot_count++;
+    if (aggregates) {
+      aggregates->add(group, vfi, value);
+    }
+  }
+  state.check_memory_budget();
+  state.row_timer.end_phase(Row_Phase::aggregate);
+}
+
+template <typename Row_Fields, int Index_Count = 0, int Value_Count = 1>
+static Row_Kernel<Row_Fields> choose_row_kernel(size_t index_count,
+                                                size_t value_count) {
+  /* Returning the kernel that was specialized for index_count index
+  fields (or an index_gen function, if index_count is 0) and
+  value_count value fields, or the generic kernel if no such
+  specialization exists. (Each step of this recursion checks one
+  combination of counts.) */
+  if constexpr (Index_Count > max_kernel_fields) {
+    return add_row_to_pivot<Row_Fields, dynamic_field_count,
+                            dynamic_field_count>;
+  } else if constexpr (Value_Count > max_kernel_fields) {
+    return choose_row_kernel<Row_Fields, Index_Count + 1, 1>(index_count,
+                                                             value_count);
+  } else {
+    if ((index_count == Index_Count) && (value_count == Value_Count)) {
+      return add_row_to_pivot<Row_Fields, Index_Count, Value_Count>;
+    }
+    return choose_row_kernel<Row_Fields, Index_Count, Value_Count + 1>(
+        index_count, value_count);
+  }
+}
+
+static std::vector<Spec_Columns>
+resolve_spec_columns(const std::vector<std::string> &col_names,
+                     std::vector<Pivot_Spec> &pivot_specs) {
+  /* Finding the position of each pivot spec's value and index fields
+  within col_names, then choosing each spec's kernels. */
+  auto column_position = [&](const std::string &field) -> size_t {
+    auto col_it = std::ranges::find(col_names, field);
+    if (col_it == col_names.end()) {
+      throw std::runtime_error("The field " + field +
+                               " is not present within this dataset.");
+    }
+    return col_it - col_names.begin();
+  };
+  std::vector<Spec_Columns> spec_columns;
+  for (Pivot_Spec &spec : pivot_specs) {
+    if (spec.index_fields.empty() && !spec.index_gen) {
+      throw std::runtime_error("Each Pivot_Spec needs either an index_gen "
+                               "function or a list of index_fields.");
+    }
+    Spec_Columns &columns = spec_columns.emplace_back();
+    for (const std::string &value_field : spec.value_fields) {
+      columns.value_columns.push_back(column_position(value_field));
+    }
+    for (const std::string &index_field : spec.index_fields) {
+      columns.index_columns.push_back(column_position(index_field));
+    }
+    columns.csv_row_kernel = choose_row_kernel<CSV_Row_Fields>(
+        spec.index_fields.size(), spec.value_fields.size());
+    columns.projected_row_kernel = choose_row_kernel<Projected_Row_Fields>(
+        spec.index_fields.size(), spec.value_fields.size());
+    columns.batched_row_kernel = choose_row_kernel<Batched_Row_Fields>(
+        spec.index_fields.size(), spec.value_fields.size());
+  }
+  return spec_columns;
+}
+
+static std::vector<Row_Filter>
+compile_row_filters(const std::vector<std::string> &col_names,
+                    std::vector<Pivot_Spec> &pivot_specs) {
+  /* Compiling each pivot spec's include_map and exclude_map into a
+  Row_Filter (see row_filter.cpp). Since these filters track their
+  own rejection counts, each thread needs to compile its own set. */
+  std::vector<Row_Filter> row_filters;
+  for (Pivot_Spec &spec : pivot_specs) {
+    row_filters.emplace_back(col_names, spec.include_map, spec.exclude_map);
+  }
+  return row_filters;
+}
+
+template <typename Row_Fields>
+static void add_row_to_pivots(Row_Fields row_fields,
+                              std::vector<Pivot_Spec> &pivot_specs,
+                              const std::vector<Spec_Columns> &spec_columns,
+                              std::vector<Row_Filter> &row_filters,
+                              Pivot_Table_States &states) {
+  /* Updating each pivot table within states with a single row's
+  data (via the kernel that was chosen for each spec). */
+  for (int psi = 0; psi < pivot_specs.size(); psi++)
+  // psi = 'pivot spec index'
+  {
+    const Spec_Columns &columns = spec_columns[psi];
+    if constexpr (std::is_same_v<Row_Fields, CSV_Row_Fields>) {
+      columns.csv_row_kernel(row_fields, pivot_specs[psi], columns,
+                             row_filters[psi], states[psi]);
+    } else if constexpr (std::is_same_v<Row_Fields, Batched_Row_Fields>) {
+      columns.batched_row_kernel(row_fields, pivot_specs[psi], columns,
+                                 row_filters[psi], states[psi]);
+    } else {
+      columns.projected_row_kernel(row_fields, pivot_specs[psi], columns,
+                                   row_filters[psi], states[psi]);
+    }
+  }
+}
+
+static bool can_project(std::vector<Pivot_Spec> &pivot_specs) {
+  /* Projected scans (see csv_projection.cpp) can only be used if no
+  pivot spec needs an index_gen function, since these functions
+  require access to an entire CSVRow. */
+  return std::ranges::all_of(pivot_specs, [](const Pivot_Spec &spec) {
+    return !spec.index_fields.empty();
+  });
+}
+
+static Column_Projection
+pivot_projection(const std::vector<Spec_Columns> &spec_columns,
+                 const std::vector<Row_Filter> &row_filters) {
+  /* Creating a Column_Projection that includes every index, value,
+  and filter field referenced by a scan's pivot specs. */
+  std::vector<size_t> columns;
+  for (const Spec_Columns &columns_for_spec : spec_columns) {
+    columns.insert(columns.end(), columns_for_spec.value_columns.begin(),
+                   columns_for_spec.value_columns.end());
+    columns.insert(columns.end(), columns_for_spec.index_columns.begin(),
+                   columns_for_spec.index_columns.end());
+  }
+  for (const Row_Filter &row_filter : row_filters) {
+    std::vector<size_t> filter_columns = row_filter.columns();
+    columns.insert(columns.end(), filter_columns.begin(), filter_columns.end());
+  }
+  return Column_Projection(columns);
+}
+
+// The measurements that a scan collects for Pivot_Stats: (Each
+// scanning thread records its own measurements, which are only added
+// to these totals once the thread has finished.)
+struct Scan_Profile {
+  // Whether a sample of each table's rows should be timed (see
+  // Row_Phase_Timer):
+  bool time_row_phases{false};
+  // The time that scanning threads spent reading, splitting, and
+  // aggregating rows (summed across threads, and not including any
+  // time spent waiting on other threads):
+  double scan_seconds{0.0};
+  // The time spent merging each thread's tables:
+  double merge_seconds{0.0};
+  uint64_t bytes_read{0};
+};
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+// The number of bytes that each parallel worker will read (and parse)
+// at a time: (Reading a block at a time, rather than an entire byte
+// range, keeps memory usage independent of the size of the file.)
+constexpr std::streamoff parallel_block_bytes = 16 * 1024 * 1024;
+
+template <typename Function>
+static void for_each_line(std::string_view text, Function function) {
+  /* Calling function(line) for each non-empty line within text (not
+  including its line break) until function returns false. */
+  size_t line_start = 0;
+  while (line_start < text.size()) {
+    size_t line_end = text.find('\n', line_start);
+    if (line_end == std::string_view::npos) {
+      line_end = text.size();
+    }
+    std::string_view line = text.substr(line_start, line_end - line_start);
+    line_start = line_end + 1;
+    if (line.ends_with('\r')) {
+      line.remove_suffix(1);
+    }
+    if (line.empty()) {
+      continue;
+    }
+    if (function(line) == false) {
+      return;
+    }
+  }
+}
+
+static size_t
+scan_projected_lines(std::string_view text, Column_Projection &projection,
+                     std::vector<Pivot_Spec> &pivot_specs,
+                     const std::vector<Spec_Columns> &spec_columns,
+                     std::vector<Row_Filter> &row_filters,
+                     Pivot_Table_States &states, long &scanned_rows,
+                     long row_limit) {
+  /* Splitting each line within text via projection, which only
+  extracts the fields that these pivot tables use, then adding each
+  line's data to states. (Empty lines, along with lines that are too
+  short to contain every projected field, get skipped.) Since text
+  is only ever viewed, it can refer either to a block that was read
+  into memory or to a memory-mapped file. Returns the number of bytes
+  within text that were scanned (which will be less than text.size()
+  if row_limit was reached). */
+  if (scanned_rows == row_limit) {
+    return 0;
+  }
+  size_t scanned_bytes = text.size();
+  for_each_line(text, [&](std::string_view line) {
+    if (scanned_rows == row_limit) {
+      scanned_bytes = line.data() - text.data();
+      return false;
+    }
+    if (projection.split(line)) {
+      add_row_to_pivots(Projected_Row_Fields{projection}, pivot_specs,
+                        spec_columns, row_filters, states);
+      scanned_rows++;
+    }
+    return true;
+  });
+  return scanned_bytes;
+}
+
+template <typename Function>
+static void read_line_aligned_blocks(std::ifstream &ifs,
+                                     std::streamoff range_start,
+                                     std::streamoff range_end,
+                                     std::streamoff block_bytes,
+                                     Function function) {
+  /* Reading the lines between range_start and range_end (both of
+  which must fall on line boundaries) about block_bytes at a time,
+  then calling function(block) for each block until function returns
+  false. Since blocks won't necessarily end on a line boundary, any
+  partial line at the end of a block will get carried over into the
+  following one. (function may move the block's contents elsewhere.) */
+  ifs.seekg(range_start);
+  std::string carryover;
+  std::streamoff pos = range_start;
+  while (pos < range_end) {
+    std::streamoff bytes_to_read = std::min(block_bytes, range_end - pos);
+    std::string block = std::move(carryover);
+    carryover.clear();
+    size_t carryover_size = block.size();
+    block.resize(carryover_size + bytes_to_read);
+    ifs.read(block.data() + carryover_size, bytes_to_read);
+    pos += bytes_to_read;
+    if (pos < range_end) {
+      size_t last_newline = block.rfind('\n');
+      if (last_newline == std::string::npos) {
+        // This block doesn't contain a complete line, so we'll need
+        // to keep reading before we can parse it.
+        carryover = std::move(block);
+        continue;
+      }
+      carryover = block.substr(last_newline + 1);
+      block.resize(last_newline + 1);
+    }
+    if (function(block) == false) {
+      return;
+    }
+  }
+}
+
+template <typename Function>
+static void read_decompressed_blocks(Decompressing_Reader &reader,
+                                     std::string carryover,
+                                     size_t block_bytes, Function function) {
+  /* Reading reader's (decompressed) data about block_bytes at a time,
+  then calling function(block) for each block until function returns
+  false. carryover should contain any data that was already read from
+  reader (beginning on a line boundary). As with
+  read_line_aligned_blocks(), any partial line at the end of a block
+  gets carried over into the following one; since the data's size
+  isn't known ahead of time, its end is only found once reader runs
+  out of data. */
+  while (true) {
+    std::string block = std::move(carryover);
+    carryover.clear();
+    size_t carryover_size = block.size();
+    block.resize(carryover_size + block_bytes);
+    size_t bytes_copied =
+        reader.read(block.data() + carryover_size, block_bytes);
+    block.resize(carryover_size + bytes_copied);
+    if (bytes_copied == 0) {
+      // (The file's last line may not end with a line break.)
+      if (!block.empty()) {
+        function(block);
+      }
+      return;
+    }
+    size_t last_newline = block.rfind('\n');
+    if (last_newline == std::string::npos) {
+      carryover = std::move(block);
+      continue;
+    }
+    carryover = block.substr(last_newline + 1);
+    block.resize(last_newline + 1);
+    if (function(block) == false) {
+      return;
+    }
+  }
+}
+
+static uint64_t scan_byte_range(const std::string &data_file_path,
+                                std::streamoff range_start,
+                                std::streamoff range_end,
+                                const std::vector<std::string> &col_names,
+                                std::vector<Pivot_Spec> &pivot_specs,
+                                const std::vector<Spec_Columns> &spec_columns,
+                                Pivot_Table_States &states,
+                                long &scanned_rows, long row_limit = -1) {
+  /* Scanning all rows located between range_start and range_end
+  (both of which must fall on line boundaries) into states, stopping
+  early if row_limit (when not -1) rows have been scanned.
+  This function gets called by each worker thread within
+  scan_to_multi_pivot()'s parallel mode, and by its single-threaded
+  mode when a projected scan can be used. Returns the number of bytes
+  that were read from the file. */
+  std::ifstream ifs(data_file_path, std::ios::binary);
+  std::vector<Row_Filter> row_filters =
+      compile_row_filters(col_names, pivot_specs);
+  bool projected = can_project(pivot_specs);
+  Column_Projection projection = pivot_projection(spec_columns, row_filters);
+
+  uint64_t bytes_read = 0;
+  read_line_aligned_blocks(
+      ifs, range_start, range_end, parallel_block_bytes,
+      [&](std::string &block) {
+        if (scanned_rows == row_limit) {
+          return false;
+        }
+        bytes_read += block.size();
+        if (projected) {
+          scan_projected_lines(block, projection, pivot_specs, spec_columns,
+                               row_filters, states, scanned_rows, row_limit);
+          return true;
+        }
+
+        // Parsing this block via Vince La's library: (Since the block
+        // won't contain a header row, we'll need to supply the column
+        // names ourselves.)
+        CSVFormat format;
+        format.column_names(col_names);
+        std::istringstream block_stream(block);
+        CSVReader reader(block_stream, format);
+        for (CSVRow &row : reader) {
+          if (scanned_rows == row_limit) {
+            break;
+          }
+          add_row_to_pivots(CSV_Row_Fields{row}, pivot_specs, spec_columns,
+                            row_filters, states);
+          scanned_rows++;
+        }
+        return true;
+      });
+  return bytes_read;
+}
+
+template <typename Function>
+static void run_on_threads(int thread_count, Function function) {
+  /* Calling function(ti) on thread_count threads (where ti is the
+  'thread index'), then waiting for all of them to finish. Any
+  exceptions thrown within a worker thread will get stored, then
+  rethrown once all threads have been joined. */
+  std::vector<std::exception_ptr> thread_exceptions(thread_count);
+  std::vector<std::thread> threads;
+  for (int ti = 0; ti < thread_count; ti++) {
+    threads.emplace_back([&, ti]() {
+      try {
+        function(ti);
+      } catch (...) {
+        thread_exceptions[ti] = std::current_exception();
+      }
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  for (std::exception_ptr &thread_exception : thread_exceptions) {
+    if (thread_exception) {
+      std::rethrow_exception(thread_exception);
+    }
+  }
+}
+
+// The number of bytes that a pipelined scan's reader stage will read
+// at a time, and the number of blocks (or batches of split lines) that
+// can wait between two stages: (These blocks are smaller than those
+// of parallel scans so that the stages can begin overlapping sooner.)
+constexpr std::streamoff pipeline_block_bytes = 1024 * 1024;
+constexpr size_t pipeline_queue_capacity = 4;
+
+template <typename Read_Blocks>
+static void scan_pipelined(Read_Blocks read_blocks,
+                           const std::vector<std::string> &col_names,
+                           std::vector<Pivot_Spec> &pivot_specs,
+                           const std::vector<Spec_Columns> &spec_columns,
+                           Pivot_Table_States &states, long &scanned_rows,
+                           long row_limit, Scan_Profile &profile) {
+  /* Performing the same projected scan as scan_byte_range(), but via
+  three stages that run on separate threads and that are connected by
+  bounded queues (see spsc_queue.h):
+
+  1. The reader stage reads line-aligned blocks from the file (by
+  calling read_blocks(function), which should pass each block to
+  function(block) until function returns false). For compressed
+  files, this stage also decompresses each block.
+  2. The splitting stage splits each block's lines into their projected
+  fields, producing one Projected_Batch per block.
+  3. The aggregation stage filters each batch's rows and adds them to
+  states.
+
+  Because each queue can only hold a few items, memory usage stays
+  bounded even if one stage is much faster than the others. If a stage
+  fails (or the row limit gets reached), both queues are cancelled so
+  that the other stages stop as well. The time that each stage spends
+  working (rather than waiting on the others) gets added to
+  profile.scan_seconds. */
+  std::vector<Row_Filter> row_filters =
+      compile_row_filters(col_names, pivot_specs);
+  const Column_Projection projection =
+      pivot_projection(spec_columns, row_filters);
+  Spsc_Queue<std::string> block_queue(pipeline_queue_capacity);
+  Spsc_Queue<Projected_Batch> batch_queue(pipeline_queue_capacity);
+  std::array<double, 3> stage_seconds{};
+  uint64_t bytes_read = 0;
+
+  run_on_threads(3, [&](int stage) {
+    try {
+      if (stage == 0) {
+        auto stage_start = std::chrono::steady_clock::now();
+        double waiting_seconds = 0.0;
+        read_blocks([&](std::string &block) {
+          bytes_read += block.size();
+          auto push_start = std::chrono::steady_clock::now();
+          bool pushed = block_queue.push(std::move(block));
+          waiting_seconds += seconds_since(push_start);
+          return pushed;
+        });
+        block_queue.close();
+        stage_seconds[0] = seconds_since(stage_start) - waiting_seconds;
+      } else if (stage == 1) {
+        Column_Projection splitter = projection;
+        std::string block;
+        while (block_queue.pop(block)) {
+          auto split_start = std::chrono::steady_clock::now();
+          Projected_Batch batch(std::move(block));
+          for_each_line(batch.text(), [&](std::string_view line) {
+            if (splitter.split(line)) {
+              batch.add_line(splitter);
+            }
+            return true;
+          });
+          stage_seconds[1] += seconds_since(split_start);
+          if ((batch.size() > 0) &&
+              (batch_queue.push(std::move(batch)) == false)) {
+            break;
+          }
+        }
+        batch_queue.close();
+      } else {
+        Projected_Batch batch;
+        while ((scanned_rows != row_limit) && batch_queue.pop(batch)) {
+          auto batch_start = std::chrono::steady_clock::now();
+          for (size_t line = 0;
+               (line < batch.size()) && (scanned_rows != row_limit); line++) {
+            add_row_to_pivots(Batched_Row_Fields{batch, line, projection},
+                              pivot_specs, spec_columns, row_filters, states);
+            scanned_rows++;
+          }
+          stage_seconds[2] += seconds_since(batch_start);
+        }
+        // (If the row limit was reached, the earlier stages can stop.)
+        block_queue.cancel();
+        batch_queue.cancel();
+      }
+    } catch (...) {
+      block_queue.cancel();
+      batch_queue.cancel();
+      throw;
+    }
+  });
+  profile.scan_seconds +=
+      std::accumulate(stage_seconds.begin(), stage_seconds.end(), 0.0);
+  profile.bytes_read += bytes_read;
+}
+
+static std::vector<std::string> header_col_names(const std::string &header_line) {
+  /* Parsing a header row via Vince La's library (which will handle
+  any quoted column names). */
+  std::istringstream header_stream(header_line);
+  CSVReader header_reader(header_stream);
+  return header_reader.get_col_names();
+}
+
+static std::vector<std::string> read_header(std::ifstream &ifs,
+                                            std::streamoff file_size,
+                                            std::streamoff &data_start) {
+  /* Reading the column names within the header row of the file that
+  ifs refers to, then storing the position at which the following
+  row begins within data_start. */
+  ifs.seekg(0);
+  std::string header_line;
+  std::getline(ifs, header_line);
+  data_start = ifs ? std::streamoff(ifs.tellg()) : file_size;
+  return header_col_names(header_line);
+}
+
+static std::streamoff find_line_start(std::ifstream &ifs, std::streamoff pos,
+                                      std::streamoff file_size) {
+  /* Returning the position of the first line that begins at or after
+  pos. Note that this approach assumes that line breaks never appear
+  within quoted fields (which is the case for the BTS datasets
+  used in this project). */
+  ifs.clear();
+  ifs.seekg(pos - 1);
+  std::string partial_line;
+  std::getline(ifs, partial_line);
+  if (!ifs) {
+    return file_size;
+  }
+  return ifs.tellg();
+}
+
+static std::vector<std::string>
+read_decompressed_header(Decompressing_Reader &reader,
+                         std::string &remainder) {
+  /* Reading the column names within the header row at the start of
+  reader's data, then storing whatever data was read beyond that row
+  within remainder. */
+  constexpr size_t header_block_bytes = 64 * 1024;
+  std::string text;
+  size_t line_end;
+  while ((line_end = text.find('\n')) == std::string::npos) {
+    size_t text_size = text.size();
+    text.resize(text_size + header_block_bytes);
+    size_t bytes_copied =
+        reader.read(text.data() + text_size, header_block_bytes);
+    text.resize(text_size + bytes_copied);
+    if (bytes_copied == 0) {
+      line_end = text.size();
+      break;
+    }
+  }
+  remainder = text.substr(std::min(line_end + 1, text.size()));
+  text.resize(line_end);
+  return header_col_names(text);
+}
+
+static long scan_compressed_file(std::string &data_file_path,
+                                 std::vector<Pivot_Spec> &pivot_specs,
+                                 Pivot_Table_States &states,
+                                 long rows_to_scan,
+                                 const Scan_Options &options,
+                                 Scan_Profile &profile) {
+  /* Scanning a gzip or zstd file, which gets decompressed as it's
+  read (see compressed_input.cpp) rather than beforehand. Because a
+  compressed stream can only be read in order, the file is always
+  scanned sequentially. If every pivot spec uses index_fields, the
+  decompressed blocks are split via a Column_Projection; when
+  options.pipeline is true or options.thread_count is greater than 1,
+  this takes place within scan_pipelined(), whose reader stage then
+  performs the decompression, so that decompressing, splitting, and
+  aggregating the rows overlap on three threads. Otherwise, the
+  decompressed data gets parsed by a CSVReader. Returns the number of
+  rows that were scanned; the number of compressed bytes that were read
+  gets stored within profile. */
+  if (options.resume_appended_rows) {
+    throw std::runtime_error("resume_appended_rows can't be used with "
+                             "compressed files, since they can't be read "
+                             "starting partway through.");
+  }
+  Decompressing_Reader reader(data_file_path);
+  long scanned_rows = 0;
+  auto scan_start = std::chrono::steady_clock::now();
+  if (can_project(pivot_specs) == false) {
+    Decompressing_Streambuf streambuf(reader);
+    std::istream stream(&streambuf);
+    // (This allows decompression errors to reach the caller rather than
+    // just ending the stream early.)
+    stream.exceptions(std::ios::badbit);
+    CSVReader csv_reader(stream, CSVFormat());
+    std::vector<Spec_Columns> spec_columns =
+        resolve_spec_columns(csv_reader.get_col_names(), pivot_specs);
+    std::vector<Row_Filter> row_filters =
+        compile_row_filters(csv_reader.get_col_names(), pivot_specs);
+    for (CSVRow &row : csv_reader) {
+      if (scanned_rows == rows_to_scan) {
+        break;
+      }
+      add_row_to_pivots(CSV_Row_Fields{row}, pivot_specs, spec_columns,
+                        row_filters, states);
+      scanned_rows++;
+    }
+    profile.scan_seconds = seconds_since(scan_start);
+    profile.bytes_read = reader.bytes_read();
+    return scanned_rows;
+  }
+
+  std::string remainder;
+  std::vector<std::string> col_names =
+      read_decompressed_header(reader, remainder);
+  std::vector<Spec_Columns> spec_columns =
+      resolve_spec_columns(col_names, pivot_specs);
+  if (options.pipeline || (options.thread_count > 1)) {
+    scan_pipelined(
+        [&](auto function) {
+          read_decompressed_blocks(reader, std::move(remainder),
+                                   pipeline_block_bytes, function);
+        },
+        col_names, pivot_specs, spec_columns, states, scanned_rows,
+        rows_to_scan, profile);
+  } else {
+    std::vector<Row_Filter> row_filters =
+        compile_row_filters(col_names, pivot_specs);
+    Column_Projection projection =
+        pivot_projection(spec_columns, row_filters);
+    read_decompressed_blocks(
+        reader, std::move(remainder), parallel_block_bytes,
+        [&](std::string &block) {
+          scan_projected_lines(block, projection, pivot_specs, spec_columns,
+                               row_filters, states, scanned_rows,
+                               rows_to_scan);
+          return scanned_rows != rows_to_scan;
+        });
+    profile.scan_seconds = seconds_since(scan_start);
+  }
+  profile.bytes_read = reader.bytes_read();
+  return scanned_rows;
+}
+
+static std::vector<Aggregate_Set>
+spec_aggregate_sets(const Pivot_Spec &spec) {
+  /* Returning the Aggregate_Set of each of spec's value fields (in the
+  same order as spec.value_fields). Throws a std::runtime_error if
+  spec.value_aggregates refers to a field that isn't a value field. */
+  std::vector<Aggregate_Set> aggregate_sets(spec.value_fields.size());
+  for (const auto &[field, aggregate_set] : spec.value_aggregates) {
+    auto field_it = std::ranges::find(spec.value_fields, field);
+    if (field_it == spec.value_fields.end()) {
+      throw std::runtime_error("Aggregates were requested for " + field +
+                               ", which is not one of this pivot table's "
+                               "value fields.");
+    }
+    aggregate_sets[field_it - spec.value_fields.begin()] = aggregate_set;
+  }
+  return aggregate_sets;
+}
+
+static Pivot_Table_States new_pivot_states(std::vector<Pivot_Spec> &pivot_specs,
+                                           const Scan_Options &options,
+                                           int sharing_threads = 1,
+                                           bool time_row_phases = false) {
+  /* Creating one (empty) Pivot_Table_State for each pivot spec. Each
+  state receives an equal share of options.memory_budget_bytes, which
+  is also divided among sharing_threads sets of states. If
+  time_row_phases is true, each state's row_timer will be enabled. */
+  Pivot_Table_States states;
+  size_t memory_budget = 0;
+  if (options.memory_budget_bytes > 0) {
+    memory_budget =
+        std::max<size_t>(1, options.memory_budget_bytes /
+                                (pivot_specs.size() * sharing_threads));
+  }
+  for (Pivot_Spec &spec : pivot_specs) {
+    Pivot_Table_State &state = states.emplace_back(
+        options.backend, spec.value_fields.size(), spec.index_fields.size(),
+        options.missing_values, spec_aggregate_sets(spec));
+    state.memory_budget = memory_budget;
+    state.spill_directory = options.spill_directory;
+    if (time_row_phases) {
+      state.row_timer.enable();
+    }
+  }
+  return states;
+}
+
+static std::vector<Pivot_Table_States>
+new_thread_states(int thread_count, std::vector<Pivot_Spec> &pivot_specs,
+                  const Scan_Options &options, bool time_row_phases) {
+  /* Creating a separate set of states for each thread. (Since each
+  state allocates its keys from its own arena, these states need to be
+  created separately rather than copied from a single set.) */
+  std::vector<Pivot_Table_States> thread_states;
+  for (int ti = 0; ti < thread_count; ti++) {
+    thread_states.push_back(
+        new_pivot_states(pivot_specs, options, thread_count,
+                         time_row_phases));
+  }
+  return thread_states;
+}
+
+static std::streamoff resume_position(const std::string &data_file_path,
+                                      std::streamoff data_start,
+                                      std::streamoff resume_offset,
+                                      std::streamoff file_size) {
+  /* Returning the position at which a scan should begin: either
+  data_start (the beginning of the row after the header) or, if the
+  scan is resuming from saved pivot states, the position at which
+  the previous scan ended. */
+  if (resume_offset > file_size) {
+    throw std::runtime_error(
+        data_file_path + " is smaller than it was when the saved pivot "
+                         "states were created, so new rows can't be "
+                         "identified.");
+  }
+  return std::max(data_start, resume_offset);
+}
+
+static long merge_thread_states(std::vector<Pivot_Table_States> &thread_states,
+                                const std::vector<long> &thread_scanned_rows,
+                                Pivot_Table_States &states,
+                                Scan_Profile &profile) {
+  /* Merging each thread's partial results into states, then returning
+  the total number of rows that the threads scanned. (The time needed
+  for this merge gets added to profile.merge_seconds.) */
+  auto merge_start = std::chrono::steady_clock::now();
+  long scanned_rows = 0;
+  for (int ti = 0; ti < thread_states.size(); ti++) {
+    for (int psi = 0; psi < states.size(); psi++) {
+      thread_states[ti][psi].finish_coded_groups();
+      states[psi].merge(thread_states[ti][psi]);
+    }
+    scanned_rows += thread_scanned_rows[ti];
+  }
+  profile.merge_seconds += seconds_since(merge_start);
+  return scanned_rows;
+}
+
+static long scan_in_parallel(std::string &data_file_path,
+                             std::vector<Pivot_Spec> &pivot_specs,
+                             Pivot_Table_States &states,
+                             const Scan_Options &options,
+                             std::streamoff resume_offset,
+                             std::streamoff &scan_end, Scan_Profile &profile) {
+  /* Dividing data_file_path into options.thread_count line-aligned byte
+  ranges, then scanning each range into its own set of pivot tables on
+  its own thread. Once all threads have finished, their partial sums
+  and counts get merged into states. Rows that begin before
+  resume_offset (see resume_position()) will be skipped, and the
+  position at which the scan ended will be stored in scan_end.
+  Each thread's scanning time and bytes read get added to profile.
+  Returns the number of rows scanned. */
+  int thread_count = options.thread_count;
+  std::ifstream ifs(data_file_path, std::ios::binary);
+  if (!ifs) {
+    throw std::runtime_error("Unable to open " + data_file_path);
+  }
+  ifs.seekg(0, std::ios::end);
+  std::streamoff file_size = ifs.tellg();
+  ifs.seekg(0);
+
+  // Retrieving the column names from the header row:
+  std::streamoff data_start = 0;
+  std::vector<std::string> col_names = read_header(ifs, file_size, data_start);
+  std::vector<Spec_Columns> spec_columns =
+      resolve_spec_columns(col_names, pivot_specs);
+  data_start = resume_position(data_file_path, data_start, resume_offset,
+                               file_size);
+  scan_end = file_size;
+
+  // Determining where each thread's byte range will begin:
+  std::vector<std::streamoff> range_starts{data_start};
+  for (int ti = 1; ti < thread_count; ti++) {
+    std::streamoff approx_start =
+        data_start + (file_size - data_start) * ti / thread_count;
+    range_starts.push_back(std::max(
+        range_starts.back(), find_line_start(ifs, approx_start, file_size)));
+  }
+  range_starts.push_back(file_size);
+
+  std::vector<Pivot_Table_States> thread_states = new_thread_states(
+      thread_count, pivot_specs, options, profile.time_row_phases);
+  std::vector<long> thread_scanned_rows(thread_count, 0);
+  std::vector<double> thread_seconds(thread_count, 0.0);
+  std::vector<uint64_t> thread_bytes_read(thread_count, 0);
+  run_on_threads(thread_count, [&](int ti) {
+    auto thread_start = std::chrono::steady_clock::now();
+    thread_bytes_read[ti] = scan_byte_range(
+        data_file_path, range_starts[ti], range_starts[ti + 1], col_names,
+        pivot_specs, spec_columns, thread_states[ti], thread_scanned_rows[ti]);
+    thread_seconds[ti] = seconds_since(thread_start);
+  });
+  for (int ti = 0; ti < thread_count; ti++) {
+    profile.scan_seconds += thread_seconds[ti];
+    profile.bytes_read += thread_bytes_read[ti];
+  }
+  return merge_thread_states(thread_states, thread_scanned_rows, states,
+                             profile);
+}
+
+static long scan_mapped_file(std::string &data_file_path,
+                             std::vector<Pivot_Spec> &pivot_specs,
+                             Pivot_Table_States &states, long rows_to_scan,
+                             const Scan_Options &options,
+                             std::streamoff resume_offset,
+                             std::streamoff &scan_end, Scan_Profile &profile) {
+  /* Scanning a memory-mapped copy of data_file_path via
+  Column_Projection objects, which tokenize each line in place. Index
+  and filter values are therefore passed along as views of the mapped
+  file, and value fields are parsed directly from it, so no fields
+  need to be copied into strings. (This function is only used for
+  projected scans; see can_project().) As with scan_in_parallel(),
+  the file will be divided into line-aligned ranges that get scanned
+  on separate threads if options.thread_count is greater than 1 and
+  rows_to_scan is -1. resume_offset, scan_end, and profile work the
+  same way as in scan_in_parallel(). Returns the number of rows
+  scanned. */
+  Mapped_File mapped_file(data_file_path);
+  std::string_view file_text = mapped_file.data();
+
+  size_t header_end = std::min(file_text.find('\n'), file_text.size());
+  std::vector<std::string> col_names =
+      header_col_names(std::string(file_text.substr(0, header_end)));
+  std::vector<Spec_Columns> spec_columns =
+      resolve_spec_columns(col_names, pivot_specs);
+  size_t data_start = resume_position(
+      data_file_path, std::min(header_end + 1, file_text.size()),
+      resume_offset, file_text.size());
+  // (If only the first rows_to_scan rows will be scanned, the position
+  // at which the scan will end isn't known ahead of time.)
+  scan_end = (rows_to_scan == -1) ? std::streamoff(file_text.size()) : -1;
+
+  int thread_count = (rows_to_scan == -1) ? std::max(options.thread_count, 1) : 1;
+  // Determining where each thread's range will begin: (See
+  // find_line_start() regarding line breaks within quoted fields.)
+  std::vector<size_t> range_starts{data_start};
+  for (int ti = 1; ti < thread_count; ti++) {
+    size_t approx_start =
+        data_start + (file_text.size() - data_start) * ti / thread_count;
+    size_t line_start =
+        std::min(file_text.find('\n', approx_start - 1), file_text.size());
+    range_starts.push_back(std::max(
+        range_starts.back(), std::min(line_start + 1, file_text.size())));
+  }
+  range_starts.push_back(file_text.size());
+
+  std::vector<Pivot_Table_States> thread_states = new_thread_states(
+      thread_count, pivot_specs, options, profile.time_row_phases);
+  std::vector<long> thread_scanned_rows(thread_count, 0);
+  std::vector<double> thread_seconds(thread_count, 0.0);
+  std::vector<uint64_t> thread_bytes_read(thread_count, 0);
+  run_on_threads(thread_count, [&](int ti) {
+    auto thread_start = std::chrono::steady_clock::now();
+    std::vector<Row_Filter> row_filters =
+        compile_row_filters(col_names, pivot_specs);
+    Column_Projection projection = pivot_projection(spec_columns, row_filters);
+    thread_bytes_read[ti] = scan_projected_lines(
+        file_text.substr(range_starts[ti], range_starts[ti + 1] - range_starts[ti]),
+        projection, pivot_specs, spec_columns, row_filters, thread_states[ti],
+        thread_scanned_rows[ti], rows_to_scan);
+    thread_seconds[ti] = seconds_since(thread_start);
+  });
+  for (int ti = 0; ti < thread_count; ti++) {
+    profile.scan_seconds += thread_seconds[ti];
+    profile.bytes_read += thread_bytes_read[ti];
+  }
+  return merge_thread_states(thread_states, thread_scanned_rows, states,
+                             profile);
+}
+
+// The first bytes of each pivot state file: (The final digit is
+// the file format's version number.)
+constexpr std::string_view pivot_state_magic = "CPTSTAT2";
+
+static std::string pivot_index_description(const Pivot_Spec &spec) {
+  return spec.index_headers.empty() ? join_with_pipes(spec.index_fields)
+                                    : spec.index_headers;
+}
+
+static void save_pivot_state(Pivot_Table_State &state, const Pivot_Spec &spec,
+                             const std::string &data_file_path,
+                             std::streamoff scan_end) {
+  /* Saving the sums, counts, and additional aggregates within state
+  (which shouldn't contain
+  any coded groups) to spec.state_file_path, along with the
+  information needed to check whether these totals can be combined
+  with those from a later scan. scan_end should store the position
+  at which the scan of data_file_path ended, or -1 if this position
+  isn't known. */
+  Binary_Writer writer(spec.state_file_path);
+  writer.write_bytes(pivot_state_magic.data(), pivot_state_magic.size());
+  writer.write_string(
+      std::filesystem::weakly_canonical(data_file_path).string());
+  writer.write<int64_t>(scan_end);
+  writer.write_string(pivot_index_description(spec));
+  writer.write<uint64_t>(spec.value_fields.size());
+  for (int vfi = 0; vfi < spec.value_fields.size(); vfi++) {
+    writer.write_string(spec.value_fields[vfi]);
+    writer.write<int64_t>(state.missing_counts[vfi]);
+  }
+  writer.write_string(state.aggregates.description(spec.value_fields));
+  uint64_t group_count = state.size();
+  if (state.spilled()) {
+    // (Spilled groups only get combined as their runs are merged, so
+    // an extra merge pass is needed in order to count them.)
+    group_count = 0;
+    state.for_each_sorted([&](std::string_view, Pivot_Vals *, size_t) {
+      group_count++;
+    });
+  }
+  writer.write<uint64_t>(group_count);
+  state.for_each_sorted([&](std::string_view pivot_index,
+                            Pivot_Vals *pivot_vals, size_t group) {
+    writer.write_string(pivot_index);
+    for (int vfi = 0; vfi < spec.value_fields.size(); vfi++) {
+      writer.write<double>(pivot_vals[vfi].pivot_sum);
+      writer.write<int64_t>(pivot_vals[vfi].pivot_count);
+    }
+    if (state.aggregates.enabled()) {
+      state.aggregates.save_group(writer, group);
+    }
+  });
+  writer.finish();
+}
+
+// Information about the scan that produced a saved pivot state:
+struct Saved_Scan_Info {
+  std::string data_file_path;
+  std::streamoff scan_end;
+};
+
+static Saved_Scan_Info load_pivot_state(Pivot_Table_State &state,
+                                        const Pivot_Spec &spec) {
+  /* Adding the sums, counts, and additional aggregates within
+  spec.state_file_path to state. Throws a std::runtime_error if the
+  file wasn't created for a pivot table with the same index fields,
+  value fields, and aggregates as this one. */
+  Binary_Reader reader(spec.state_file_path);
+  std::string magic(pivot_state_magic.size(), '\0');
+  reader.read_bytes(magic.data(), magic.size());
+  if (magic != pivot_state_magic) {
+    throw std::runtime_error(spec.state_file_path +
+                             " is not a pivot state file.");
+  }
+  Saved_Scan_Info scan_info;
+  scan_info.data_file_path = reader.read_string();
+  scan_info.scan_end = reader.read<int64_t>();
+
+  bool fields_match =
+      (reader.read_string() == pivot_index_description(spec)) &&
+      (reader.read<uint64_t>() == spec.value_fields.size());
+  for (int vfi = 0; fields_match && (vfi < spec.value_fields.size()); vfi++) {
+    fields_match = (reader.read_string() == spec.value_fields[vfi]);
+    state.missing_counts[vfi] += reader.read<int64_t>();
+  }
+  fields_match = fields_match && (reader.read_string() ==
+                                  state.aggregates.description(
+                                      spec.value_fields));
+  if (fields_match == false) {
+    throw std::runtime_error(
+        spec.state_file_path +
+        " was created for a pivot table with different index fields, "
+        "value fields, or aggregates.");
+  }
+
+  uint64_t group_count = reader.read<uint64_t>();
+  for (uint64_t group = 0; group < group_count; group++) {
+    Pivot_Vals *pivot_vals = state.find_or_insert(reader.read_string());
+    for (int vfi = 0; vfi < spec.value_fields.size(); vfi++) {
+      pivot_vals[vfi].pivot_sum += reader.read<double>();
+      pivot_vals[vfi].pivot_count += reader.read<int64_t>();
+    }
+    if (state.aggregates.enabled()) {
+      state.aggregates.load_group(reader, state.group_of(pivot_vals));
+    }
+    state.check_memory_budget();
+  }
+  return scan_info;
+}
+
+static std::streamoff load_pivot_states(const std::string &data_file_path,
+                                        std::vector<Pivot_Spec> &pivot_specs,
+                                        Pivot_Table_States &states,
+                                        const Scan_Options &options) {
+  /* Loading the saved state (if any) of each pivot spec that has a
+  state_file_path. Returns the position at which the scan of
+  data_file_path should resume if options.resume_appended_rows is
+  true, and 0 otherwise. */
+  std::string canonical_path =
+      std::filesystem::weakly_canonical(data_file_path).string();
+  std::vector<Saved_Scan_Info> scan_infos;
+  for (int psi = 0; psi < pivot_specs.size(); psi++) {
+    Pivot_Spec &spec = pivot_specs[psi];
+    if (!spec.state_file_path.empty() &&
+        std::filesystem::exists(spec.state_file_path)) {
+      scan_infos.push_back(load_pivot_state(states[psi], spec));
+    }
+  }
+  if (options.resume_appended_rows == false) {
+    // Rescanning every row of the file that a state was saved from
+    // would count each of those rows twice.
+    if (options.combine_rescanned_states == false) {
+      for (const Saved_Scan_Info &scan_info : scan_infos) {
+        if ((scan_info.data_file_path == canonical_path) &&
+            (scan_info.scan_end >= 0)) {
+          throw std::runtime_error(
+              "A saved state already contains a complete scan of " +
+              data_file_path +
+              ". Set resume_appended_rows to true to scan only the rows "
+              "appended since then, delete the state file, or set "
+              "combine_rescanned_states to true to count these rows "
+              "again.");
+        }
+      }
+    }
+    return 0;
+  }
+  // In order for the scan to resume where the previous one ended,
+  // every pivot table must have been saved after a complete scan of
+  // this same file. (Otherwise, some rows would either get skipped or
+  // counted twice.)
+  bool can_resume = (scan_infos.size() == pivot_specs.size()) &&
+                    !scan_infos.empty();
+  for (const Saved_Scan_Info &scan_info : scan_infos) {
+    can_resume = can_resume && (scan_info.data_file_path == canonical_path) &&
+                 (scan_info.scan_end >= 0) &&
+                 (scan_info.scan_end == scan_infos.front().scan_end);
+  }
+  if (can_resume == false) {
+    throw std::runtime_error(
+        "resume_appended_rows requires every pivot spec to have a saved "
+        "state from a complete scan of " +
+        data_file_path + ".");
+  }
+  return scan_infos.front().scan_end;
+}
+
+static size_t write_sampled_pivot_csv(const Sample_Estimator &estimator,
+                                      const Pivot_Spec &spec,
+                                      const Scan_Options &options) {
+  /* Writing the estimates within estimator to spec.pivot_file_path.
+  Each value field's sum, count, and mean are followed by the margins
+  of error of these estimates. Returns the number of rows (i.e.
+  groups) that were written. */
+  Csv_Output_Writer writer(spec.pivot_file_path, options.output_precision,
+                           options.output_format);
+  writer.write_field(pivot_index_description(spec));
+  static const std::array<std::string, 6> estimate_columns{
+      "Sum", "Count", "Mean", "Sum_Margin", "Count_Margin", "Mean_Margin"};
+  for (const std::string &value_field : spec.value_fields) {
+    for (const std::string &estimate_column : estimate_columns) {
+      writer.write_field(value_field + "_" + estimate_column);
+    }
+  }
+  writer.end_row();
+
+  estimator.for_each_sorted(
+      options.confidence_level,
+      [&](std::string_view pivot_index, const Sample_Estimate *estimates) {
+        writer.write_field(pivot_index);
+        for (size_t vfi = 0; vfi < spec.value_fields.size(); vfi++) {
+          const Sample_Estimate &estimate = estimates[vfi];
+          for (double value : {estimate.sum, estimate.count, estimate.mean,
+                               estimate.sum_margin, estimate.count_margin,
+                               estimate.mean_margin}) {
+            writer.write_field(value);
+          }
+        }
+        writer.end_row();
+      });
+  writer.flush();
+  return estimator.size();
+}
+
+// A stratum of a sampled scan: blocks first_block through
+// (first_block + block_count - 1), of which sampled_count will be read.
+struct Sample_Stratum {
+  size_t first_block;
+  size_t block_count;
+  size_t sampled_count;
+};
+
+static std::vector<Sample_Stratum>
+sample_strata(size_t block_count, const Scan_Options &options) {
+  /* Dividing block_count blocks into the strata from which a sampled
+  scan will draw its blocks. Roughly options.sample_fraction of the
+  blocks (but at least two, when possible) get sampled. Stratified
+  samples use one stratum for every two sampled blocks, which is the
+  finest stratification that still allows each stratum's variance to
+  be estimated; uniform samples use a single stratum. */
+  if (block_count == 0) {
+    return {};
+  }
+  size_t sample_size = static_cast<size_t>(
+      std::ceil(double(block_count) * options.sample_fraction));
+  sample_size = std::clamp<size_t>(
+      sample_size, std::min<size_t>(2, block_count), block_count);
+  size_t stratum_count = (options.sample_design == Sample_Design::stratified)
+                             ? std::max<size_t>(1, sample_size / 2)
+                             : 1;
+  std::vector<Sample_Stratum> strata;
+  for (size_t stratum = 0; stratum < stratum_count; stratum++) {
+    size_t first_block = block_count * stratum / stratum_count;
+    size_t end_block = block_count * (stratum + 1) / stratum_count;
+    size_t sampled_count = sample_size * (stratum + 1) / stratum_count -
+                           sample_size * stratum / stratum_count;
+    strata.push_back({first_block, end_block - first_block,
+                      std::min(sampled_count, end_block - first_block)});
+  }
+  return strata;
+}
+
+static void scan_sampled_blocks(std::string &data_file_path,
+                                std::vector<Pivot_Spec> &pivot_specs,
+                                long rows_to_scan, const Scan_Options &options,
+                                Pivot_Stats *stats) {
+  /* Estimating each pivot table from a random sample of
+  data_file_path's blocks, then writing these estimates (along with
+  their margins of error) to each spec's pivot_file_path. This
+  function implements scan_to_multi_pivot()'s sampled mode; see
+  sample_estimator.cpp for the estimation method.
+
+  The file's data rows are divided into blocks of
+  options.sample_block_bytes (each of which begins and ends at the
+  first line break after its nominal boundaries, so that every row
+  belongs to exactly one block). Each sampled block gets scanned
+  (via scan_byte_range()) into its own small set of tables, whose
+  groups are then added to each table's Sample_Estimator. */
   auto function_start_time = std::chrono::high_resolution_clock::now();
+  if (!(options.sample_fraction > 0.0) || (options.sample_fraction > 1.0)) {
+    throw std::runtime_error("sample_fraction must be greater than 0 and no "
+                             "greater than 1.");
+  }
+  if (options.sample_block_bytes == 0) {
+    throw std::runtime_error("sample_block_bytes must be greater than 0.");
+  }
+  if ((rows_to_scan != -1) || options.resume_appended_rows) {
+    throw std::runtime_error("Sampled scans can't be combined with "
+                             "rows_to_scan or resume_appended_rows.");
+  }
+  if (detect_compression(data_file_path) != Input_Compression::none) {
+    throw std::runtime_error("Sampled scans need to read blocks from "
+                             "throughout the file, so they can't be used "
+                             "with compressed files.");
+  }
+  for (const Pivot_Spec &spec : pivot_specs) {
+    if (!spec.state_file_path.empty() || !spec.value_aggregates.empty() ||
+        !spec.rollups.empty() || !spec.selection.empty()) {
+      throw std::runtime_error(
+          "Sampled scans don't support state files, additional "
+          "aggregates, rollups, or selections, but " +
+          spec.pivot_file_path + " requested one of these.");
+    }
+  }
+
+  std::ifstream ifs(data_file_path, std::ios::binary);
+  if (!ifs) {
+    throw std::runtime_error("Unable to open " + data_file_path);
+  }
+  ifs.seekg(0, std::ios::end);
+  std::streamoff file_size = ifs.tellg();
+  std::streamoff data_start = 0;
+  std::vector<std::string> col_names = read_header(ifs, file_size, data_start);
+  std::vector<Spec_Columns> spec_columns =
+      resolve_spec_columns(col_names, pivot_specs);
+
+  std::streamoff block_bytes = options.sample_block_bytes;
+  size_t block_count = (file_size - data_start + block_bytes - 1) / block_bytes;
+  // Returns the position at which block's first row begins: (The
+  // final block ends at the end of the file.)
+  auto block_start = [&](size_t block) -> std::streamoff {
+    if (block == 0) {
+      return data_start;
+    }
+    if (block >= block_count) {
+      return file_size;
+    }
+    return find_line_start(ifs, data_start + block * block_bytes, file_size);
+  };
+
+  // Each block's tables only need to hold that block's groups, so
+  // they don't need a memory budget. (tally_states, which never
+  // receive any groups, collect the measurements of every block's
+  // tables for Pivot_Stats.)
+  Scan_Options block_options = options;
+  block_options.memory_budget_bytes = 0;
+  Scan_Profile profile;
+  profile.time_row_phases = (stats != nullptr);
+  Pivot_Table_States tally_states =
+      new_pivot_states(pivot_specs, block_options);
+  std::vector<Sample_Estimator> estimators;
+  for (const Pivot_Spec &spec : pivot_specs) {
+    estimators.emplace_back(spec.value_fields.size());
+  }
+
+  std::mt19937_64 generator(options.sample_seed);
+  long scanned_rows = 0;
+  size_t sampled_blocks = 0;
+  for (const Sample_Stratum &stratum : sample_strata(block_count, options)) {
+    for (Sample_Estimator &estimator : estimators) {
+      estimator.begin_stratum(stratum.block_count, stratum.sampled_count);
+    }
+    // (std::sample() keeps the selected blocks in order, so the file
+    // still gets read from beginning to end.)
+    std::vector<size_t> stratum_blocks(stratum.block_count);
+    std::iota(stratum_blocks.begin(), stratum_blocks.end(),
+              stratum.first_block);
+    std::vector<size_t> blocks;
+    std::sample(stratum_blocks.begin(), stratum_blocks.end(),
+                std::back_inserter(blocks), stratum.sampled_count, generator);
+    for (size_t block : blocks) {
+      std::streamoff range_start = block_start(block);
+      std::streamoff range_end = block_start(block + 1);
+      Pivot_Table_States block_states = new_pivot_states(
+          pivot_specs, block_options, 1, profile.time_row_phases);
+      if (range_start < range_end) {
+        auto scan_start = std::chrono::steady_clock::now();
+        profile.bytes_read += scan_byte_range(
+            data_file_path, range_start, range_end, col_names, pivot_specs,
+            spec_columns, block_states, scanned_rows);
+        profile.scan_seconds += seconds_since(scan_start);
+      }
+      // (A block that contains no rows, e.g. because a single long
+      // line spans it, still counts as a sampled block whose sums are
+      // all 0.)
+      for (int psi = 0; psi < pivot_specs.size(); psi++) {
+        Pivot_Table_State &block_state = block_states[psi];
+        block_state.finish_coded_groups();
+        block_state.for_each_sorted_in_memory(
+            [&](std::string_view pivot_index, Pivot_Vals *pivot_vals,
+                size_t) {
+              estimators[psi].add_block_group(pivot_index, pivot_vals);
+            });
+        Pivot_Table_State &tally_state = tally_states[psi];
+        for (int vfi = 0; vfi < pivot_specs[psi].value_fields.size(); vfi++) {
+          tally_state.missing_counts[vfi] += block_state.missing_counts[vfi];
+        }
+        tally_state.rows_filtered_out += block_state.rows_filtered_out;
+        tally_state.row_timer.merge(block_state.row_timer);
+        tally_state.peak_bytes =
+            std::max(tally_state.peak_bytes, block_state.peak_bytes);
+      }
+      sampled_blocks++;
+    }
+    for (Sample_Estimator &estimator : estimators) {
+      estimator.end_stratum();
+    }
+  }
+
+  auto write_start = std::chrono::steady_clock::now();
+  std::vector<size_t> distinct_groups;
+  for (int psi = 0; psi < pivot_specs.size(); psi++) {
+    distinct_groups.push_back(
+        write_sampled_pivot_csv(estimators[psi], pivot_specs[psi], options));
+  }
+  double write_seconds = seconds_since(write_start);
+
+  auto function_end_time = std::chrono::high_resolution_clock::now();
+  auto function_run_time =
+      std::chrono::duration<double>(function_end_time - function_start_time)
+          .count();
+  if (stats) {
+    // (The tallied row counts, blank counts, and phase times only
+    // reflect the sampled rows, and each table's peak size is that of
+    // its largest block.)
+    *stats = Pivot_Stats{};
+    for (int psi = 0; psi < pivot_specs.size(); psi++) {
+      add_table_stats(*stats, tally_states[psi],
+                      pivot_specs[psi].pivot_file_path, distinct_groups[psi]);
+    }
+    stats->parse_seconds =
+        std::max(0.0, profile.scan_seconds - stats->filter_seconds -
+                          stats->key_build_seconds -
+                          stats->aggregate_seconds);
+    stats->write_seconds = write_seconds;
+    stats->total_seconds = function_run_time;
+    stats->rows_scanned = scanned_rows;
+    stats->bytes_read = profile.bytes_read;
+  }
+  if (options.log_to_stdout) {
+    std::cout << "Estimated " << pivot_specs.size() << " pivot table"
+              << ((pivot_specs.size() == 1) ? "" : "s") << " from "
+              << sampled_blocks << " of " << block_count << " blocks ("
+              << scanned_rows << " rows) in " << function_run_time
+              << " seconds.\n";
+  }
+}
+
+static long scan_data_file(std::string &data_file_path,
+                           std::vector<Pivot_Spec> &pivot_specs,
+                           Pivot_Table_States &states, long rows_to_scan,
+                           const Scan_Options &options,
+                           std::streamoff resume_offset, bool saving_states,
+                           std::streamoff &scan_end, Scan_Profile &profile) {
+  /* Scanning a single .csv file into states via whichever of
+  scan_to_multi_pivot()'s modes options (and pivot_specs) call for.
+  Rows that begin before resume_offset will be skipped; if saving_states
+  is true, the position at which the scan ended will be stored within
+  scan_end (when known). Returns the number of rows scanned. */
+  long scanned_rows = 0;
+  if (detect_compression(data_file_path) != Input_Compression::none) {
+    scanned_rows = scan_compressed_file(data_file_path, pivot_specs, states,
+                                        rows_to_scan, options, profile);
+  } else if (options.memory_map && can_project(pivot_specs)) {
+    scanned_rows = scan_mapped_file(data_file_path, pivot_specs, states,
+                                    rows_to_scan, options, resume_offset,
+                                    scan_end, profile);
+  } else if ((options.thread_count > 1) && (rows_to_scan == -1)) {
+    scanned_rows = scan_in_parallel(data_file_path, pivot_specs, states,
+                                    options, resume_offset, scan_end, profile);
+  } else if (can_project(pivot_specs) || saving_states) {
+    // If every pivot spec has index_fields, the file can be scanned
+    // via a Column_Projection rather than a CSVReader, which allows
+    // all unused fields to be skipped: (See csv_projection.cpp.)
+    // scan_byte_range() is also used when pivot states will be saved,
+    // since it allows the scan to begin (and end) at a specific
+    // position within the file.
+    std::ifstream ifs(data_file_path, std::ios::binary);
+    if (!ifs) {
+      throw std::runtime_error("Unable to open " + data_file_path);
+    }
+    ifs.seekg(0, std::ios::end);
+    std::streamoff file_size = ifs.tellg();
+    std::streamoff data_start = 0;
+    std::vector<std::string> col_names =
+        read_header(ifs, file_size, data_start);
+    std::vector<Spec_Columns> spec_columns =
+        resolve_spec_columns(col_names, pivot_specs);
+    data_start = resume_position(data_file_path, data_start, resume_offset,
+                                 file_size);
+    scan_end = (rows_to_scan == -1) ? file_size : -1;
+    if (options.pipeline && can_project(pivot_specs)) {
+      scan_pipelined(
+          [&](auto function) {
+            std::ifstream ifs(data_file_path, std::ios::binary);
+            read_line_aligned_blocks(ifs, data_start, file_size,
+                                     pipeline_block_bytes, function);
+          },
+          col_names, pivot_specs, spec_columns, states, scanned_rows,
+          rows_to_scan, profile);
+    } else {
+      auto scan_start = std::chrono::steady_clock::now();
+      profile.bytes_read = scan_byte_range(
+          data_file_path, data_start, file_size, col_names, pivot_specs,
+          spec_columns, states, scanned_rows, rows_to_scan);
+      profile.scan_seconds = seconds_since(scan_start);
+    }
+  } else {
+    // Initializing a CSVReader object that will allow us to
+    // iterate through our .csv file, one row at a time:
+    /* This code was based on the example found at:
+    https://github.com/vincentlaucsb/csv-parser?
+    tab=readme-ov-file#reading-an-arbitrarily-large-file-with-iterators */
+    // (CSVReader reads and parses rows ahead of the ones that it
+    // returns, partly on a thread of its own; as a result, the size of
+    // the file gets reported as the number of bytes read, and this
+    // scan's parse time only includes the time that this thread spent
+    // waiting on the reader.)
+    auto scan_start = std::chrono::steady_clock::now();
+    CSVReader reader(data_file_path);
+    std::vector<Spec_Columns> spec_columns =
+        resolve_spec_columns(reader.get_col_names(), pivot_specs);
+    std::vector<Row_Filter> row_filters =
+        compile_row_filters(reader.get_col_names(), pivot_specs);
+    profile.bytes_read = std::filesystem::file_size(data_file_path);
+    for (CSVRow &row : reader) {
+      if ((scanned_rows < rows_to_scan) || (rows_to_scan == -1)) {
+        add_row_to_pivots(CSV_Row_Fields{row}, pivot_specs, spec_columns,
+                          row_filters, states);
+        scanned_rows++; // This number should be incremented regardless
+        // of whether or not the current row qualified for inclusion
+        // in any of the pivot tables.
+      } else // In this case, we've scanned the requested
+             // number of rows and can thus exit the loop early.
+      {
+        break;
+      }
+    }
+    profile.scan_seconds = seconds_since(scan_start);
+  }
+  return scanned_rows;
+}
+
+std::vector<std::string> expand_data_file_paths(const std::string &pattern) {
+  /* If pattern contains any glob characters (*, ?, or [) and doesn't
+  name an existing file, returning the files that it matches (in
+  alphabetical order) via POSIX glob(); otherwise, returning pattern
+  itself. Throws a std::runtime_error if a pattern matches no files. */
+  if ((pattern.find_first_of("*?[") == std::string::npos) ||
+      std::filesystem::exists(pattern)) {
+    return {pattern};
+  }
+  glob_t matches{};
+  int result = glob(pattern.c_str(), 0, nullptr, &matches);
+  std::vector<std::string> paths(matches.gl_pathv,
+                                 matches.gl_pathv + matches.gl_pathc);
+  globfree(&matches);
+  if ((result != 0) || paths.empty()) {
+    throw std::runtime_error("No files match " + pattern);
+  }
+  return paths;
+}
+
+static std::vector<std::string>
+data_file_columns(const std::string &data_file_path) {
+  /* Returning the column names within data_file_path's header row.
+  (Compressed files get decompressed just far enough to read this
+  row.) */
+  Decompressing_Reader reader(data_file_path);
+  std::string remainder;
+  return read_decompressed_header(reader, remainder);
+}
+
+static void add_scan_profile(Scan_Profile &profile,
+                             const Scan_Profile &file_profile) {
+  profile.scan_seconds += file_profile.scan_seconds;
+  profile.merge_seconds += file_profile.merge_seconds;
+  profile.bytes_read += file_profile.bytes_read;
+}
+
+static long scan_data_files(std::vector<std::string> &data_file_paths,
+                            std::vector<Pivot_Spec> &pivot_specs,
+                            Pivot_Table_States &states, long rows_to_scan,
+                            const Scan_Options &options,
+                            Scan_Profile &profile) {
+  /* Scanning several .csv files (each of which must have the same
+  columns as the first) into states; see scan_to_multi_pivot(). Returns
+  the total number of rows scanned. */
+  const std::vector<std::string> col_names =
+      data_file_columns(data_file_paths.front());
+  for (const std::string &data_file_path : data_file_paths) {
+    if (data_file_columns(data_file_path) != col_names) {
+      throw std::runtime_error("The columns of " + data_file_path +
+                               " don't match those of " +
+                               data_file_paths.front() + ".");
+    }
+  }
+  std::streamoff scan_end = -1;
+
+  if (rows_to_scan != -1) {
+    // (The first rows_to_scan rows can only be identified by scanning
+    // the files in order.)
+    long scanned_rows = 0;
+    for (std::string &data_file_path : data_file_paths) {
+      if (scanned_rows == rows_to_scan) {
+        break;
+      }
+      Scan_Profile file_profile;
+      file_profile.time_row_phases = profile.time_row_phases;
+      scanned_rows += scan_data_file(data_file_path, pivot_specs, states,
+                                     rows_to_scan - scanned_rows, options, 0,
+                                     false, scan_end, file_profile);
+      add_scan_profile(profile, file_profile);
+    }
+    return scanned_rows;
+  }
+
+  // Each worker claims the largest remaining file whenever it finishes
+  // one, which keeps a few large files from ending up on the same
+  // worker at the end of the scan.
+  std::vector<std::string *> files_by_size;
+  for (std::string &data_file_path : data_file_paths) {
+    files_by_size.push_back(&data_file_path);
+  }
+  std::ranges::stable_sort(files_by_size, std::greater<>(),
+                           [](const std::string *data_file_path) {
+                             return std::filesystem::file_size(
+                                 *data_file_path);
+                           });
+  int worker_count = std::clamp<int>(options.thread_count, 1,
+                                     int(data_file_paths.size()));
+  Scan_Options file_options = options;
+  file_options.thread_count = std::max(1, options.thread_count / worker_count);
+  file_options.memory_budget_bytes = options.memory_budget_bytes / worker_count;
+  if ((options.memory_budget_bytes > 0) &&
+      (file_options.memory_budget_bytes == 0)) {
+    file_options.memory_budget_bytes = 1;
+  }
+
+  std::vector<Pivot_Table_States> worker_states = new_thread_states(
+      worker_count, pivot_specs, options, profile.time_row_phases);
+  std::vector<long> worker_scanned_rows(worker_count, 0);
+  std::vector<Scan_Profile> worker_profiles(worker_count);
+  std::atomic<size_t> next_file{0};
+  run_on_threads(worker_count, [&](int wi) {
+    std::streamoff file_scan_end = -1;
+    for (size_t fi = next_file++; fi < files_by_size.size();
+         fi = next_file++) {
+      Scan_Profile file_profile;
+      file_profile.time_row_phases = profile.time_row_phases;
+      worker_scanned_rows[wi] += scan_data_file(
+          *files_by_size[fi], pivot_specs, worker_states[wi], -1,
+          file_options, 0, false, file_scan_end, file_profile);
+      add_scan_profile(worker_profiles[wi], file_profile);
+    }
+  });
+  for (const Scan_Profile &worker_profile : worker_profiles) {
+    add_scan_profile(profile, worker_profile);
+  }
+  return merge_thread_states(worker_states, worker_scanned_rows, states,
+                             profile);
+}
 
-  // Initializing a CSVReader object that will allow us to
-  // iterate through our .csv file, one row at a time:
-  /* This code was based on the example found at:
-  https://github.com/vincentlaucsb/csv-parser?
-  tab=readme-ov-file#reading-an-arbitrarily-large-file-with-iterators */
-  CSVReader reader(data_file_path);
+void scan_to_multi_pivot(std::vector<std::string> &data_file_paths,
+                         std::vector<Pivot_Spec> &pivot_specs,
+                         long &rows_to_scan, const Scan_Options &options,
+                         Pivot_Stats *stats) {
+  /* This function produces one pivot table for each entry within
+  pivot_specs while reading through each of data_file_paths only once
+  (as though these files, which must all have the same columns, had
+  been concatenated). If you
+  need several pivot tables from the same .csv file (e.g. filtered and
+  unfiltered versions, or tables with different index fields), calling
+  this function once will be much faster than calling scan_to_pivot()
+  several times, since the time needed to parse the .csv file will
+  generally far exceed the time needed to update the pivot maps.
+
+  pivot_specs: A vector of Pivot_Spec structs, each of which contains
+  the value_fields, index_headers, index_gen, include_map, exclude_map,
+  and pivot_file_path arguments for one pivot table. (See the
+  scan_to_pivot() documentation for more information on each of these.)
+
+  rows_to_scan: Works the same way as in scan_to_pivot(); this limit
+  applies to all of the pivot tables within pivot_specs.
+
+  options: A Scan_Options struct that controls how the file gets
+  scanned. If options.thread_count is greater than 1, the file will
+  be divided into that many line-aligned byte ranges, each of which
+  will get scanned into its own set of pivot maps on a separate thread.
+  These partial sums and counts will then get merged before the
+  means are calculated. (Because the first rows_to_scan rows can only
+  be identified by reading the file in order, this parallel mode
+  is only used when rows_to_scan is set to -1.)
+  options.backend determines whether each pivot table's results will
+  be aggregated within a std::map (Pivot_Backend::ordered_map) or
+  within a Pivot_Hash_Table (Pivot_Backend::hash_table); the latter
+  option avoids a tree lookup for every row, then sorts its keys once
+  so that the output will be identical either way.
+
+  If every pivot spec defines its index via index_fields, this function
+  will split each line via a Column_Projection (see
+  csv_projection.cpp) rather than a CSVReader. This allows all fields
+  that aren't used as index, value, or filter fields to be skipped over
+  rather than parsed and stored. Setting options.memory_map to true
+  will further allow these projected scans to read the file via
+  mmap() and tokenize it in place (see mapped_file.cpp). Single-threaded
+  projected scans that don't use mmap() can instead set
+  options.pipeline to true, which overlaps reading, line splitting,
+  and aggregation on three threads (see scan_pipelined()).
+  options.missing_values determines whether blank value fields will be
+  skipped, counted as zeros, or treated as errors (the default); the
+  number of blank values found within each pivot table's value fields
+  will be printed once the scan has finished. Value fields are parsed
+  via std::from_chars() regardless of how the file gets scanned.
+
+  For pivot tables with very many groups, options.memory_budget_bytes
+  can cap the memory that the tables occupy. Whenever a table exceeds
+  its share of this budget, its groups are written (in sorted order)
+  to a run file and then cleared; once the scan finishes, these runs
+  are combined via a k-way merge that streams the output rows in the
+  same order as an in-memory table would. (Sums may still differ in
+  their final digits, since they get added in a different order.)
+
+  data_file_path may also refer to a gzip or zstd file (identified by
+  its first few bytes), which will be decompressed as it's read rather
+  than beforehand; see scan_compressed_file(). Such files are always
+  read sequentially, so memory_map is ignored for them, and
+  thread_count values above 1 have the same effect as pipeline.
+  Pivot_Stats::bytes_read will then count compressed bytes.
+
+  When data_file_paths contains more than one file, and rows_to_scan is
+  -1, the files are divided among min(options.thread_count, file count)
+  workers (largest files first); each worker scans one whole file at a
+  time into its own set of tables, which then get merged. (Leftover
+  threads get divided evenly among the workers, so each file can also
+  be scanned in parallel.) Otherwise, the files are scanned one after
+  another. Either way, every file's header must match that of the
+  first file. Multi-file scans can't be sampled or resumed.
+
+  A spec's rollups (see Pivot_Rollup) are derived from its finished
+  table as that table gets written out: each of its groups is added
+  (via the same accumulator merge used for parallel scans) to the
+  matching group of every level, so subtotals and grand totals don't
+  require any additional scans or specs.
+
+  A spec's selection (see Pivot_Selection) is also applied as its table
+  gets written: only the groups that satisfy its conditions are
+  written, and if it has a limit, the best of those groups are kept
+  within a heap of that size (whose entries are copies, since spilled
+  groups only exist while their runs are being merged) and then
+  written in rank order. With the hash_table backend, the table's keys
+  are then never sorted at all. The returned stats still count every
+  group.
+
+  stats (optional): if this pointer isn't null, the Pivot_Stats struct
+  that it points to will be overwritten with this scan's per-phase
+  timings, row and group counts, and bytes read. (Only a sample of
+  rows gets timed, and only when stats are requested; see
+  Row_Phase_Timer.) The running time and blank value counts will also
+  be printed unless options.log_to_stdout is false.
+  */
+
+  if (data_file_paths.empty()) {
+    throw std::runtime_error("No data files were specified.");
+  }
+  std::string &data_file_path = data_file_paths.front();
+  if ((data_file_paths.size() > 1) &&
+      ((options.sample_fraction != 0.0) || options.resume_appended_rows)) {
+    throw std::runtime_error("Sampled scans and resume_appended_rows can "
+                             "only be used with a single data file.");
+  }
+  if (options.sample_fraction != 0.0) {
+    scan_sampled_blocks(data_file_path, pivot_specs, rows_to_scan, options,
+                        stats);
+    return;
+  }
+
+  auto function_start_time = std::chrono::high_resolution_clock::now();
+  Scan_Profile profile;
+  profile.time_row_phases = (stats != nullptr);
 
   // Initializing a struct that can store results for each
   // pivot index combination:
@@ -112,162 +3014,313 @@ void scan_to_pivot(
   // that these initial values are strictly necessary to specify,
   // but it shouldn't hurt to do so.)
 
-  // Creating a map that can be used to store values for our pivot
-  // table calculations:
-  // (Each key will be a unique combination of pivot_index values;
-  // each corresponding value will be an array of structs with the
-  // same length as that of value_fields. That way, one struct
-  // can be created, and easily accessed, for each value.)
-  // Note: although it results in longer processing time,
-  // I chose to use a regular map here, rather than an unordered
-  // map, because I wanted the final output to be in alphabetical order.
-  std::map<std::string, std::vector<Pivot_Vals>> pivot_map;
+  // Creating one map (or hash table) for each pivot spec that can be
+  // used to store values for our pivot table calculations:
+  Pivot_Table_States states =
+      new_pivot_states(pivot_specs, options, 1, profile.time_row_phases);
+
+  // The rollup levels (if any) that will be derived from each table
+  // once the scan has finished, along with the selection that chooses
+  // which of its groups get written: (These are created beforehand so
+  // that any invalid levels or selections will be reported without
+  // scanning the file.)
+  std::vector<Rollup_Tables> rollups;
+  std::vector<Group_Selector> selectors;
+  for (const Pivot_Spec &spec : pivot_specs) {
+    selectors.emplace_back(spec.selection, spec.value_fields);
+    rollups.emplace_back(spec.rollups,
+                         spec.index_fields.empty()
+                             ? split_index_headers(spec.index_headers)
+                             : spec.index_fields,
+                         options.backend, spec.value_fields.size(),
+                         spec_aggregate_sets(spec));
+  }
+
+  // Loading any saved pivot states, then determining whether this scan
+  // should resume where the previous one ended:
+  std::streamoff resume_offset =
+      load_pivot_states(data_file_path, pivot_specs, states, options);
+  bool saving_states =
+      std::ranges::any_of(pivot_specs, [](const Pivot_Spec &spec) {
+        return !spec.state_file_path.empty();
+      });
+  // The position at which the scan ended (or -1 if unknown):
+  std::streamoff scan_end = -1;
 
   long scanned_rows = 0;
-  for (CSVRow &row : reader) {
-    bool include_row = true;
-    if ((scanned_rows < rows_to_scan) || (rows_to_scan == -1))
-    // Checking, based on include_map and exclude_map,
-    // whether this particular row should be included in our output:
-    {
-      // Iterating through our map of values to include for each field:
-      // This code was based in part on P0W's response at
-      // https://stackoverflow.com/a/26282004/13097194 .
-      for (auto const &[field, field_vals] : include_map) {
-        // Checking to see whether the row's value is present within
-        // our list of field values:
-        if (std::ranges::contains(field_vals, row[field].get()) == false) {
-          include_row = false; // This row will now be skipped.
-          break; // There's no need to go through any other key/value
-          // pairs within this map now that we know that we won't be
-          // using this row.
-        }
-      }
-      // Performing similar steps for exclude_map: (The only difference
-      // is that we'll now set include_row to false if we *do* encounter
-      // a given value within field_vals.)
-      for (auto const &[field, field_vals] : exclude_map) {
-        if (std::ranges::contains(field_vals, row[field].get())) {
-          include_row = false;
-          break;
-        }
-      }
-      if (include_row == true) {
-        {
-          std::string pivot_index_vals = index_gen(row);
-          // Adding the values corresponding to this set
-          // of index variables to our map:
-          if (pivot_map.contains(pivot_index_vals) == false)
-          // We'll now add one Pivot_Vals object for each
-          // value field to this map so that separate sum, mean,
-          // and count values can get calculated for each of them.
-          // I had tried to avoid this step by (1) using arrays
-          // of Pivot_Vals objects as values within pivot_map and (2)
-          // using the length of value_fields to specify the number
-          // of Pivot_Vals objects to include. However, I encountered
-          // issues with this approach, so I instead shifted to the
-          // following approach, in which I use a loop to add the number
-          // of necessary Pivot_Vals objects to the map. This check and
-          // loop probably do slow down the function a bit.
-          {
-            for (const auto &x : value_fields) {
-              Pivot_Vals pv{};
-              pivot_map[pivot_index_vals].push_back(pv);
-            }
-          }
-          // Updating the sum and count values within each value field's
-          // correponding Pivot_Vals struct:
-          for (int vfi = 0; vfi < value_fields.size(); vfi++)
-          // vfi = 'value field index'
-          {
-            pivot_map[pivot_index_vals][vfi].pivot_sum +=
-                row[value_fields[vfi]].get<double>();
-            pivot_map[pivot_index_vals][vfi].pivot_count++;
-          }
-        }
+  if (data_file_paths.size() > 1) {
+    scanned_rows = scan_data_files(data_file_paths, pivot_specs, states,
+                                   rows_to_scan, options, profile);
+  } else {
+    scanned_rows = scan_data_file(data_file_path, pivot_specs, states,
+                                  rows_to_scan, options, resume_offset,
+                                  saving_states, scan_end, profile);
+  }
+
+  // Calculating means within each pivot table, then writing
+  // the table's output to a .csv file:
+  auto write_start = std::chrono::steady_clock::now();
+  std::vector<size_t> distinct_groups;
+  for (int psi = 0; psi < pivot_specs.size(); psi++) {
+    Pivot_Spec &spec = pivot_specs[psi];
+    states[psi].finish_coded_groups();
+    if (!spec.state_file_path.empty()) {
+      save_pivot_state(states[psi], spec, data_file_path, scan_end);
+    }
+    distinct_groups.push_back(write_pivot_csv(
+        states[psi], spec.value_fields, spec_index_headers(spec),
+        spec.pivot_file_path, options.output_precision,
+        options.output_format, rollups[psi], selectors[psi]));
+  }
+  double write_seconds = seconds_since(write_start);
+
+  auto function_end_time = std::chrono::high_resolution_clock::now();
+  auto function_run_time =
+      std::chrono::duration<double>(function_end_time - function_start_time)
+          .count();
+  if (stats) {
+    *stats = Pivot_Stats{};
+    for (int psi = 0; psi < pivot_specs.size(); psi++) {
+      add_table_stats(*stats, states[psi], pivot_specs[psi].pivot_file_path,
+                      distinct_groups[psi]);
+    }
+    stats->parse_seconds =
+        std::max(0.0, profile.scan_seconds - stats->filter_seconds -
+                          stats->key_build_seconds -
+                          stats->aggregate_seconds);
+    stats->merge_seconds = profile.merge_seconds;
+    stats->write_seconds = write_seconds;
+    stats->total_seconds = function_run_time;
+    stats->rows_scanned = scanned_rows;
+    stats->bytes_read = profile.bytes_read;
+  }
+  if (options.log_to_stdout == false) {
+    return;
+  }
+  std::cout << "Finished processing the " << scanned_rows << "-row dataset";
+  if (data_file_paths.size() > 1) {
+    std::cout << " (from " << data_file_paths.size() << " files)";
+  }
+  if (pivot_specs.size() > 1) {
+    std::cout << " into " << pivot_specs.size() << " pivot tables";
+  }
+  std::cout << " in " << function_run_time << " seconds.\n";
+
+  // Reporting the number of blank values found within each pivot
+  // table's value fields:
+  for (int psi = 0; psi < pivot_specs.size(); psi++) {
+    for (int vfi = 0; vfi < pivot_specs[psi].value_fields.size(); vfi++) {
+      if (states[psi].missing_counts[vfi] > 0) {
+        std::cout << states[psi].missing_counts[vfi] << " blank "
+                  << pivot_specs[psi].value_fields[vfi] << " values were "
+                  << ((options.missing_values == Missing_Value_Policy::skip)
+                          ? "skipped"
+                          : "counted as zeros")
+                  << " within " << pivot_specs[psi].pivot_file_path << ".\n";
       }
-      scanned_rows++; // This number should be incremented regardless
-      // of whether or not the current row qualified for inclusion
-      // in the dataset.
-    } else // In this case, we've scanned the requested
-           // number of rows and can thus exit the loop early.
-    {
-      break;
     }
   }
+}
 
-  // Calculating means within pivot table, then writing
-  // the table's output to a .csv file:
-  // This will involve converting each row of our pivot table values
-  // into a vector of strings, then exporting that vector to a file
-  // via Vince La's csv-parser library.
-  // This export will take place on a row-by-row basis, thus
-  // preventing us from having to loop through our map twice
-  // (once to calculate our means and again to export the table).
+void scan_to_multi_pivot(std::string &data_file_path,
+                         std::vector<Pivot_Spec> &pivot_specs,
+                         long &rows_to_scan, const Scan_Options &options,
+                         Pivot_Stats *stats) {
+  /* This version of scan_to_multi_pivot() accepts a single path, which
+  may also be a glob pattern (such as
+  T_T100_SEGMENT_ALL_CARRIER_*.csv) that matches several files; see
+  expand_data_file_paths(). */
+  std::vector<std::string> data_file_paths =
+      expand_data_file_paths(data_file_path);
+  scan_to_multi_pivot(data_file_paths, pivot_specs, rows_to_scan, options,
+                      stats);
+}
 
-  /* The following code was based on
-  https://github.com/vincentlaucsb/csv-parser?
-  tab=readme-ov-file#writing-csv-files
-  and
-  https://en.cppreference.com/w/cpp/io/basic_ofstream.html . */
-  std::ofstream ofs_pivot(pivot_file_path);
-  auto row_writer = make_csv_writer(ofs_pivot);
+template <typename Function>
+static void merge_in_parallel(size_t part_count, Function merge_parts) {
+  /* Combining part_count partial results via a pairwise (tree) merge:
+  during each round, each pair of remaining parts gets merged on its
+  own thread (via merge_parts(target, source), which should add part
+  source's results to part target's). Only about log2(part_count)
+  rounds are needed, at the end of which part 0 will store the
+  combined results. */
+  for (size_t stride = 1; stride < part_count; stride *= 2) {
+    std::vector<size_t> targets;
+    for (size_t target = 0; target + stride < part_count;
+         target += 2 * stride) {
+      targets.push_back(target);
+    }
+    run_on_threads(targets.size(), [&](int pair) {
+      merge_parts(targets[pair], targets[pair] + stride);
+    });
+  }
+}
 
-  // Writing a header row for the .csv file:
+static std::map<std::string, std::map<std::string, Pivot_Vals>>
+finish_in_memory_pivot(Pivot_Table_State &state,
+                       std::vector<std::string> &index_fields,
+                       std::vector<std::string> &value_fields,
+                       bool save_to_csv, std::string &pivot_file_path,
+                       int output_precision, Rollup_Tables &rollups,
+                       Pivot_Columns *columns, Group_Selector &selector,
+                       std::string *csv_output) {
+  /* Calculating means within a pivot table produced by either version
+  of in_memory_pivot(), then copying the groups that selector chooses
+  into the map that in_memory_pivot() will return (and, if save_to_csv
+  is true, into a .csv file or (if csv_output isn't null) that string,
+  and if columns isn't null, into those columns). The table's rollup levels are then derived (from all of its
+  groups) and written as well; any rows that they append to the table's
+  output also get added to the returned map. */
 
-  std::vector<std::string> header_row{index_headers};
-  // Adding pivot value fields to this row: (These will be prefaced
-  // with value field names for easier identification.
-  std::vector<std::string> value_aggregates{"Sum", "Count", "Mean"};
+  // The output of our pivot table will be stored as a map.
+  // The keys of this map will be unique pivot index value combinations,
+  // and the values themselves will be maps. The keys of these 'sub-maps'
+  // will be pivot value names, and the values will be Pivot_Vals
+  // objects. This approach will make it easier to link different
+  // aggregate values to their corresponding value fields.
+  std::map<std::string, std::map<std::string, Pivot_Vals>> pivot_map;
 
-  for (const auto &value_field : value_fields) {
-    for (std::string &aggregate : value_aggregates) {
-      header_row.push_back(value_field + "_" + aggregate);
-    }
-  }
-
-  row_writer << header_row;
-
-  for (auto &[pivot_index, pivot_val_array] : pivot_map) {
-    // Initializing a vector of strings that will store the
-    // data for the current key/value pair as a copy of
-    // the aggregate values for the current pivot_index entry:
-    std::vector<std::string> pivot_row_vector{pivot_index};
-    // Adding results (in string form) to this vector:
-    for (int vfi = 0; vfi < value_fields.size(); vfi++) {
-      // Calculating means for each value field:
-      pivot_map[pivot_index][vfi].pivot_mean =
-          pivot_map[pivot_index][vfi].pivot_sum /
-          pivot_map[pivot_index][vfi].pivot_count;
-      // std::cout << pivot_map[pivot_index].pivot_sum << " "
-      // << pivot_map[pivot_index].pivot_count << " "
-      // << pivot_map[pivot_index].pivot_mean << "\n";
-
-      // Adding the sum, count, and mean aggregate values for this
-      // particular value field to pivot_row_vector:
-      pivot_row_vector.push_back(
-          std::to_string(pivot_map[pivot_index][vfi].pivot_sum));
-      pivot_row_vector.push_back(
-          std::to_string(pivot_map[pivot_index][vfi].pivot_count));
-      pivot_row_vector.push_back(
-          std::to_string(pivot_map[pivot_index][vfi].pivot_mean));
-
-      // for (const auto &field : pivot_row_vector)
-      // {
-      //     std::cout << field << "\t";
-      // }
-      // std::cout << "\n";
-    }
-    // Writing this completed row to a .csv file:
-    row_writer << pivot_row_vector;
+  std::optional<Csv_Output_Writer> writer;
+  if (save_to_csv) {
+    if (csv_output) {
+      writer.emplace(csv_output, output_precision);
+    } else {
+      writer.emplace(pivot_file_path, output_precision);
+    }
+    write_pivot_header(*writer, join_with_pipes(index_fields), value_fields);
+  }
+  // (See pivot_columns.cpp for more information on Pivot_Columns.)
+  std::optional<Csv_Output_Writer> column_writer;
+  if (columns) {
+    *columns = Pivot_Columns{};
+    column_writer.emplace(*columns);
+    write_pivot_header(*column_writer, join_with_pipes(index_fields),
+                       value_fields);
   }
 
-  auto function_end_time = std::chrono::high_resolution_clock::now();
-  auto function_run_time =
-      std::chrono::duration<double>(function_end_time - function_start_time)
-          .count();
-  std::cout << "Finished processing the " << scanned_rows << "-row dataset in "
-            << function_run_time << " seconds.\n";
+  selector.for_each_group(
+      state,
+      [&](std::string_view pivot_index, Pivot_Vals *pivot_vals, size_t) {
+        rollups.add_group(pivot_index, pivot_vals, state.aggregates, 0);
+      },
+      [&](std::string_view pivot_index, Pivot_Vals *pivot_vals,
+          Aggregate_Table &, size_t) {
+        // (Limited selections aren't written in alphabetical order, so
+        // the end of the map is only a hint.)
+        std::map<std::string, Pivot_Vals> &value_map =
+            pivot_map.try_emplace(pivot_map.end(), std::string(pivot_index))
+                ->second;
+        for (int vfi = 0; vfi < value_fields.size(); vfi++) {
+          value_map[value_fields[vfi]] = pivot_vals[vfi];
+        }
+        if (save_to_csv) {
+          write_pivot_row(*writer, pivot_index, pivot_vals,
+                          value_fields.size());
+        }
+        if (columns) {
+          write_pivot_row(*column_writer, pivot_index, pivot_vals,
+                          value_fields.size());
+        }
+      });
+  rollups.write(
+      writer ? &*writer : nullptr, value_fields, output_precision,
+      Output_Format::csv,
+      [&](std::string_view pivot_index, const Pivot_Vals *pivot_vals) {
+        std::map<std::string, Pivot_Vals> &value_map =
+            pivot_map[std::string(pivot_index)];
+        for (int vfi = 0; vfi < value_fields.size(); vfi++) {
+          value_map[value_fields[vfi]] = pivot_vals[vfi];
+        }
+        if (columns) {
+          write_pivot_row(*column_writer, pivot_index, pivot_vals,
+                          value_fields.size());
+        }
+      });
+  if (save_to_csv) {
+    writer->flush();
+  }
+  return pivot_map;
+}
+
+static Rollup_Tables
+in_memory_rollup_tables(const std::vector<Pivot_Rollup> &rollups,
+                        const std::vector<std::string> &index_fields,
+                        const std::vector<std::string> &value_fields,
+                        bool save_to_csv, Pivot_Backend backend) {
+  /* Creating the rollup levels that an in_memory_pivot() call will
+  derive. (If save_to_csv is false, the levels that would have been
+  written to their own files are left out.) */
+  std::vector<Pivot_Rollup> derived_rollups;
+  for (const Pivot_Rollup &rollup : rollups) {
+    if (save_to_csv || rollup.pivot_file_path.empty()) {
+      derived_rollups.push_back(rollup);
+    }
+  }
+  return Rollup_Tables(derived_rollups, index_fields, backend,
+                       value_fields.size());
+}
+
+static void add_in_memory_value(Pivot_Table_State &state,
+                                Pivot_Vals &pivot_vals, size_t vfi,
+                                double value,
+                                const std::string &value_field) {
+  /* Adding value to pivot_vals' sum and count, unless it's nan (i.e.
+  missing), in which case state.missing_values determines whether it
+  gets skipped, counted as a zero, or results in an error. */
+  if (std::isnan(value)) {
+    state.missing_counts[vfi]++;
+    if (state.missing_values == Missing_Value_Policy::error) {
+      throw std::runtime_error(
+          "A blank " + value_field +
+          " value was found. (To skip these values or treat them as "
+          "zeros, pass a different Missing_Value_Policy to "
+          "in_memory_pivot().)");
+    }
+    if (state.missing_values == Missing_Value_Policy::skip) {
+      return;
+    }
+    value = 0.0;
+  }
+  pivot_vals.pivot_sum += value;
+  pivot_vals.pivot_count++;
+}
+
+static void report_in_memory_pivot(Pivot_Stats *stats, bool log_to_stdout,
+                                   Pivot_Table_State &state,
+                                   const std::vector<std::string> &value_fields,
+                                   const std::string &pivot_file_path,
+                                   size_t row_count, double merge_seconds,
+                                   double write_seconds,
+                                   double total_seconds) {
+  /* Filling in stats (if it isn't null) with the measurements from
+  an in_memory_pivot() call whose results were aggregated within
+  state, then (if log_to_stdout is true) printing its running time and
+  the number of missing values that were skipped or counted as zeros.
+  (As with scan_to_multi_pivot(), the table's distinct group count
+  includes every group, whether or not its selection kept it, but not
+  any appended rollup rows.) */
+  if (stats) {
+    *stats = Pivot_Stats{};
+    add_table_stats(*stats, state, pivot_file_path, state.size());
+    stats->merge_seconds = merge_seconds;
+    stats->write_seconds = write_seconds;
+    stats->total_seconds = total_seconds;
+    stats->rows_scanned = row_count;
+  }
+  if (log_to_stdout) {
+    std::cout << "Finished processing the " << row_count
+              << "-row dataset in " << total_seconds << " seconds.\n";
+    for (size_t vfi = 0; vfi < value_fields.size(); vfi++) {
+      if (state.missing_counts[vfi] > 0) {
+        std::cout << state.missing_counts[vfi] << " blank "
+                  << value_fields[vfi] << " values were "
+                  << ((state.missing_values == Missing_Value_Policy::skip)
+                          ? "skipped"
+                          : "counted as zeros")
+                  << ".\n";
+      }
+    }
+  }
 }
 
 std::map<std::string, std::map<std::string, Pivot_Vals>> in_memory_pivot(
@@ -281,7 +3334,13 @@ std::map<std::string, std::map<std::string, Pivot_Vals>> in_memory_pivot(
     std::map<std::string, std::vector<std::string>> &string_include_map,
     std::map<std::string, std::vector<std::string>> &string_exclude_map,
     std::map<std::string, std::vector<double>> &double_include_map,
-    std::map<std::string, std::vector<double>> &double_exclude_map)
+    std::map<std::string, std::vector<double>> &double_exclude_map,
+    Pivot_Backend backend, int output_precision, int thread_count,
+    Pivot_Stats *stats, bool log_to_stdout,
+    const std::vector<Pivot_Rollup> &rollups, Pivot_Columns *columns,
+    const Pivot_Selection &selection,
+    const std::vector<Double_Range_Filter> &double_range_filters,
+    Missing_Value_Policy missing_values, std::string *csv_output)
 /* This function is similar to scan_to_pivot() except that it processes
 in-memory data rather than that from a .csv file. This approach allows for
 faster processing time at the expense of RAM usage.
@@ -313,156 +3372,353 @@ the keys within the maps found within table_rows.
 save_to_csv: Set to true to save the output of this script to a local
 .csv file; set to false to skip this step. Either way, the output of 
 the pivot table will be returned as a map.
+
+backend (optional): Pivot_Backend::hash_table will aggregate the data
+within a Pivot_Hash_Table, then copy its results into the (sorted)
+map that this function returns. This avoids a tree lookup for every
+included row, which can save a considerable amount of time for tables
+with many distinct pivot index combinations.
+
+output_precision (optional): the number of decimal places with which
+sums and means will be written to the .csv file, or -1 to write the
+shortest representation of each value that will round-trip back to
+the same number. (See csv_output.cpp.)
+
+thread_count (optional): the number of threads to use. Values greater
+than 1 will split table_rows into that many contiguous ranges, each of
+which gets aggregated into its own table on a separate thread; these
+tables are then combined via a pairwise merge that also runs in
+parallel. (Since sums will get added in a different order, their final
+digits may differ slightly from those of a single-threaded run.)
+
+stats (optional): a pointer to a Pivot_Stats struct that will receive
+this call's per-phase timings and group counts. (Since the rows are
+already in memory, no parse time or bytes read will be reported.)
+
+log_to_stdout (optional): set to false to prevent this function from
+printing its running time.
+
+rollups (optional): coarser levels (such as subtotals or a grand total)
+to derive from this table's groups once all rows have been aggregated;
+see Pivot_Rollup. Levels without a pivot_file_path of their own get
+appended to the .csv file and added to the returned map, with "(All)"
+in place of each rolled-up index field. (Levels with their own files
+are only written when save_to_csv is true.)
+
+columns (optional): a pointer to a Pivot_Columns struct that will
+receive the same output (including any appended rollup rows) as typed
+columns, with each index field stored as its own dictionary-encoded
+column. These columns can then be passed to write_arrow_file() in
+order to save them as an Arrow IPC file. (See pivot_columns.cpp.)
+
+selection (optional): post-aggregation conditions (like those of a
+SQL HAVING clause) and a top-K limit that determine which groups get
+written and returned; see Pivot_Selection. Rollup levels are still
+derived from every group. When the selection has a limit, its groups
+are ranked via a heap as the table is read out (so a hash table's
+keys are never sorted), and the .csv file and columns list them in
+rank order; the returned map is keyed alphabetically as always.
+
+double_range_filters (optional): range and null conditions on numeric
+fields (such as {"PASSENGERS", Range_Test::greater, 0}) that rows must
+satisfy in addition to the include and exclude maps, which can only
+match exact values; see Double_Range_Filter. The Columnar_Table
+version checks these conditions a block of rows at a time, via
+branch-free passes over each filtered column (see row_filter.cpp).
+
+missing_values (optional): how nan value fields (such as the blank
+values that load_columnar_table() stores as nan) should be handled;
+see Missing_Value_Policy. As with scan_to_multi_pivot(), the number
+of these values found within each value field is reported via stats
+and (unless missing_values is error) printed when log_to_stdout is
+true.
+
+csv_output (optional): a pointer to a string to which the table's .csv
+text will be appended (when save_to_csv is true) in place of saving it
+to pivot_file_path. This allows callers such as Pivot_Service to send
+the output elsewhere without formatting it themselves. (Rollup levels
+with their own pivot_file_path are still saved to those files.)
 */
 {
   auto function_start_time = std::
   chrono::high_resolution_clock::now();
 
-  // The output of our pivot table will be stored as a map.
-  // The keys of this map will be unique pivot index value combinations,
-  // and the values themselves will be maps. The keys of these 'sub-maps'
-  // will be pivot value names, and the values will be Pivot_Vals
-  // objects. This approach will make it easier to link different
-  // aggregate values to their corresponding value fields.
-  std::map<std::string, std::map<std::string, Pivot_Vals>> pivot_map;
-
-  for (int i = 0; i < table_rows.size(); i++)
-  {
-    std::map<std::string, std::variant<std::string, double>> row =
-        table_rows[i];
-    bool include_row = true;
-
-    // Note that this function includes both string-based and 
-    // double-based inclusion and exclusion maps so that certain
-    // double-typed fields can also get excluded.
-    for (auto const &[field, field_vals] : string_include_map) {
-
-      if (std::ranges::contains(field_vals,
-                                std::get<std::string>(row[field])) == false) {
-        include_row = false; 
-        break; 
-      }
-    }
-
-    for (auto const &[field, field_vals] : string_exclude_map) {
-      if (std::ranges::contains(field_vals,
-                                std::get<std::string>(row[field]))) {
-        include_row = false;
-        break;
-      }
-    }
-
-    for (auto const &[field, field_vals] : double_include_map) {
-
-      if (std::ranges::contains(field_vals,
-                                std::get<double>(row[field])) == false) {
-        include_row = false; 
-        break; 
-      }
-    }
-
-    for (auto const &[field, field_vals] : double_exclude_map) {
-      if (std::ranges::contains(field_vals,
-                                std::get<double>(row[field]))) {
-        include_row = false;
-        break;
-      }
+  // The data will first get aggregated within a Pivot_Table_State
+  // (the same structure used by scan_to_multi_pivot()), whose
+  // accumulators for each key are stored in the same order as
+  // value_fields. This allows each row's
+  // accumulators to be retrieved via a single lookup (rather than
+  // one outer-map and one inner-map lookup for each value field).
+  // (Each thread receives its own state, along with its own copy of
+  // the filter, since filters track their own rejection counts.)
+  Rollup_Tables rollup_tables =
+      in_memory_rollup_tables(rollups, index_fields, value_fields,
+                              save_to_csv, backend);
+  Group_Selector selector(selection, value_fields);
+
+  thread_count = std::max(thread_count, 1);
+  Pivot_Table_States states;
+  for (int ti = 0; ti < thread_count; ti++) {
+    states.emplace_back(backend, value_fields.size(), 0, missing_values);
+    if (stats) {
+      states.back().row_timer.enable();
     }
+  }
 
-
-    if (include_row == true) {
-
-      // Creating a grouped representation of all pivot index
-      // values in the form of a string (with pipe separators
-      // added in for easier readability):
-      {
-        std::string pivot_index_vals = "";
-        for (int j = 0; j < index_fields.size();
-             j++) { // The following code could be replaced with a lambda
-          // function if needed/preferred.
-          pivot_index_vals += std::get<std::string>(row[index_fields[j]]);
-          // Adding a spacer between pivot index fields:
-          if (j != (index_fields.size() - 1)) {
-            pivot_index_vals += "|";
+  // Compiling the include and exclude maps (and any range filters)
+  // into a filter that stores each field's values within a hash set:
+  // (See row_filter.cpp.)
+  const Row_Map_Filter compiled_filter(string_include_map, string_exclude_map,
+                                       double_include_map, double_exclude_map,
+                                       double_range_filters);
+
+  run_on_threads(thread_count, [&](int ti) {
+    Pivot_Table_State &state = states[ti];
+    Row_Map_Filter row_filter = compiled_filter;
+    size_t first_row = table_rows.size() * ti / thread_count;
+    size_t last_row = table_rows.size() * (ti + 1) / thread_count;
+    for (size_t i = first_row; i < last_row; i++)
+    {
+      // Note that row is a reference, rather than a copy, of
+      // this row's data.
+      const std::map<std::string, std::variant<std::string, double>> &row =
+          table_rows[i];
+      // Note that this function includes both string-based and
+      // double-based inclusion and exclusion maps so that certain
+      // double-typed fields can also get excluded. (These maps were
+      // compiled into row_filter before the loop began.)
+      state.row_timer.start_row();
+      bool include_row = row_filter.passes(row);
+      state.row_timer.end_phase(Row_Phase::filter);
+
+      if (include_row == false) {
+        state.rows_filtered_out++;
+      } else {
+
+        // Creating a grouped representation of all pivot index
+        // values in the form of a string (with pipe separators
+        // added in for easier readability):
+        {
+          std::string pivot_index_vals = "";
+          for (int j = 0; j < index_fields.size();
+               j++) { // The following code could be replaced with a lambda
+            // function if needed/preferred.
+            pivot_index_vals += std::get<std::string>(row.at(index_fields[j]));
+            // Adding a spacer between pivot index fields:
+            if (j != (index_fields.size() - 1)) {
+              pivot_index_vals += "|";
+            }
           }
-        }
-        // std::cout << pivot_index_vals << "\n";
+          // std::cout << pivot_index_vals << "\n";
+          state.row_timer.end_phase(Row_Phase::key_build);
 
-        if (pivot_map.contains(pivot_index_vals) == false)
-        {
-          for (const auto &value_field : value_fields) {
-            //Pivot_Vals pv{};
-            pivot_map[pivot_index_vals][value_field] = Pivot_Vals {};
+          Pivot_Vals *pivot_vals =
+              state.find_or_insert(std::move(pivot_index_vals));
+          // Updating the sum and count values within each value field's
+          // correponding Pivot_Vals struct:
+          // (Nan values are handled according to missing_values.)
+          for (int vfi = 0; vfi < value_fields.size(); vfi++)
+          {
+            add_in_memory_value(state, pivot_vals[vfi], vfi,
+                                std::get<double>(row.at(value_fields[vfi])),
+                                value_fields[vfi]);
           }
-        }
-        // Updating the sum and count values within each value field's
-        // correponding Pivot_Vals struct:
-        for (const auto &value_field : value_fields)
-        {
-          pivot_map[pivot_index_vals][value_field].pivot_sum +=
-              std::get<double>(row[value_field]);
-          pivot_map[pivot_index_vals][value_field].pivot_count++;
+          state.row_timer.end_phase(Row_Phase::aggregate);
         }
       }
     }
-  }
+  });
+  auto merge_start = std::chrono::steady_clock::now();
+  merge_in_parallel(thread_count, [&](size_t target, size_t source) {
+    states[target].merge(states[source]);
+  });
+  double merge_seconds = seconds_since(merge_start);
+  Pivot_Table_State &state = states[0];
+
+  auto write_start = std::chrono::steady_clock::now();
+  std::map<std::string, std::map<std::string, Pivot_Vals>> pivot_map =
+      finish_in_memory_pivot(state, index_fields, value_fields, save_to_csv,
+                             pivot_file_path, output_precision,
+                             rollup_tables, columns, selector, csv_output);
+  double write_seconds = seconds_since(write_start);
 
+  auto function_end_time = std::chrono::high_resolution_clock::now();
+  auto function_run_time =
+      std::chrono::duration<double>(function_end_time - function_start_time)
+          .count();
+  report_in_memory_pivot(stats, log_to_stdout, state, value_fields,
+                         pivot_file_path,
+                         table_rows.size(), merge_seconds, write_seconds,
+                         function_run_time);
 
-  if (save_to_csv)
-  {
-  std::ofstream ofs_pivot(pivot_file_path);
-  auto row_writer = make_csv_writer(ofs_pivot);
+return pivot_map;
+}
 
-  std::vector<std::string> header_row;
+std::map<std::string, std::map<std::string, Pivot_Vals>> in_memory_pivot(
+    const Columnar_Table &table, std::vector<std::string> &index_fields,
+    std::vector<std::string> &value_fields, bool save_to_csv,
+    std::string &pivot_file_path,
+    std::map<std::string, std::vector<std::string>> &string_include_map,
+    std::map<std::string, std::vector<std::string>> &string_exclude_map,
+    std::map<std::string, std::vector<double>> &double_include_map,
+    std::map<std::string, std::vector<double>> &double_exclude_map,
+    Pivot_Backend backend, int output_precision, int thread_count,
+    Pivot_Stats *stats, bool log_to_stdout,
+    const std::vector<Pivot_Rollup> &rollups, Pivot_Columns *columns,
+    const Pivot_Selection &selection,
+    const std::vector<Double_Range_Filter> &double_range_filters,
+    Missing_Value_Policy missing_values, std::string *csv_output)
+/* This version of in_memory_pivot() processes a Columnar_Table
+(see columnar_table.cpp) rather than a vector of row maps. Its
+arguments and output are otherwise the same as those of the original
+version.
+
+Because each column is stored contiguously, each field used by this
+function is looked up only once (before any rows are processed);
+each row's values are then read directly from those columns. When
+thread_count is greater than 1, each thread aggregates a contiguous
+range of rows into its own tables; since every thread's group keys
+are packed from the same column dictionaries, the threads' coded
+tables can then be merged (in parallel, pairwise) without decoding
+their keys.
+*/
+{
+  auto function_start_time = std::chrono::high_resolution_clock::now();
 
-  std::string pivot_index_header_field = "";
-  for (int j = 0; j < index_fields.size();
-       j++) {
-    pivot_index_header_field += index_fields[j];
-    if (j != (index_fields.size() - 1)) {
-      pivot_index_header_field += "|";
-    }
+  // Retrieving each column that this pivot table will use, and
+  // compiling the include and exclude maps (and any range filters) into
+  // a filter that checks each string column's codes via a bitset and
+  // each range against whole blocks of its column: (See row_filter.cpp.)
+  const Column_Filter compiled_filter(table, string_include_map,
+                                      string_exclude_map, double_include_map,
+                                      double_exclude_map,
+                                      double_range_filters);
+  std::vector<const String_Column *> index_columns;
+  for (const std::string &index_field : index_fields) {
+    index_columns.push_back(&table.string_column(index_field));
+  }
+  std::vector<const std::vector<double> *> value_columns;
+  for (const std::string &value_field : value_fields) {
+    value_columns.push_back(&table.double_column(value_field));
   }
 
-  header_row.push_back(pivot_index_header_field);
-
-  std::vector<std::string> value_aggregates{"Sum", "Count", "Mean"};
-
-  for (const auto &value_field : value_fields) {
-    for (std::string &aggregate : value_aggregates) {
-      header_row.push_back(value_field + "_" + aggregate);
+  // Since each index column is already dictionary-encoded, each row's
+  // group key can be created by packing its index codes into a single
+  // integer (as long as these fields don't contain too many distinct
+  // values to fit within 64 bits). The pipe-separated pivot index
+  // strings will only get created once per group, after all rows
+  // have been processed.
+  std::vector<size_t> index_cardinalities;
+  std::vector<const String_Dictionary *> index_dictionaries;
+  for (const String_Column *index_column : index_columns) {
+    index_cardinalities.push_back(index_column->dictionary.size());
+    index_dictionaries.push_back(&index_column->dictionary);
+  }
+  bool use_coded_groups = Coded_Group_Table::can_pack(index_cardinalities);
+
+  // Each thread's string-keyed and coded results:
+  Rollup_Tables rollup_tables =
+      in_memory_rollup_tables(rollups, index_fields, value_fields,
+                              save_to_csv, backend);
+  Group_Selector selector(selection, value_fields);
+
+  thread_count = std::max(thread_count, 1);
+  Pivot_Table_States states;
+  std::vector<Coded_Group_Table> thread_coded_groups;
+  for (int ti = 0; ti < thread_count; ti++) {
+    states.emplace_back(backend, value_fields.size(), 0, missing_values);
+    if (stats) {
+      states.back().row_timer.enable();
     }
+    thread_coded_groups.push_back(
+        use_coded_groups
+            ? Coded_Group_Table(index_cardinalities, value_fields.size())
+            : Coded_Group_Table(size_t(0), value_fields.size()));
   }
 
-  row_writer << header_row;
+  run_on_threads(thread_count, [&](int ti) {
+    Pivot_Table_State &state = states[ti];
+    Coded_Group_Table &coded_groups = thread_coded_groups[ti];
+    Column_Filter column_filter = compiled_filter;
+    std::vector<uint32_t> index_codes(index_columns.size());
+    // The offsets (within the current block) of the rows that passed
+    // the filter:
+    std::vector<uint16_t> selection(Column_Filter::max_block_rows);
+    size_t first_row = table.row_count * ti / thread_count;
+    size_t last_row = table.row_count * (ti + 1) / thread_count;
+    for (size_t block_start = first_row; block_start < last_row;
+         block_start += Column_Filter::max_block_rows) {
+      size_t block_rows =
+          std::min(Column_Filter::max_block_rows, last_row - block_start);
+      auto filter_start = std::chrono::steady_clock::now();
+      size_t selected_count =
+          column_filter.select(block_start, block_rows, selection.data());
+      state.row_timer.add_block_seconds(Row_Phase::filter,
+                                        seconds_since(filter_start));
+      state.rows_filtered_out += block_rows - selected_count;
+
+      for (size_t si = 0; si < selected_count; si++) {
+        size_t i = block_start + selection[si];
+        state.row_timer.start_row();
+        if (use_coded_groups) {
+          for (int j = 0; j < index_columns.size(); j++) {
+            index_codes[j] = index_columns[j]->codes[i];
+          }
+          state.row_timer.end_phase(Row_Phase::key_build);
+          Pivot_Vals *pivot_vals =
+              coded_groups.find_or_insert(index_codes.data());
+          for (int vfi = 0; vfi < value_columns.size(); vfi++) {
+            add_in_memory_value(state, pivot_vals[vfi], vfi,
+                                (*value_columns[vfi])[i], value_fields[vfi]);
+          }
+          state.row_timer.end_phase(Row_Phase::aggregate);
+          continue;
+        }
+
+        std::string pivot_index_vals = "";
+        for (int j = 0; j < index_columns.size(); j++) {
+          pivot_index_vals += index_columns[j]->value(i);
+          if (j != (index_columns.size() - 1)) {
+            pivot_index_vals += "|";
+          }
+        }
+        state.row_timer.end_phase(Row_Phase::key_build);
 
-  // for (const std::string &header_field : header_row) {
-  //   std::cout << header_field << "\t";
-  // }
-  // std::cout << "\n";
-  for (auto &[pivot_index, pivot_val_array] : pivot_map) {
-    std::vector<std::string> pivot_row_vector{pivot_index};
-    for (const auto &value_field : value_fields) {
-      pivot_map[pivot_index][value_field].pivot_mean =
-          pivot_map[pivot_index][value_field].pivot_sum /
-          pivot_map[pivot_index][value_field].pivot_count;
-      pivot_row_vector.push_back(
-          std::to_string(pivot_map[pivot_index][value_field].pivot_sum));
-      pivot_row_vector.push_back(
-          std::to_string(pivot_map[pivot_index][value_field].pivot_count));
-      pivot_row_vector.push_back(
-          std::to_string(pivot_map[pivot_index][value_field].pivot_mean));
+        Pivot_Vals *pivot_vals =
+            state.find_or_insert(std::move(pivot_index_vals));
+        for (int vfi = 0; vfi < value_columns.size(); vfi++) {
+          add_in_memory_value(state, pivot_vals[vfi], vfi,
+                              (*value_columns[vfi])[i], value_fields[vfi]);
+        }
+        state.row_timer.end_phase(Row_Phase::aggregate);
+      }
     }
-    row_writer << pivot_row_vector;
-  }
-}
+  });
+  auto merge_start = std::chrono::steady_clock::now();
+  merge_in_parallel(thread_count, [&](size_t target, size_t source) {
+    states[target].merge(states[source]);
+    thread_coded_groups[target].merge(thread_coded_groups[source]);
+  });
+  double merge_seconds = seconds_since(merge_start);
+  Pivot_Table_State &state = states[0];
+
+  auto write_start = std::chrono::steady_clock::now();
+  state.add_coded_groups(thread_coded_groups[0], index_dictionaries,
+                         state.coded_aggregates);
+  std::map<std::string, std::map<std::string, Pivot_Vals>> pivot_map =
+      finish_in_memory_pivot(state, index_fields, value_fields, save_to_csv,
+                             pivot_file_path, output_precision,
+                             rollup_tables, columns, selector, csv_output);
+  double write_seconds = seconds_since(write_start);
 
   auto function_end_time = std::chrono::high_resolution_clock::now();
   auto function_run_time =
       std::chrono::duration<double>(function_end_time - function_start_time)
           .count();
-  std::cout << "Finished processing the " << table_rows.size() << "-row dataset in "
-            << function_run_time << " seconds.\n";
+  report_in_memory_pivot(stats, log_to_stdout, state, value_fields,
+                         pivot_file_path,
+                         table.row_count, merge_seconds, write_seconds,
+                         function_run_time);
 
-return pivot_map;
-}
\ No newline at end of file
+  return pivot_map;
+}
@@ -5,7 +5,11 @@
 // Documentation on these functions is available
 // within pivot_compressors.cpp.
 
+#pragma once
+
+#include "aggregates.h"
 #include "csv.hpp"
+#include "csv_output.h"
 #include <functional>
 #include <map>
 #include <string>
@@ -19,15 +23,308 @@ using namespace csv;
     double pivot_mean{0.0};
   };
 
+// A coarser level of a pivot table (such as a subtotal or a grand
+// total) that gets derived from the table's finest groups rather than
+// from another scan. (See Pivot_Spec::rollups.)
+struct Pivot_Rollup {
+  // The index fields (a subset of the table's own, in any order) by
+  // which this level is grouped; an empty list produces a grand total.
+  std::vector<std::string> index_fields;
+  // The .csv file to which this level will be written. If this path is
+  // empty, the level's rows will instead be appended to the table's
+  // own output (after its finest groups), with "(All)" in place of
+  // each index field that was rolled up.
+  std::string pivot_file_path;
+};
+
+// The aggregates by which a Pivot_Selection can filter or rank groups:
+enum class Pivot_Aggregate { sum, count, mean };
+
+// The comparisons that a Pivot_Condition can make:
+enum class Pivot_Comparison {
+  less,
+  less_equal,
+  greater,
+  greater_equal,
+  equal,
+  not_equal
+};
+
+// A condition on one of a group's aggregates, such as "PASSENGERS_Count
+// > 100" (like one of the terms within a SQL HAVING clause). Groups
+// whose mean is nan (since all of their values were skipped) never
+// satisfy a condition on that mean.
+struct Pivot_Condition {
+  std::string value_field;
+  Pivot_Aggregate aggregate{Pivot_Aggregate::sum};
+  Pivot_Comparison comparison{Pivot_Comparison::greater};
+  double threshold{0.0};
+};
+
+// Limits a pivot table's output to the groups that satisfy every
+// condition within having. If limit is greater than 0, only the limit
+// groups with the largest (or, if descending is false, the smallest)
+// values of order_by_field's order_by aggregate are kept (like SQL's
+// ORDER BY ... LIMIT), and they're written in that order rather than
+// alphabetically; ties are broken by pivot index. This selection takes
+// place as the table is written, via a heap of the best limit groups
+// found so far, so the full table never gets sorted or written out.
+// (Rollup levels are still derived from all of the table's groups.)
+struct Pivot_Selection {
+  std::vector<Pivot_Condition> having;
+  std::string order_by_field;
+  Pivot_Aggregate order_by{Pivot_Aggregate::sum};
+  bool descending{true};
+  size_t limit{0};
+
+  bool empty() const { return having.empty() && (limit == 0); }
+};
+
+// Pivot_Spec stores all of the arguments that scan_to_pivot() needs
+// in order to produce one pivot table. A vector of these structs can
+// be passed to scan_to_multi_pivot() in order to produce several pivot
+// tables from a single scan of a .csv file.
+struct Pivot_Spec {
+  std::vector<std::string> value_fields;
+  std::string index_headers;
+  std::function<std::string(const CSVRow &)> index_gen;
+  std::map<std::string, std::vector<std::string>> include_map;
+  std::map<std::string, std::vector<std::string>> exclude_map;
+  std::string pivot_file_path;
+  // As an alternative to index_gen, the pivot index can be specified
+  // as a list of field names. (If this list isn't empty, index_gen
+  // will be ignored, and a blank index_headers value will be replaced
+  // by these names separated by pipes.) This allows each row's group
+  // key to be built out of dictionary codes rather than a new string.
+  std::vector<std::string> index_fields;
+  // If this path isn't empty, the table's sums and counts will be
+  // saved to a binary state file here after each scan. If the file
+  // already exists, its totals will be loaded (and combined with those
+  // of the new scan) beforehand, allowing a table to be refreshed
+  // without rescanning rows that it already includes.
+  std::string state_file_path;
+  // Additional aggregates (such as minimums, variances, or quantiles;
+  // see aggregates.h) to calculate for specific value fields. Keys are
+  // value field names; each requested aggregate adds its own column(s)
+  // to the output after that field's sum, count, and mean.
+  std::map<std::string, Aggregate_Set> value_aggregates;
+  // Coarser levels to derive from this table once its rows have all
+  // been aggregated, in the order in which they'll be written. Each
+  // level merges the accumulators of the table's groups, so no rows
+  // get scanned again. (If this spec uses index_gen, its index_headers
+  // are split at each pipe in order to name its index fields.)
+  std::vector<Pivot_Rollup> rollups;
+  // Post-aggregation conditions and a top-K limit that determine which
+  // of the table's groups get written (see Pivot_Selection).
+  Pivot_Selection selection;
+};
+
+// Returns the levels of a SQL-style ROLLUP of index_fields: one for
+// each of its prefixes (from all fields but the last down to a grand
+// total), all of which will be appended to the table's own output.
+std::vector<Pivot_Rollup>
+rollup_levels(const std::vector<std::string> &index_fields);
+
+// The data structure that the pivot functions will use to aggregate
+// their data. ordered_map keeps each pivot table's keys in
+// alphabetical order as rows get added; hash_table (which is
+// generally faster for tables with many distinct keys) instead
+// sorts its keys once when the table is ready to be written out.
+// Either way, the output will be the same.
+enum class Pivot_Backend { ordered_map, hash_table };
+
+// How scan_to_multi_pivot() and in_memory_pivot() should handle blank
+// value fields (which in-memory tables store as nan): skip leaves them
+// out of the field's sum and count; zero adds them to the count with a
+// value of 0; and error throws a std::runtime_error. (Non-blank values
+// that can't be parsed as numbers always result in an error.)
+enum class Missing_Value_Policy { skip, zero, error };
+
+// How a sampled scan (see Scan_Options::sample_fraction) chooses the
+// blocks that it will read: uniform draws them at random from the
+// whole file, whereas stratified divides the file into contiguous
+// strata and draws (at least two) blocks from each one, which ensures
+// that every part of a sorted file gets represented.
+enum class Sample_Design { uniform, stratified };
+
+// Scan_Options stores settings that affect how a .csv file gets
+// scanned (as opposed to what each pivot table contains).
+struct Scan_Options {
+  // The number of threads to use. Values greater than 1 will split
+  // the file into line-aligned byte ranges that get scanned in parallel.
+  int thread_count{1};
+  Pivot_Backend backend{Pivot_Backend::ordered_map};
+  // Set to true to read the file via mmap() rather than a stream, so
+  // that its fields can be tokenized in place. (This setting only
+  // applies when every pivot spec uses index_fields.)
+  bool memory_map{false};
+  // The number of blank values found within each value field will be
+  // reported (for each pivot table) once the scan has finished.
+  Missing_Value_Policy missing_values{Missing_Value_Policy::error};
+  // The number of decimal places with which sums and means will be
+  // written to each output file, or -1 to write the shortest
+  // representation of each value that round-trips back to the same
+  // number. (The default matches std::to_string()'s output.)
+  int output_precision{6};
+  // The format in which each table (along with any rollup levels that
+  // have their own files) gets saved. Output_Format::arrow writes an
+  // Arrow IPC file in which each index field is its own dictionary-
+  // encoded column and each aggregate is a float64 or int64 column.
+  // (See pivot_columns.cpp.)
+  Output_Format output_format{Output_Format::csv};
+  // Set to true to only scan rows that were appended to the file
+  // since the pivot tables' saved states were created. (Every pivot
+  // spec must have a state file from a complete scan of this same
+  // file; otherwise, a std::runtime_error will be thrown, since rows
+  // would otherwise be skipped or counted twice.)
+  bool resume_appended_rows{false};
+  // When resume_appended_rows is false, a saved state that records a
+  // complete scan of this same file will cause a std::runtime_error to
+  // be thrown, since rescanning the whole file would count each of its
+  // rows twice. Set this to true to combine such states with the new
+  // scan's totals anyway.
+  bool combine_rescanned_states{false};
+  // The approximate number of bytes that the scan's pivot tables may
+  // occupy, or 0 for no limit. (This budget gets divided evenly among
+  // the pivot tables and threads.) Whenever a table exceeds its share,
+  // its groups will be written to a sorted run file within
+  // spill_directory (or, if spill_directory is empty, within the
+  // system's temporary directory); these runs then get merged as the
+  // table is written out.
+  size_t memory_budget_bytes{0};
+  std::string spill_directory{};
+  // Set to true to split single-threaded projected scans (see
+  // memory_map) into three stages that run on separate threads: one
+  // reads blocks from the file, one splits their lines into fields,
+  // and one filters and aggregates the resulting rows. This allows
+  // disk (or network) reads to overlap with parsing and aggregation.
+  bool pipeline{false};
+  // Set to false to prevent scan_to_multi_pivot() from printing its
+  // running time and blank value counts. (These numbers are also
+  // available via a Pivot_Stats struct.)
+  bool log_to_stdout{true};
+  // Set to a fraction between 0 and 1 (e.g. 0.01) to estimate each
+  // pivot table from a random sample of roughly that fraction of the
+  // file's blocks (each of which contains about sample_block_bytes of
+  // rows) rather than from every row. Sums and counts get scaled up
+  // accordingly, and each table's output will also contain the margin
+  // of error (at confidence_level) of each sum, count, and mean. (See
+  // sample_estimator.cpp.) The same sample_seed always selects the
+  // same blocks. Sampled scans can't be combined with
+  // rows_to_scan, state files, additional aggregates, or rollups.
+  double sample_fraction{0.0};
+  Sample_Design sample_design{Sample_Design::stratified};
+  size_t sample_block_bytes{64 * 1024};
+  double confidence_level{0.95};
+  uint64_t sample_seed{0};
+};
+
+// Pivot_Table_Stats describes one of the pivot tables produced by a
+// pivot function call.
+struct Pivot_Table_Stats {
+  std::string pivot_file_path;
+  // The number of scanned rows that this table's filters excluded:
+  long rows_filtered_out{0};
+  size_t distinct_groups{0};
+  // The largest approximate size (in bytes) that any single copy of
+  // this table's groups reached: (Each thread of a parallel scan
+  // builds its own copy.)
+  size_t peak_table_bytes{0};
+  // The number of blank values found within each value field:
+  std::vector<long> blank_values;
+};
+
+// Pivot_Stats breaks a pivot function call's running time down into
+// phases, and also reports how much data it processed, so that slow
+// inputs can be identified. (To receive these numbers, pass a pointer
+// to a Pivot_Stats struct to scan_to_multi_pivot() or
+// in_memory_pivot().)
+struct Pivot_Stats {
+  // The time (in seconds) spent reading and splitting rows; checking
+  // rows against each table's filters; converting each row's index
+  // fields into a group key; and finding each row's group (then
+  // parsing and adding its values). These times are summed across
+  // threads and tables, so for parallel scans, they can exceed
+  // total_seconds. The filter, key-build, and aggregate times are
+  // extrapolated from a sample of rows (see Row_Phase_Timer within
+  // pivot_compressors.cpp); parse_seconds is the remainder of the
+  // scanning threads' time. (In-memory pivots don't parse any rows.)
+  double parse_seconds{0.0};
+  double filter_seconds{0.0};
+  double key_build_seconds{0.0};
+  double aggregate_seconds{0.0};
+  // The time spent combining each thread's tables, then the time spent
+  // finishing each table (e.g. decoding its keys and merging any
+  // spilled runs), saving its state, and writing it out:
+  double merge_seconds{0.0};
+  double write_seconds{0.0};
+  // The function's overall running time:
+  double total_seconds{0.0};
+  long rows_scanned{0};
+  // The totals of these fields across all of the tables below:
+  long rows_filtered_out{0};
+  size_t distinct_groups{0};
+  size_t peak_group_table_bytes{0};
+  // The number of bytes read from the .csv file (or 0 for in-memory
+  // pivots):
+  uint64_t bytes_read{0};
+  std::vector<Pivot_Table_Stats> tables;
+};
+
 void scan_to_pivot(std::string &data_file_path, std::vector<
   std::string>& value_fields,
                    std::string index_headers, long &rows_to_scan,
                    std::string &pivot_file_path,
-                   std::function<std::string(CSVRow)> index_gen,
+                   std::function<std::string(const CSVRow &)> index_gen,
                    std::map<std::string, std::vector<std::string>>
                        &include_map,
                   std::map<std::string, std::vector<std::string>>
-                       &exclude_map);
+                       &exclude_map,
+                   const Scan_Options &options = Scan_Options{},
+                   Pivot_Stats *stats = nullptr);
+
+void scan_to_multi_pivot(std::string &data_file_path,
+                         std::vector<Pivot_Spec> &pivot_specs,
+                         long &rows_to_scan,
+                         const Scan_Options &options = Scan_Options{},
+                         Pivot_Stats *stats = nullptr);
+
+// This overload produces its pivot tables from several .csv files
+// (such as one per year) that all have the same columns. (The version
+// above also accepts a glob pattern, e.g.
+// T_T100_SEGMENT_ALL_CARRIER_*.csv, in place of a single path.)
+void scan_to_multi_pivot(std::vector<std::string> &data_file_paths,
+                         std::vector<Pivot_Spec> &pivot_specs,
+                         long &rows_to_scan,
+                         const Scan_Options &options = Scan_Options{},
+                         Pivot_Stats *stats = nullptr);
+
+// Returns the files (in alphabetical order) that a glob pattern
+// matches, or the pattern itself if it doesn't contain any wildcards.
+std::vector<std::string> expand_data_file_paths(const std::string &pattern);
+
+// The tests that a Double_Range_Filter can apply to a numeric field:
+enum class Range_Test {
+  less,
+  less_equal,
+  greater,
+  greater_equal,
+  between,
+  is_null,
+  not_null
+};
+
+// A range or null condition (such as "SEATS >= 100") that rows must
+// satisfy in order to be included within an in_memory_pivot() table.
+// between accepts values from bound to upper_bound (inclusive), and
+// is_null accepts only missing (nan) values, which never satisfy any
+// of the other tests.
+struct Double_Range_Filter {
+  std::string field;
+  Range_Test test{Range_Test::greater};
+  double bound{0.0};
+  double upper_bound{0.0};
+};
 
 std::map<std::string, std::map<std::string, Pivot_Vals>> in_memory_pivot(
     std::vector<std::map<std::string, 
@@ -40,4 +337,13 @@ std::map<std::string, std::map<std::string, Pivot_Vals>> in_memory_pivot(
     std::map<std::string, std::vector<std::string>> &string_include_map,
     std::map<std::string, std::vector<std::string>> &string_exclude_map,
     std::map<std::string, std::vector<double>> &double_include_map,
-    std::map<std::string, std::vector<double>> &double_exclude_map);
\ No newline at end of file
+    std::map<std::string, std::vector<double>> &double_exclude_map,
+    Pivot_Backend backend = Pivot_Backend::ordered_map,
+    int output_precision = 6, int thread_count = 1,
+    Pivot_Stats *stats = nullptr, bool log_to_stdout = true,
+    const std::vector<Pivot_Rollup> &rollups = {},
+    Pivot_Columns *columns = nullptr,
+    const Pivot_Selection &selection = {},
+    const std::vector<Double_Range_Filter> &double_range_filters = {},
+    Missing_Value_Policy missing_values = Missing_Value_Policy::error,
+    std::string *csv_output = nullptr);
\ No newline at end of file
@@ -0,0 +1,161 @@
+// pivot_hash_table.h
+// Released under the MIT License
+
+// This header defines Pivot_Hash_Table, an open-addressing hash table
+// that the pivot functions within pivot_compressors.cpp can use
+// (in place of std::map) to aggregate their data. Rather than
+// keeping its keys in alphabetical order at all times, this table
+// only sorts its keys once (when the pivot table is ready to be
+// written out), which saves an O(log n) string-comparison tree
+// walk for every row that gets aggregated.
+
+#pragma once
+
+#include "pivot_compressors.h"
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory_resource>
+#include <numeric>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+// A hash function for std::string keys that also accepts
+// std::string_view and const char* arguments, thus allowing keys
+// to get looked up without first being copied into a std::string.
+struct String_Hash {
+  using is_transparent = void;
+  size_t operator()(std::string_view key) const {
+    return std::hash<std::string_view>{}(key);
+  }
+};
+
+// A hash function for integer keys: (std::hash<uint64_t> generally
+// returns its argument unchanged, which would cause keys that differ
+// only in their upper bits to collide within the table. This function
+// instead mixes all 64 bits into the result; it's based on the
+// finalizer found within MurmurHash3.)
+struct Integer_Hash {
+  size_t operator()(uint64_t key) const {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return static_cast<size_t>(key);
+  }
+};
+
+template <typename Key, typename Hash = std::hash<Key>>
+class Pivot_Hash_Table {
+public:
+  // vals_per_key: the number of Pivot_Vals accumulators (generally
+  // one per value field) to store for each key.
+  // key_resource: the memory resource from which std::pmr::string keys
+  // will allocate their characters. (This argument is ignored for
+  // other key types.)
+  explicit Pivot_Hash_Table(size_t vals_per_key = 1,
+                            std::pmr::memory_resource *key_resource =
+                                std::pmr::get_default_resource())
+      : vals_per_key_(vals_per_key), key_resource_(key_resource) {}
+
+  // Returns a pointer to the vals_per_key accumulators that
+  // correspond to key, first adding them (initialized to zero) if
+  // the key isn't yet present. (These accumulators are stored
+  // contiguously, so the pointer can be indexed by value field.)
+  // Lookup_Key can be any type that Hash accepts and that Key can be
+  // compared to and constructed from (e.g. std::string_view for
+  // std::string keys).
+  // Note that this pointer will be invalidated by the next insertion.
+  template <typename Lookup_Key>
+  Pivot_Vals *find_or_insert(const Lookup_Key &key) {
+    size_t hash = Hash{}(key);
+    if ((keys_.size() + 1) * 2 > slots_.size()) {
+      grow();
+    }
+    size_t mask = slots_.size() - 1;
+    for (size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+      uint32_t group = slots_[slot];
+      if (group == empty_slot) {
+        slots_[slot] = static_cast<uint32_t>(keys_.size());
+        if constexpr (std::is_same_v<Key, std::pmr::string>) {
+          keys_.emplace_back(key, key_resource_);
+        } else {
+          keys_.emplace_back(key);
+        }
+        hashes_.push_back(hash);
+        vals_.resize(vals_.size() + vals_per_key_);
+        return &vals_[vals_.size() - vals_per_key_];
+      }
+      if ((hashes_[group] == hash) && (keys_[group] == key)) {
+        return &vals_[group * vals_per_key_];
+      }
+    }
+  }
+
+  // The number of distinct keys (i.e. groups) within the table:
+  size_t size() const { return keys_.size(); }
+  size_t vals_per_key() const { return vals_per_key_; }
+
+  // Groups are numbered in the order in which they were inserted;
+  // these functions provide access to each group's key and
+  // accumulators.
+  const Key &key(size_t group) const { return keys_[group]; }
+  Pivot_Vals *vals(size_t group) { return &vals_[group * vals_per_key_]; }
+  const Pivot_Vals *vals(size_t group) const {
+    return &vals_[group * vals_per_key_];
+  }
+  // Returns the number of the group whose accumulators begin at vals
+  // (which must have been returned by find_or_insert() or vals() since
+  // the most recent insertion).
+  size_t group_of(const Pivot_Vals *vals) const {
+    return (vals - vals_.data()) / vals_per_key_;
+  }
+
+  // Returns all group numbers, sorted by their corresponding keys.
+  // (This allows output to be written in the same alphabetical
+  // order that a std::map would have produced.)
+  std::vector<size_t> sorted_groups() const {
+    std::vector<size_t> groups(keys_.size());
+    std::iota(groups.begin(), groups.end(), 0);
+    std::sort(groups.begin(), groups.end(),
+              [&](size_t a, size_t b) { return keys_[a] < keys_[b]; });
+    return groups;
+  }
+
+  // Removes every group, releasing the table's storage. (Keys that
+  // were allocated from key_resource are only returned to it when
+  // they get destroyed here.)
+  void clear() { *this = Pivot_Hash_Table(vals_per_key_, key_resource_); }
+
+private:
+  static constexpr uint32_t empty_slot = UINT32_MAX;
+
+  void grow() {
+    // Doubling the number of slots (so that the table stays at most
+    // half full), then reinserting each group using its stored hash:
+    std::vector<uint32_t> new_slots(std::max<size_t>(16, slots_.size() * 2),
+                                    empty_slot);
+    size_t mask = new_slots.size() - 1;
+    for (uint32_t group = 0; group < keys_.size(); group++) {
+      size_t slot = hashes_[group] & mask;
+      while (new_slots[slot] != empty_slot) {
+        slot = (slot + 1) & mask;
+      }
+      new_slots[slot] = group;
+    }
+    slots_ = std::move(new_slots);
+  }
+
+  size_t vals_per_key_;
+  std::pmr::memory_resource *key_resource_;
+  // Each slot stores either empty_slot or the number of the group
+  // that occupies it; the groups' keys, hashes and accumulators are
+  // kept in separate dense vectors.
+  std::vector<uint32_t> slots_;
+  std::vector<Key> keys_;
+  std::vector<size_t> hashes_;
+  std::vector<Pivot_Vals> vals_;
+};
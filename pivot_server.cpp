@@ -0,0 +1,257 @@
+// pivot_server.cpp
+// Released under the MIT License
+
+/* This program loads one or more .csv files into memory once, then
+answers pivot requests against them for as long as it runs (rather
+than rescanning a file for each request). Repeated requests are served
+from an LRU cache of recent results. The request protocol is documented
+within pivot_service.cpp.
+
+The server can be configured via the following arguments:
+
+--table NAME=PATH: loads the .csv file at PATH as the table NAME; this
+option can be specified multiple times (at least one is required)
+--string-fields A,B,...: the string fields to load from each table
+(default: CARRIER,ORIGIN,REGION,DEST_COUNTRY, the same fields that
+cpp_pivot_tables.cpp loads)
+--double-fields A,B,...: the numeric fields to load from each table
+(default: PASSENGERS,SEATS,DEPARTURES_PERFORMED)
+--cache-dir DIR: the directory in which each table's columnar cache
+file (NAME.columns.cache) is kept; if this option is specified, tables
+whose cache files are up to date will be loaded from those files
+instead (see columnar_cache.cpp)
+--cache-bytes N: the number of bytes of results that the result cache
+can hold (default: 268435456, i.e. 256 MiB)
+--threads N: the thread count with which each pivot is computed
+(default: 1)
+--precision N: the number of decimal places with which results are
+written, or -1 for the shortest round-trip representation (default: 6)
+--socket PATH: listens for connections on a UNIX domain socket at PATH
+(each connection is served by its own thread); by default, requests
+are instead read from stdin and answered on stdout
+
+Either way, each line received is one request, and the connection (or
+program) ends once a "quit" line arrives or the input ends. For
+example:
+./pivot_server --table t100=../T100_segment_all_carrier_2023.csv
+--cache-dir ../Cache --socket /tmp/pivot_server.sock */
+
+#include "pivot_service.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+static std::vector<std::string> split_fields(const std::string &fields) {
+  std::vector<std::string> field_list;
+  size_t field_start = 0;
+  while (true) {
+    size_t field_end = fields.find(',', field_start);
+    field_list.push_back(fields.substr(field_start, field_end - field_start));
+    if (field_end == std::string::npos) {
+      return field_list;
+    }
+    field_start = field_end + 1;
+  }
+}
+
+static bool write_all(int socket_fd, const std::string &response) {
+  /* Sending all of response, returning false if the client has
+  disconnected. */
+  size_t bytes_sent = 0;
+  while (bytes_sent < response.size()) {
+    ssize_t result = send(socket_fd, response.data() + bytes_sent,
+                          response.size() - bytes_sent, MSG_NOSIGNAL);
+    if (result <= 0) {
+      return false;
+    }
+    bytes_sent += result;
+  }
+  return true;
+}
+
+static void serve_connection(Pivot_Service &service, int socket_fd) {
+  /* Answering each line that the client sends, in order, until it
+  disconnects or sends "quit". */
+  std::string pending;
+  char buffer[65536];
+  bool open = true;
+  while (open) {
+    ssize_t bytes_received = recv(socket_fd, buffer, sizeof(buffer), 0);
+    if (bytes_received <= 0) {
+      break;
+    }
+    pending.append(buffer, bytes_received);
+    size_t line_start = 0;
+    size_t line_end;
+    while (open &&
+           ((line_end = pending.find('\n', line_start)) != std::string::npos)) {
+      std::string_view line(pending.data() + line_start,
+                            line_end - line_start);
+      if (line.ends_with('\r')) {
+        line.remove_suffix(1);
+      }
+      line_start = line_end + 1;
+      if (line == "quit") {
+        open = false;
+      } else if (!line.empty()) {
+        open = write_all(socket_fd, service.respond(line));
+      }
+    }
+    pending.erase(0, line_start);
+  }
+  close(socket_fd);
+}
+
+static void serve_socket(Pivot_Service &service,
+                         const std::string &socket_path) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(address.sun_path)) {
+    throw std::runtime_error("The socket path " + socket_path +
+                             " is too long.");
+  }
+  std::strcpy(address.sun_path, socket_path.c_str());
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd < 0) {
+    throw std::runtime_error("Unable to create a socket.");
+  }
+  // (A socket file left behind by an earlier run would otherwise cause
+  // bind() to fail. Anything other than a socket is left alone, so that
+  // a mistyped path can't delete an unrelated file.)
+  struct stat existing_file;
+  if (lstat(socket_path.c_str(), &existing_file) == 0) {
+    if (!S_ISSOCK(existing_file.st_mode)) {
+      close(listen_fd);
+      throw std::runtime_error(socket_path +
+                               " already exists and is not a socket.");
+    }
+    unlink(socket_path.c_str());
+  }
+  if ((bind(listen_fd, reinterpret_cast<sockaddr *>(&address),
+            sizeof(address)) != 0) ||
+      (listen(listen_fd, SOMAXCONN) != 0)) {
+    close(listen_fd);
+    throw std::runtime_error("Unable to listen on " + socket_path + ": " +
+                             std::strerror(errno));
+  }
+  std::cerr << "Listening on " << socket_path << ".\n";
+  while (true) {
+    int socket_fd = accept(listen_fd, nullptr, nullptr);
+    if (socket_fd < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error("Unable to accept a connection: " +
+                               std::string(std::strerror(errno)));
+    }
+    std::thread(serve_connection, std::ref(service), socket_fd).detach();
+  }
+}
+
+static void serve_stdin(Pivot_Service &service) {
+  std::string line;
+  while (std::getline(std::cin, line)) {
+    if (line.ends_with('\r')) {
+      line.pop_back();
+    }
+    if (line == "quit") {
+      break;
+    }
+    if (!line.empty()) {
+      std::cout << service.respond(line) << std::flush;
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  try {
+    std::vector<std::pair<std::string, std::string>> table_paths;
+    std::vector<std::string> string_fields{"CARRIER", "ORIGIN", "REGION",
+                                           "DEST_COUNTRY"};
+    std::vector<std::string> double_fields{"PASSENGERS", "SEATS",
+                                           "DEPARTURES_PERFORMED"};
+    std::string cache_dir;
+    size_t cache_bytes = 256ull * 1024 * 1024;
+    int thread_count = 1;
+    int output_precision = 6;
+    std::string socket_path;
+
+    for (int arg = 1; arg < argc; arg++) {
+      std::string option = argv[arg];
+      if (arg + 1 >= argc) {
+        throw std::runtime_error("The " + option + " option requires a value.");
+      }
+      std::string value = argv[++arg];
+      if (option == "--table") {
+        size_t equals = value.find('=');
+        if ((equals == std::string::npos) || (equals == 0)) {
+          throw std::runtime_error("Tables must be specified as NAME=PATH.");
+        }
+        table_paths.emplace_back(value.substr(0, equals),
+                                 value.substr(equals + 1));
+      } else if (option == "--string-fields") {
+        string_fields = split_fields(value);
+      } else if (option == "--double-fields") {
+        double_fields = split_fields(value);
+      } else if (option == "--cache-dir") {
+        cache_dir = value;
+      } else if (option == "--cache-bytes") {
+        cache_bytes = std::stoull(value);
+      } else if (option == "--threads") {
+        thread_count = std::max(1, std::stoi(value));
+      } else if (option == "--precision") {
+        output_precision = std::stoi(value);
+      } else if (option == "--socket") {
+        socket_path = value;
+      } else {
+        throw std::runtime_error("Unknown option: " + option);
+      }
+    }
+    if (table_paths.empty()) {
+      throw std::runtime_error("At least one --table NAME=PATH is required.");
+    }
+
+    // Log messages go to stderr, since stdout may be carrying responses.
+    Pivot_Service service(cache_bytes, thread_count, output_precision);
+    for (auto &[table_name, data_file_path] : table_paths) {
+      auto load_start = std::chrono::steady_clock::now();
+      Columnar_Table table =
+          cache_dir.empty()
+              ? load_columnar_table(data_file_path, string_fields,
+                                    double_fields)
+              : load_cached_columnar_table(
+                    data_file_path, string_fields, double_fields,
+                    (std::filesystem::path(cache_dir) /
+                     (table_name + ".columns.cache"))
+                        .string());
+      std::chrono::duration<double> load_seconds =
+          std::chrono::steady_clock::now() - load_start;
+      std::cerr << "Loaded " << table.row_count << " rows from "
+                << data_file_path << " as " << table_name << " in "
+                << load_seconds.count() << " seconds.\n";
+      service.add_table(table_name, std::move(table));
+    }
+
+    if (socket_path.empty()) {
+      serve_stdin(service);
+    } else {
+      serve_socket(service, socket_path);
+    }
+    return 0;
+  } catch (const std::exception &error) {
+    std::cerr << error.what() << "\n";
+    return 1;
+  }
+}
@@ -0,0 +1,380 @@
+// pivot_service.cpp
+// Released under the MIT License
+
+/* Each run of cpp_pivot_tables.cpp starts from scratch: it reloads its
+table, re-runs in_memory_pivot(), and then discards the returned map.
+A Pivot_Service instead keeps its Columnar_Tables resident for as long
+as it runs, and answers pivot requests against them. Since dashboard
+users tend to request the same few pivots over and over, each result
+is also stored within an LRU cache (keyed by the normalized request),
+so that a repeated request costs a hash lookup rather than a full
+aggregation. (The tables never change while the service runs, so
+these cached results never go stale; restarting the service picks up
+new data.)
+
+The pivot_server program (see pivot_server.cpp) exposes a
+Pivot_Service via a simple line-based protocol. Each request is one
+line made up of whitespace-separated tokens; a token can be wrapped in
+double quotes in order to include spaces. The following commands are
+supported:
+
+pivot table=NAME index=FIELD,FIELD values=FIELD,FIELD [filters]: runs
+in_memory_pivot() against the table that was loaded as NAME. Filters
+can be specified via any number of include=FIELD:VALUE|VALUE,
+exclude=FIELD:VALUE|VALUE, include_number=FIELD:NUMBER|NUMBER, and
+exclude_number=FIELD:NUMBER|NUMBER tokens, which correspond to
+in_memory_pivot()'s string and double include and exclude maps.
+(Each NUMBER must be finite.) For example:
+pivot table=t100 index=CARRIER,ORIGIN values=PASSENGERS
+include=CARRIER:UA|AA|DL "include=ORIGIN_CITY_NAME:New York, NY"
+A missing=skip, missing=zero, or missing=error token determines how
+blank values within the value fields get handled; see
+Missing_Value_Policy. (As with in_memory_pivot(), the default is
+error.)
+
+stats: reports the cache's entry count, size in bytes, hits, misses,
+and evictions.
+
+clear: empties the cache.
+
+A successful response begins with a line of the form
+"OK <byte count> [hit|miss]", which is followed by exactly that many
+bytes of output (for pivot commands, the same .csv text that
+in_memory_pivot() would have saved). A failed request instead receives
+a single "ERROR <message>" line. */
+
+#include "pivot_service.h"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+
+static std::vector<std::string> split_tokens(std::string_view line) {
+  /* Splitting line at each run of whitespace (other than whitespace
+  within double quotes, which are themselves removed). */
+  std::vector<std::string> tokens;
+  std::string token;
+  bool in_token = false;
+  bool quoted = false;
+  for (char character : line) {
+    if (character == '"') {
+      quoted = !quoted;
+      in_token = true;
+    } else if (!quoted && std::isspace(static_cast<unsigned char>(character))) {
+      if (in_token) {
+        tokens.push_back(std::move(token));
+        token.clear();
+        in_token = false;
+      }
+    } else {
+      token += character;
+      in_token = true;
+    }
+  }
+  if (quoted) {
+    throw std::runtime_error("This request contains an unterminated quote.");
+  }
+  if (in_token) {
+    tokens.push_back(std::move(token));
+  }
+  return tokens;
+}
+
+static std::vector<std::string> split_list(std::string_view list,
+                                           char separator) {
+  std::vector<std::string> items;
+  size_t item_start = 0;
+  while (true) {
+    size_t item_end = list.find(separator, item_start);
+    items.emplace_back(list.substr(item_start, item_end - item_start));
+    if (item_end == std::string_view::npos) {
+      return items;
+    }
+    item_start = item_end + 1;
+  }
+}
+
+static double parse_number(const std::string &text) {
+  /* Parsing text as a finite number. (Nan and infinite values are
+  rejected: a nan include or exclude value could never match a row,
+  and it would also keep normalized_request_key() from sorting each
+  filter's values.) */
+  double value = 0.0;
+  auto [end, error] =
+      std::from_chars(text.data(), text.data() + text.size(), value);
+  if ((error != std::errc{}) || (end != text.data() + text.size())) {
+    throw std::runtime_error("Unable to interpret " + text + " as a number.");
+  }
+  if (!std::isfinite(value)) {
+    throw std::runtime_error("Numeric filter values must be finite, but "
+                             "found " + text + ".");
+  }
+  return value;
+}
+
+Pivot_Request parse_pivot_request(std::string_view arguments) {
+  Pivot_Request request;
+  for (const std::string &token : split_tokens(arguments)) {
+    size_t equals = token.find('=');
+    if (equals == std::string::npos) {
+      throw std::runtime_error("Expected a name=value argument, but found " +
+                               token + ".");
+    }
+    std::string name = token.substr(0, equals);
+    std::string value = token.substr(equals + 1);
+    if (name == "table") {
+      request.table = value;
+    } else if (name == "index") {
+      request.index_fields = split_list(value, ',');
+    } else if (name == "values") {
+      request.value_fields = split_list(value, ',');
+    } else if (name == "missing") {
+      if (value == "skip") {
+        request.missing_values = Missing_Value_Policy::skip;
+      } else if (value == "zero") {
+        request.missing_values = Missing_Value_Policy::zero;
+      } else if (value == "error") {
+        request.missing_values = Missing_Value_Policy::error;
+      } else {
+        throw std::runtime_error(
+            "missing must be skip, zero, or error, but found " + value + ".");
+      }
+    } else if ((name == "include") || (name == "exclude") ||
+               (name == "include_number") || (name == "exclude_number")) {
+      size_t colon = value.find(':');
+      if (colon == std::string::npos) {
+        throw std::runtime_error("Filters must be specified as "
+                                 "FIELD:VALUE|VALUE, but found " +
+                                 value + ".");
+      }
+      std::string field = value.substr(0, colon);
+      std::vector<std::string> values =
+          split_list(std::string_view(value).substr(colon + 1), '|');
+      if (name.ends_with("_number")) {
+        std::vector<double> &numbers =
+            (name == "include_number") ? request.double_include_map[field]
+                                       : request.double_exclude_map[field];
+        for (const std::string &number : values) {
+          numbers.push_back(parse_number(number));
+        }
+      } else {
+        std::vector<std::string> &strings =
+            (name == "include") ? request.string_include_map[field]
+                                : request.string_exclude_map[field];
+        strings.insert(strings.end(), values.begin(), values.end());
+      }
+    } else {
+      throw std::runtime_error("Unknown pivot argument: " + name);
+    }
+  }
+  if (request.table.empty() || request.index_fields.empty() ||
+      request.value_fields.empty()) {
+    throw std::runtime_error(
+        "Pivot requests need a table, index fields, and value fields.");
+  }
+  return request;
+}
+
+static void append_key_part(std::string &key, std::string_view part) {
+  /* Appending part to key along with its length, so that no two
+  distinct sequences of parts can result in the same key. */
+  key += std::to_string(part.size());
+  key += ':';
+  key += part;
+}
+
+std::string normalized_request_key(const Pivot_Request &request) {
+  /* Fields are kept in their original order (since that order affects
+  the output), but each filter's values are sorted and deduplicated,
+  since filters only check whether a value is present. (std::map
+  already keeps the filters themselves sorted by field.) */
+  std::string key;
+  append_key_part(key, request.table);
+  key += std::to_string(static_cast<int>(request.missing_values)) + ';';
+  for (const std::vector<std::string> *fields :
+       {&request.index_fields, &request.value_fields}) {
+    key += std::to_string(fields->size()) + ';';
+    for (const std::string &field : *fields) {
+      append_key_part(key, field);
+    }
+  }
+  for (const auto *string_map :
+       {&request.string_include_map, &request.string_exclude_map}) {
+    key += std::to_string(string_map->size()) + ';';
+    for (const auto &[field, values] : *string_map) {
+      append_key_part(key, field);
+      std::vector<std::string> sorted_values = values;
+      std::ranges::sort(sorted_values);
+      auto duplicates = std::ranges::unique(sorted_values);
+      sorted_values.erase(duplicates.begin(), duplicates.end());
+      key += std::to_string(sorted_values.size()) + ';';
+      for (const std::string &value : sorted_values) {
+        append_key_part(key, value);
+      }
+    }
+  }
+  for (const auto *double_map :
+       {&request.double_include_map, &request.double_exclude_map}) {
+    key += std::to_string(double_map->size()) + ';';
+    for (const auto &[field, values] : *double_map) {
+      append_key_part(key, field);
+      std::vector<double> sorted_values = values;
+      std::ranges::sort(sorted_values);
+      auto duplicates = std::ranges::unique(sorted_values);
+      sorted_values.erase(duplicates.begin(), duplicates.end());
+      key += std::to_string(sorted_values.size()) + ';';
+      for (double value : sorted_values) {
+        // (The shortest round-trip representation of each value keeps
+        // distinct numbers from sharing a key.)
+        char buffer[64];
+        auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        append_key_part(key, std::string_view(buffer, result.ptr - buffer));
+      }
+    }
+  }
+  return key;
+}
+
+Pivot_Result_Cache::Pivot_Result_Cache(size_t capacity_bytes)
+    : capacity_bytes_(capacity_bytes) {}
+
+std::shared_ptr<const std::string>
+Pivot_Result_Cache::find(const std::string &key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto position_it = positions_.find(key);
+  if (position_it == positions_.end()) {
+    counts_.misses++;
+    return nullptr;
+  }
+  counts_.hits++;
+  entries_.splice(entries_.begin(), entries_, position_it->second);
+  return position_it->second->result;
+}
+
+void Pivot_Result_Cache::insert(const std::string &key,
+                                std::shared_ptr<const std::string> result) {
+  size_t result_bytes = key.size() + result->size();
+  if (result_bytes > capacity_bytes_) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto position_it = positions_.find(key);
+  if (position_it != positions_.end()) {
+    // (Another thread may have computed the same result in the
+    // meantime, in which case its entry gets replaced.)
+    counts_.bytes -= key.size() + position_it->second->result->size();
+    entries_.erase(position_it->second);
+    positions_.erase(position_it);
+  }
+  entries_.push_front(Entry{key, std::move(result)});
+  positions_[key] = entries_.begin();
+  counts_.bytes += result_bytes;
+  while (counts_.bytes > capacity_bytes_) {
+    const Entry &oldest = entries_.back();
+    counts_.bytes -= oldest.key.size() + oldest.result->size();
+    positions_.erase(oldest.key);
+    entries_.pop_back();
+    counts_.evictions++;
+  }
+  counts_.entries = entries_.size();
+}
+
+void Pivot_Result_Cache::clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_.clear();
+  positions_.clear();
+  counts_.entries = 0;
+  counts_.bytes = 0;
+}
+
+Pivot_Result_Cache::Counts Pivot_Result_Cache::counts() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return counts_;
+}
+
+Pivot_Service::Pivot_Service(size_t cache_bytes, int thread_count,
+                             int output_precision)
+    : cache_(cache_bytes), thread_count_(thread_count),
+      output_precision_(output_precision) {}
+
+void Pivot_Service::add_table(const std::string &name, Columnar_Table table) {
+  tables_.insert_or_assign(name, std::move(table));
+}
+
+std::shared_ptr<const std::string>
+Pivot_Service::pivot(const Pivot_Request &request, bool &cache_hit) {
+  std::string key = normalized_request_key(request);
+  if (std::shared_ptr<const std::string> cached = cache_.find(key)) {
+    cache_hit = true;
+    return cached;
+  }
+  cache_hit = false;
+  auto table_it = tables_.find(request.table);
+  if (table_it == tables_.end()) {
+    throw std::runtime_error("No table named " + request.table +
+                             " has been loaded.");
+  }
+
+  // (in_memory_pivot() accepts its arguments by non-const reference,
+  // so each request's arguments get copied. Its .csv text is appended
+  // to result rather than saved to a file, so that responses always
+  // match its output exactly.)
+  Pivot_Request arguments = request;
+  std::string unused_file_path;
+  auto result = std::make_shared<std::string>();
+  in_memory_pivot(table_it->second, arguments.index_fields,
+                  arguments.value_fields, true, unused_file_path,
+                  arguments.string_include_map, arguments.string_exclude_map,
+                  arguments.double_include_map, arguments.double_exclude_map,
+                  Pivot_Backend::hash_table, output_precision_, thread_count_,
+                  nullptr, false, {}, nullptr, {}, {},
+                  arguments.missing_values, result.get());
+  cache_.insert(key, result);
+  return result;
+}
+
+std::string Pivot_Service::respond(std::string_view request_line) {
+  try {
+    while (!request_line.empty() &&
+           std::isspace(static_cast<unsigned char>(request_line.front()))) {
+      request_line.remove_prefix(1);
+    }
+    size_t command_end = request_line.find_first_of(" \t");
+    std::string_view command = request_line.substr(0, command_end);
+    std::string_view arguments =
+        (command_end == std::string_view::npos)
+            ? std::string_view()
+            : request_line.substr(command_end + 1);
+    if (command == "pivot") {
+      bool cache_hit = false;
+      std::shared_ptr<const std::string> result =
+          pivot(parse_pivot_request(arguments), cache_hit);
+      return "OK " + std::to_string(result->size()) +
+             (cache_hit ? " hit\n" : " miss\n") + *result;
+    }
+    if (command == "stats") {
+      Pivot_Result_Cache::Counts counts = cache_.counts();
+      std::string body = "entries=" + std::to_string(counts.entries) +
+                         " bytes=" + std::to_string(counts.bytes) +
+                         " hits=" + std::to_string(counts.hits) +
+                         " misses=" + std::to_string(counts.misses) +
+                         " evictions=" + std::to_string(counts.evictions) +
+                         "\n";
+      return "OK " + std::to_string(body.size()) + "\n" + body;
+    }
+    if (command == "clear") {
+      cache_.clear();
+      return "OK 0\n";
+    }
+    throw std::runtime_error("Unknown command: " + std::string(command));
+  } catch (const std::exception &error) {
+    // (Errors are reported to the client rather than ending the
+    // service; line breaks are removed so that the response remains a
+    // single line.)
+    std::string message = error.what();
+    std::ranges::replace(message, '\n', ' ');
+    return "ERROR " + message + "\n";
+  }
+}
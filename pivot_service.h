@@ -0,0 +1,110 @@
+// pivot_service.h
+// Released under the MIT License
+
+// This header defines Pivot_Service, which keeps Columnar_Tables
+// resident in memory and answers pivot requests against them (caching
+// each result within a Pivot_Result_Cache), along with the request
+// format that the pivot_server program accepts. Documentation on
+// these types is available within pivot_service.cpp.
+
+#pragma once
+
+#include "columnar_table.h"
+#include <cstddef>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// The arguments of a single in_memory_pivot() call against one of a
+// Pivot_Service's tables:
+struct Pivot_Request {
+  std::string table;
+  std::vector<std::string> index_fields;
+  std::vector<std::string> value_fields;
+  std::map<std::string, std::vector<std::string>> string_include_map;
+  std::map<std::string, std::vector<std::string>> string_exclude_map;
+  std::map<std::string, std::vector<double>> double_include_map;
+  std::map<std::string, std::vector<double>> double_exclude_map;
+  Missing_Value_Policy missing_values{Missing_Value_Policy::error};
+};
+
+// Parses the arguments of a pivot command (see pivot_service.cpp);
+// throws a std::runtime_error if they're malformed.
+Pivot_Request parse_pivot_request(std::string_view arguments);
+
+// Returns a key that's identical for any two requests that will
+// produce the same output, regardless of the order in which their
+// filters (and each filter's values) were listed.
+std::string normalized_request_key(const Pivot_Request &request);
+
+// A thread-safe least-recently-used cache of pivot results (stored as
+// the .csv text that gets sent to clients), which holds up to
+// capacity_bytes of results.
+class Pivot_Result_Cache {
+public:
+  explicit Pivot_Result_Cache(size_t capacity_bytes);
+
+  // Returns the result stored under key (marking it as the most
+  // recently used one), or null if there isn't one.
+  std::shared_ptr<const std::string> find(const std::string &key);
+  // Stores result under key, then evicts the least recently used
+  // results until the cache fits within its capacity. (Results that
+  // are larger than the entire capacity don't get stored.)
+  void insert(const std::string &key,
+              std::shared_ptr<const std::string> result);
+  void clear();
+
+  struct Counts {
+    size_t entries{0};
+    size_t bytes{0};
+    size_t hits{0};
+    size_t misses{0};
+    size_t evictions{0};
+  };
+  Counts counts();
+
+private:
+  struct Entry {
+    std::string key;
+    std::shared_ptr<const std::string> result;
+  };
+  size_t capacity_bytes_;
+  std::mutex mutex_;
+  // The most recently used entries come first.
+  std::list<Entry> entries_;
+  std::unordered_map<std::string, std::list<Entry>::iterator> positions_;
+  Counts counts_;
+};
+
+class Pivot_Service {
+public:
+  // thread_count and output_precision get passed to each
+  // in_memory_pivot() call.
+  Pivot_Service(size_t cache_bytes, int thread_count = 1,
+                int output_precision = 6);
+
+  // Makes table available to requests under the specified name. (Tables
+  // should all be added before any requests get handled.)
+  void add_table(const std::string &name, Columnar_Table table);
+
+  // Handles one line of the pivot_server protocol, returning the
+  // complete response. (This function may be called from several
+  // threads at once.)
+  std::string respond(std::string_view request_line);
+
+  // Returns the .csv output of request, from the cache if possible.
+  // cache_hit will be set to whether the result came from the cache.
+  std::shared_ptr<const std::string> pivot(const Pivot_Request &request,
+                                           bool &cache_hit);
+
+private:
+  std::map<std::string, Columnar_Table> tables_;
+  Pivot_Result_Cache cache_;
+  int thread_count_;
+  int output_precision_;
+};
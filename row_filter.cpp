@@ -0,0 +1,493 @@
+// row_filter.cpp
+// Released under the MIT License
+
+/* The include and exclude maps accepted by the pivot functions store
+each field's values as a std::vector, and these maps refer to fields
+by name. Checking these maps directly would therefore require a
+by-name field lookup and a linear search of each value list for every
+row--which becomes expensive when filtering on, say, hundreds of
+airports.
+
+The filter objects defined here get compiled from these maps once,
+before any rows are processed:
+
+1. Each field's column position (or, for Columnar_Table objects, its
+column) is resolved ahead of time.
+
+2. Each field's values are stored within a hash set. For
+Columnar_Table string columns, each value list instead gets converted
+into a bitset indexed by dictionary code, so checking a row only
+requires a single array lookup.
+
+3. The predicates are evaluated in order of selectivity (via
+Predicate_Order), so that most rows that will be filtered out get
+rejected by the first predicate checked. Since the actual rejection
+rates aren't known ahead of time, each filter starts out with estimated
+rates, then re-sorts its predicates every few thousand rows based on
+the rates it has observed so far.
+
+4. Range filters on numeric fields (such as "SEATS >= 100") are
+converted into closed intervals. Column_Filter checks its rows a block
+at a time: each range filter is applied to the whole block via one
+branch-free pass over its column, and the rows that pass all of them
+are written to a selection vector of row offsets. The other predicates
+then compact this vector in order of selectivity, so each one only
+reads the rows that are still selected.
+
+Each range pass compares 8 values at a time against both bounds and
+ANDs the results into a byte mask. As with the kernels within
+structural_scan.cpp, the best available version gets chosen at
+runtime: AVX2 (two 4-value comparisons per step) or SSE2 (four 2-value
+comparisons) on x86-64 CPUs, NEON on ARM64 CPUs, and a portable scalar
+loop everywhere else. (The x86 kernels are compiled via target
+attributes, so the rest of the program doesn't need to be built with
+-mavx2.)
+
+Note that these filters keep track of their own rejection counts, so
+each thread should use its own filter objects. */
+
+#include "row_filter.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ROW_FILTER_X86
+#include <immintrin.h>
+#elif defined(__GNUC__) && defined(__aarch64__)
+#define ROW_FILTER_NEON
+#include <arm_neon.h>
+#endif
+
+Predicate_Order::Predicate_Order(
+    const std::vector<double> &estimated_pass_rates)
+    : order_(estimated_pass_rates.size()),
+      evaluations_(estimated_pass_rates.size(), 0),
+      rejections_(estimated_pass_rates.size(), 0) {
+  std::iota(order_.begin(), order_.end(), 0);
+  std::stable_sort(order_.begin(), order_.end(), [&](size_t a, size_t b) {
+    return estimated_pass_rates[a] < estimated_pass_rates[b];
+  });
+}
+
+void Predicate_Order::reorder() {
+  /* Sorting the predicates by their observed rejection rates (from
+  highest to lowest). A predicate's rate can only be measured for rows
+  that made it past the predicates in front of it; the +1 and +2 terms
+  keep rarely-evaluated predicates from being assigned extreme rates
+  based on only a handful of rows. */
+  auto rejection_rate = [&](size_t predicate) {
+    return (rejections_[predicate] + 1.0) / (evaluations_[predicate] + 2.0);
+  };
+  std::stable_sort(order_.begin(), order_.end(), [&](size_t a, size_t b) {
+    return rejection_rate(a) > rejection_rate(b);
+  });
+}
+
+// Without any information about the data itself, include predicates
+// are assumed to reject more rows than exclude predicates (since
+// exclude lists generally remove only a small share of the data).
+static constexpr double estimated_include_pass_rate = 0.5;
+static constexpr double estimated_exclude_pass_rate = 0.9;
+
+// Range filters are assumed to be about as selective as include lists.
+static constexpr double estimated_range_pass_rate = 0.5;
+
+Double_Range::Double_Range(const Double_Range_Filter &filter)
+    : lower(-std::numeric_limits<double>::infinity()),
+      upper(std::numeric_limits<double>::infinity()),
+      null_test(filter.test == Range_Test::is_null) {
+  /* Strict bounds become the adjacent representable values, so that
+  "> 0" is checked as ">= the smallest positive double". (Since nan
+  fails every comparison, an interval with a nan bound matches no
+  values, and not_null's unbounded interval matches every number.) */
+  constexpr double infinity = std::numeric_limits<double>::infinity();
+  switch (filter.test) {
+  case Range_Test::less:
+    upper = (filter.bound == -infinity)
+                ? std::numeric_limits<double>::quiet_NaN()
+                : std::nextafter(filter.bound, -infinity);
+    break;
+  case Range_Test::less_equal:
+    upper = filter.bound;
+    break;
+  case Range_Test::greater:
+    lower = (filter.bound == infinity)
+                ? std::numeric_limits<double>::quiet_NaN()
+                : std::nextafter(filter.bound, infinity);
+    break;
+  case Range_Test::greater_equal:
+    lower = filter.bound;
+    break;
+  case Range_Test::between:
+    lower = filter.bound;
+    upper = filter.upper_bound;
+    break;
+  case Range_Test::is_null:
+  case Range_Test::not_null:
+    break;
+  }
+}
+
+Row_Filter::Row_Filter(
+    const std::vector<std::string> &col_names,
+    const std::map<std::string, std::vector<std::string>> &include_map,
+    const std::map<std::string, std::vector<std::string>> &exclude_map) {
+  auto column_position = [&](const std::string &field) -> size_t {
+    auto col_it = std::ranges::find(col_names, field);
+    if (col_it == col_names.end()) {
+      throw std::runtime_error("The filter field " + field +
+                               " is not present within this dataset.");
+    }
+    return col_it - col_names.begin();
+  };
+  std::vector<double> estimated_pass_rates;
+  for (bool include : {true, false}) {
+    for (auto const &[field, field_vals] : include ? include_map : exclude_map) {
+      predicates_.push_back({column_position(field), include,
+                             String_Set(field_vals.begin(), field_vals.end())});
+      estimated_pass_rates.push_back(include ? estimated_include_pass_rate
+                                             : estimated_exclude_pass_rate);
+    }
+  }
+  order_ = Predicate_Order(estimated_pass_rates);
+}
+
+std::vector<size_t> Row_Filter::columns() const {
+  std::vector<size_t> filter_columns;
+  for (const Value_Predicate &value_predicate : predicates_) {
+    filter_columns.push_back(value_predicate.column);
+  }
+  return filter_columns;
+}
+
+Row_Map_Filter::Row_Map_Filter(
+    const std::map<std::string, std::vector<std::string>> &string_include_map,
+    const std::map<std::string, std::vector<std::string>> &string_exclude_map,
+    const std::map<std::string, std::vector<double>> &double_include_map,
+    const std::map<std::string, std::vector<double>> &double_exclude_map,
+    const std::vector<Double_Range_Filter> &range_filters) {
+  std::vector<double> estimated_pass_rates;
+  for (bool include : {true, false}) {
+    for (auto const &[field, field_vals] :
+         include ? string_include_map : string_exclude_map) {
+      string_predicates_.push_back(
+          {field, include, String_Set(field_vals.begin(), field_vals.end())});
+      estimated_pass_rates.push_back(include ? estimated_include_pass_rate
+                                             : estimated_exclude_pass_rate);
+    }
+  }
+  for (bool include : {true, false}) {
+    for (auto const &[field, field_vals] :
+         include ? double_include_map : double_exclude_map) {
+      double_predicates_.push_back(
+          {field, include,
+           std::unordered_set<double>(field_vals.begin(), field_vals.end())});
+      estimated_pass_rates.push_back(include ? estimated_include_pass_rate
+                                             : estimated_exclude_pass_rate);
+    }
+  }
+  for (const Double_Range_Filter &range_filter : range_filters) {
+    range_predicates_.push_back(
+        {range_filter.field, Double_Range(range_filter)});
+    estimated_pass_rates.push_back(estimated_range_pass_rate);
+  }
+  order_ = Predicate_Order(estimated_pass_rates);
+}
+
+bool Row_Map_Filter::passes(
+    const std::map<std::string, std::variant<std::string, double>> &row) {
+  return order_.all_pass([&](size_t predicate) {
+    if (predicate < string_predicates_.size()) {
+      const String_Predicate &string_predicate = string_predicates_[predicate];
+      return string_predicate.values.contains(std::get<std::string>(
+                 row.at(string_predicate.field))) == string_predicate.include;
+    }
+    predicate -= string_predicates_.size();
+    if (predicate < double_predicates_.size()) {
+      const Double_Predicate &double_predicate = double_predicates_[predicate];
+      return double_predicate.values.contains(
+                 std::get<double>(row.at(double_predicate.field))) ==
+             double_predicate.include;
+    }
+    const Range_Predicate &range_predicate =
+        range_predicates_[predicate - double_predicates_.size()];
+    return range_predicate.range.contains(
+        std::get<double>(row.at(range_predicate.field)));
+  });
+}
+
+Column_Filter::Column_Filter(
+    const Columnar_Table &table,
+    const std::map<std::string, std::vector<std::string>> &string_include_map,
+    const std::map<std::string, std::vector<std::string>> &string_exclude_map,
+    const std::map<std::string, std::vector<double>> &double_include_map,
+    const std::map<std::string, std::vector<double>> &double_exclude_map,
+    const std::vector<Double_Range_Filter> &range_filters)
+    : range_mask_(max_block_rows) {
+  std::vector<double> estimated_pass_rates;
+  for (bool include : {true, false}) {
+    for (auto const &[field, field_vals] :
+         include ? string_include_map : string_exclude_map) {
+      const String_Column &column = table.string_column(field);
+      // Every code starts out as passing (for exclude predicates) or
+      // failing (for include predicates); the codes of the listed
+      // values then get flipped. (Values that don't appear within the
+      // column's dictionary can't match any rows, so they're skipped.)
+      Code_Predicate &code_predicate = code_predicates_.emplace_back();
+      code_predicate.codes = &column.codes;
+      code_predicate.passing_codes.assign(column.dictionary.size(),
+                                          include ? 0 : 1);
+      for (const std::string &field_val : field_vals) {
+        auto code_it = column.dictionary.code_lookup.find(field_val);
+        if (code_it != column.dictionary.code_lookup.end()) {
+          code_predicate.passing_codes[code_it->second] = include ? 1 : 0;
+        }
+      }
+      // Since the dictionary is known, the share of distinct values
+      // that pass makes for a better starting estimate than a fixed
+      // one. (Empty columns are treated as fully passing.)
+      size_t passing_count = std::ranges::count(code_predicate.passing_codes, 1);
+      estimated_pass_rates.push_back(
+          column.dictionary.size() > 0
+              ? double(passing_count) / column.dictionary.size()
+              : 1.0);
+    }
+  }
+  for (bool include : {true, false}) {
+    for (auto const &[field, field_vals] :
+         include ? double_include_map : double_exclude_map) {
+      double_predicates_.push_back(
+          {&table.double_column(field), include,
+           std::unordered_set<double>(field_vals.begin(), field_vals.end())});
+      estimated_pass_rates.push_back(include ? estimated_include_pass_rate
+                                             : estimated_exclude_pass_rate);
+    }
+  }
+  for (const Double_Range_Filter &range_filter : range_filters) {
+    range_predicates_.push_back(
+        {&table.double_column(range_filter.field), Double_Range(range_filter)});
+  }
+  order_ = Predicate_Order(estimated_pass_rates);
+}
+
+// A function that ANDs each of mask's first count bytes with 1 if the
+// corresponding value passes range (and 0 otherwise):
+using Range_Kernel = void (*)(const double *values, size_t count,
+                              const Double_Range &range, uint8_t *mask);
+
+static void scalar_range_kernel(const double *values, size_t count,
+                                const Double_Range &range, uint8_t *mask) {
+  if (range.null_test) {
+    for (size_t i = 0; i < count; i++) {
+      mask[i] &= uint8_t(std::isnan(values[i]));
+    }
+  } else {
+    for (size_t i = 0; i < count; i++) {
+      mask[i] &= uint8_t((values[i] >= range.lower) &
+                         (values[i] <= range.upper));
+    }
+  }
+}
+
+#if defined(ROW_FILTER_X86)
+
+// Entry b has a 1 within byte i for each bit i that's set within b, so
+// that 8 comparison results (as returned by movemask) can be ANDed into
+// 8 mask bytes at once:
+static constexpr std::array<uint64_t, 256> mask_bytes = [] {
+  std::array<uint64_t, 256> bytes{};
+  for (int bits = 0; bits < 256; bits++) {
+    for (int i = 0; i < 8; i++) {
+      if (bits & (1 << i)) {
+        bytes[bits] |= uint64_t(1) << (8 * i);
+      }
+    }
+  }
+  return bytes;
+}();
+
+static void and_mask_bytes(uint8_t *mask, unsigned bits) {
+  uint64_t mask_word;
+  std::memcpy(&mask_word, mask, sizeof(mask_word));
+  mask_word &= mask_bytes[bits];
+  std::memcpy(mask, &mask_word, sizeof(mask_word));
+}
+
+__attribute__((target("avx2"))) static unsigned
+avx2_passes(__m256d values, __m256d lower, __m256d upper, bool null_test) {
+  __m256d passes =
+      null_test ? _mm256_cmp_pd(values, values, _CMP_UNORD_Q)
+                : _mm256_and_pd(_mm256_cmp_pd(values, lower, _CMP_GE_OQ),
+                                _mm256_cmp_pd(values, upper, _CMP_LE_OQ));
+  return unsigned(_mm256_movemask_pd(passes));
+}
+
+__attribute__((target("avx2"))) static void
+avx2_range_kernel(const double *values, size_t count,
+                  const Double_Range &range, uint8_t *mask) {
+  __m256d lower = _mm256_set1_pd(range.lower);
+  __m256d upper = _mm256_set1_pd(range.upper);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    unsigned bits =
+        avx2_passes(_mm256_loadu_pd(values + i), lower, upper,
+                    range.null_test) |
+        (avx2_passes(_mm256_loadu_pd(values + i + 4), lower, upper,
+                     range.null_test)
+         << 4);
+    and_mask_bytes(mask + i, bits);
+  }
+  scalar_range_kernel(values + i, count - i, range, mask + i);
+}
+
+__attribute__((target("sse2"))) static unsigned
+sse2_passes(__m128d values, __m128d lower, __m128d upper, bool null_test) {
+  __m128d passes = null_test ? _mm_cmpunord_pd(values, values)
+                             : _mm_and_pd(_mm_cmpge_pd(values, lower),
+                                          _mm_cmple_pd(values, upper));
+  return unsigned(_mm_movemask_pd(passes));
+}
+
+__attribute__((target("sse2"))) static void
+sse2_range_kernel(const double *values, size_t count,
+                  const Double_Range &range, uint8_t *mask) {
+  __m128d lower = _mm_set1_pd(range.lower);
+  __m128d upper = _mm_set1_pd(range.upper);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    unsigned bits = 0;
+    for (int offset = 0; offset < 8; offset += 2) {
+      bits |= sse2_passes(_mm_loadu_pd(values + i + offset), lower, upper,
+                          range.null_test)
+              << offset;
+    }
+    and_mask_bytes(mask + i, bits);
+  }
+  scalar_range_kernel(values + i, count - i, range, mask + i);
+}
+
+#elif defined(ROW_FILTER_NEON)
+
+static uint32x2_t neon_passes(const double *values, float64x2_t lower,
+                              float64x2_t upper, bool null_test) {
+  // (Each comparison yields an all-ones or all-zeros 64-bit lane, which
+  // gets narrowed down to 32 bits.)
+  float64x2_t pair = vld1q_f64(values);
+  uint64x2_t passes =
+      null_test ? vreinterpretq_u64_u32(vmvnq_u32(
+                      vreinterpretq_u32_u64(vceqq_f64(pair, pair))))
+                : vandq_u64(vcgeq_f64(pair, lower), vcleq_f64(pair, upper));
+  return vmovn_u64(passes);
+}
+
+static void neon_range_kernel(const double *values, size_t count,
+                              const Double_Range &range, uint8_t *mask) {
+  // Since NEON lacks a movemask instruction, each step's 8 results
+  // instead get narrowed down to 8 bytes, which are then ANDed with 1
+  // and with the mask.
+  float64x2_t lower = vdupq_n_f64(range.lower);
+  float64x2_t upper = vdupq_n_f64(range.upper);
+  uint8x8_t ones = vdup_n_u8(1);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    uint32x4_t first_half =
+        vcombine_u32(neon_passes(values + i, lower, upper, range.null_test),
+                     neon_passes(values + i + 2, lower, upper,
+                                 range.null_test));
+    uint32x4_t second_half = vcombine_u32(
+        neon_passes(values + i + 4, lower, upper, range.null_test),
+        neon_passes(values + i + 6, lower, upper, range.null_test));
+    uint8x8_t passes = vand_u8(
+        vmovn_u16(vcombine_u16(vmovn_u32(first_half), vmovn_u32(second_half))),
+        ones);
+    vst1_u8(mask + i, vand_u8(vld1_u8(mask + i), passes));
+  }
+  scalar_range_kernel(values + i, count - i, range, mask + i);
+}
+
+#endif
+
+struct Range_Kernel_Choice {
+  Range_Kernel kernel;
+  const char *name;
+};
+
+static Range_Kernel_Choice choose_range_kernel() {
+#if defined(ROW_FILTER_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return {avx2_range_kernel, "avx2"};
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return {sse2_range_kernel, "sse2"};
+  }
+#elif defined(ROW_FILTER_NEON)
+  return {neon_range_kernel, "neon"};
+#endif
+  return {scalar_range_kernel, "scalar"};
+}
+
+static const Range_Kernel_Choice &range_kernel_choice() {
+  static const Range_Kernel_Choice choice = choose_range_kernel();
+  return choice;
+}
+
+const char *range_kernel_name() { return range_kernel_choice().name; }
+
+size_t Column_Filter::select(size_t first_row, size_t row_count,
+                             uint16_t *selection) {
+  /* Applying each range predicate to the whole block (as a dense pass
+  whose results are ANDed into range_mask_), converting the mask into a
+  selection vector, and then letting each remaining predicate remove
+  the rows that it rejects from that vector. */
+  size_t selected_count = row_count;
+  if (range_predicates_.empty()) {
+    std::iota(selection, selection + row_count, uint16_t(0));
+  } else {
+    uint8_t *mask = range_mask_.data();
+    std::fill_n(mask, row_count, uint8_t(1));
+    Range_Kernel range_kernel = range_kernel_choice().kernel;
+    for (const Range_Predicate &range_predicate : range_predicates_) {
+      range_kernel(range_predicate.column->data() + first_row, row_count,
+                   range_predicate.range, mask);
+    }
+    // (Each offset gets written, but only passing rows advance the
+    // count, which avoids a branch per row.)
+    selected_count = 0;
+    for (size_t i = 0; i < row_count; i++) {
+      selection[selected_count] = uint16_t(i);
+      selected_count += mask[i];
+    }
+  }
+
+  return order_.filter_rows(selected_count, [&](size_t predicate,
+                                                size_t candidate_count) {
+    size_t passing_count = 0;
+    if (predicate < code_predicates_.size()) {
+      const Code_Predicate &code_predicate = code_predicates_[predicate];
+      const uint32_t *codes = code_predicate.codes->data() + first_row;
+      const uint8_t *passing_codes = code_predicate.passing_codes.data();
+      for (size_t k = 0; k < candidate_count; k++) {
+        uint16_t offset = selection[k];
+        selection[passing_count] = offset;
+        passing_count += passing_codes[codes[offset]];
+      }
+      return passing_count;
+    }
+    const Double_Predicate &double_predicate =
+        double_predicates_[predicate - code_predicates_.size()];
+    const double *values = double_predicate.column->data() + first_row;
+    for (size_t k = 0; k < candidate_count; k++) {
+      uint16_t offset = selection[k];
+      selection[passing_count] = offset;
+      passing_count += (double_predicate.values.contains(values[offset]) ==
+                        double_predicate.include);
+    }
+    return passing_count;
+  });
+}
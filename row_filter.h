@@ -0,0 +1,234 @@
+// row_filter.h
+// Released under the MIT License
+
+// This header defines filter objects that the pivot functions within
+// pivot_compressors.cpp compile their include and exclude maps into
+// before any rows are processed. Documentation on these types is
+// available within row_filter.cpp.
+
+#pragma once
+
+#include "columnar_table.h"
+#include "csv.hpp"
+#include "pivot_hash_table.h"
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <variant>
+#include <vector>
+
+// A set of strings that can be searched via std::string_view keys:
+using String_Set = std::unordered_set<std::string, String_Hash, std::equal_to<>>;
+
+// Keeps track of how often each of a filter's predicates rejects a
+// row, then periodically reorders the predicates so that those most
+// likely to reject a row get evaluated first.
+class Predicate_Order {
+public:
+  // estimated_pass_rates: the estimated share of rows that will pass
+  // each predicate. Predicates with lower estimates will be evaluated
+  // first until enough rows have been tested to measure these rates.
+  explicit Predicate_Order(const std::vector<double> &estimated_pass_rates = {});
+
+  // Returns true if test(predicate) returns true for every predicate.
+  // (Evaluation stops as soon as one predicate returns false.)
+  template <typename Test> bool all_pass(Test &&test) {
+    bool passes = true;
+    for (size_t predicate : order_) {
+      evaluations_[predicate]++;
+      if (!test(predicate)) {
+        rejections_[predicate]++;
+        passes = false;
+        break;
+      }
+    }
+    if (++rows_tested_ % reorder_interval == 0) {
+      reorder();
+    }
+    return passes;
+  }
+
+  // The block-at-a-time counterpart of all_pass(): calls
+  // filter(predicate, row_count) for each predicate in order, where
+  // row_count is the number of rows that passed the predicates before
+  // it; filter should return how many of those rows also pass
+  // predicate. Returns the number of rows that pass every predicate.
+  template <typename Filter>
+  size_t filter_rows(size_t row_count, Filter &&filter) {
+    uint64_t previous_rows_tested = rows_tested_;
+    rows_tested_ += row_count;
+    for (size_t predicate : order_) {
+      if (row_count == 0) {
+        break;
+      }
+      size_t passing_count = filter(predicate, row_count);
+      evaluations_[predicate] += row_count;
+      rejections_[predicate] += row_count - passing_count;
+      row_count = passing_count;
+    }
+    if (rows_tested_ / reorder_interval !=
+        previous_rows_tested / reorder_interval) {
+      reorder();
+    }
+    return row_count;
+  }
+
+private:
+  static constexpr uint64_t reorder_interval = 4096;
+  void reorder();
+
+  std::vector<size_t> order_;
+  std::vector<uint64_t> evaluations_;
+  std::vector<uint64_t> rejections_;
+  uint64_t rows_tested_{0};
+};
+
+// A Double_Range_Filter (see pivot_compressors.h) converted into a
+// closed interval (or, for is_null, a nan test), so that every test
+// can be checked via the same pair of comparisons.
+struct Double_Range {
+  explicit Double_Range(const Double_Range_Filter &filter);
+
+  bool contains(double value) const {
+    return null_test ? std::isnan(value)
+                     : ((value >= lower) & (value <= upper));
+  }
+
+  double lower;
+  double upper;
+  bool null_test;
+};
+
+// A filter for CSVRow objects whose predicates refer to fields by
+// column position.
+class Row_Filter {
+public:
+  // Throws a std::runtime_error if a field within either map isn't
+  // present within col_names.
+  Row_Filter(const std::vector<std::string> &col_names,
+             const std::map<std::string, std::vector<std::string>> &include_map,
+             const std::map<std::string, std::vector<std::string>> &exclude_map);
+
+  // field_text(column) should return the text of the field at
+  // position column within the row being tested (e.g. as a
+  // std::string_view).
+  template <typename Field_Text> bool passes(Field_Text &&field_text) {
+    return order_.all_pass([&](size_t predicate) {
+      const Value_Predicate &value_predicate = predicates_[predicate];
+      return value_predicate.values.contains(
+                 field_text(value_predicate.column)) ==
+             value_predicate.include;
+    });
+  }
+  bool passes(CSVRow &row) {
+    return passes([&](size_t column) { return row[column].get_sv(); });
+  }
+
+  // The column positions referenced by this filter's predicates:
+  std::vector<size_t> columns() const;
+
+private:
+  struct Value_Predicate {
+    size_t column;
+    bool include; // false for exclude_map predicates
+    String_Set values;
+  };
+  std::vector<Value_Predicate> predicates_;
+  Predicate_Order order_;
+};
+
+// A filter for the row maps processed by the original version of
+// in_memory_pivot().
+class Row_Map_Filter {
+public:
+  Row_Map_Filter(
+      const std::map<std::string, std::vector<std::string>> &string_include_map,
+      const std::map<std::string, std::vector<std::string>> &string_exclude_map,
+      const std::map<std::string, std::vector<double>> &double_include_map,
+      const std::map<std::string, std::vector<double>> &double_exclude_map,
+      const std::vector<Double_Range_Filter> &range_filters = {});
+
+  bool
+  passes(const std::map<std::string, std::variant<std::string, double>> &row);
+
+private:
+  struct String_Predicate {
+    std::string field;
+    bool include;
+    String_Set values;
+  };
+  struct Double_Predicate {
+    std::string field;
+    bool include;
+    std::unordered_set<double> values;
+  };
+  struct Range_Predicate {
+    std::string field;
+    Double_Range range;
+  };
+  // Predicates 0 through (string_predicates_.size() - 1) refer to
+  // string_predicates_, the next double_predicates_.size() refer to
+  // double_predicates_, and the rest refer to range_predicates_.
+  std::vector<String_Predicate> string_predicates_;
+  std::vector<Double_Predicate> double_predicates_;
+  std::vector<Range_Predicate> range_predicates_;
+  Predicate_Order order_;
+};
+
+// The name of the kernel (e.g. "avx2") that Column_Filter uses to check
+// its range predicates; see row_filter.cpp.
+const char *range_kernel_name();
+
+// A filter for Columnar_Table rows, which get checked a block at a
+// time. Each string predicate is stored as a bitset that indicates,
+// for each code within its column's dictionary, whether rows with that
+// code will pass.
+class Column_Filter {
+public:
+  // The largest number of rows that select() can check at once:
+  static constexpr size_t max_block_rows = 4096;
+
+  // Throws a std::runtime_error if table doesn't contain one of the
+  // columns referenced by these maps or filters.
+  Column_Filter(
+      const Columnar_Table &table,
+      const std::map<std::string, std::vector<std::string>> &string_include_map,
+      const std::map<std::string, std::vector<std::string>> &string_exclude_map,
+      const std::map<std::string, std::vector<double>> &double_include_map,
+      const std::map<std::string, std::vector<double>> &double_exclude_map,
+      const std::vector<Double_Range_Filter> &range_filters = {});
+
+  // Writes the offsets (from first_row) of the rows within [first_row,
+  // first_row + row_count) that pass every predicate to selection, in
+  // order, and returns the number of offsets written. row_count can't
+  // exceed max_block_rows.
+  size_t select(size_t first_row, size_t row_count, uint16_t *selection);
+
+private:
+  struct Code_Predicate {
+    const std::vector<uint32_t> *codes;
+    std::vector<uint8_t> passing_codes;
+  };
+  struct Double_Predicate {
+    const std::vector<double> *column;
+    bool include;
+    std::unordered_set<double> values;
+  };
+  struct Range_Predicate {
+    const std::vector<double> *column;
+    Double_Range range;
+  };
+  // Predicates 0 through (code_predicates_.size() - 1) refer to
+  // code_predicates_; the rest refer to double_predicates_. (Range
+  // predicates are always checked first; see select().)
+  std::vector<Code_Predicate> code_predicates_;
+  std::vector<Double_Predicate> double_predicates_;
+  std::vector<Range_Predicate> range_predicates_;
+  Predicate_Order order_;
+  // Whether each row of the current block has passed the range
+  // predicates checked so far:
+  std::vector<uint8_t> range_mask_;
+};
@@ -0,0 +1,195 @@
+// sample_estimator.cpp
+// Released under the MIT License
+
+/* When scan_to_multi_pivot() samples a file (see
+Scan_Options::sample_fraction), the file's data rows are divided into
+equally sized, line-aligned blocks, and only some of these blocks get
+scanned. Each block is treated as a cluster: every row belongs to
+exactly one block (the one in which the row begins), so a block's sum
+and count for each group can be scaled up to an estimate of the whole
+file's totals.
+
+The blocks are divided into contiguous strata, and a simple random
+sample of blocks is drawn (without replacement) within each stratum.
+(A uniform sample is just the special case of a single stratum.)
+Since the BTS files are sorted (e.g. by month), stratifying ensures
+that every part of the file is represented in the sample, which
+generally reduces the variance of the estimates.
+
+For stratum h, which contains N_h blocks, n_h of which were sampled,
+and a group whose per-block sums within the sampled blocks are y_1
+through y_{n_h} (with 0 for blocks that don't contain the group):
+
+1. The estimated sum is N_h / n_h * (y_1 + ... + y_{n_h}); the
+whole table's estimate is the total of these estimates across all
+strata. Counts are estimated the same way.
+
+2. The variance of this estimate is N_h^2 * (1 - n_h / N_h) * s_h^2 /
+n_h, where s_h^2 is the sample variance of the y values and
+(1 - n_h / N_h) is the finite population correction. (Strata in
+which every block was sampled therefore contribute no variance.)
+Strata with only one sampled block can't estimate s_h^2, so
+scan_to_multi_pivot() assigns at least two blocks to each stratum.
+
+3. The mean is estimated as the ratio of the estimated sum to the
+estimated count. Its variance is approximated via linearization
+(the delta method): (Var(sum) - 2 * mean * Cov(sum, count) +
+mean^2 * Var(count)) / count^2.
+
+Each estimate's confidence interval is then estimate +/- t * sqrt(
+variance), where t is the quantile of Student's t distribution for
+the requested confidence level (e.g. about 1.96 for 95% when many
+blocks were sampled). Its degrees of freedom are the number of sampled
+blocks minus the number of strata, which widens the intervals of small
+samples. These intervals still assume that the estimates are roughly
+normal, so they'll tend to be too narrow for groups that only appear
+within a few sampled blocks, and groups that don't appear within any
+sampled block will be missing from the output altogether. */
+
+#include "sample_estimator.h"
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+Sample_Estimator::Sample_Estimator(size_t value_count)
+    : value_count_(value_count) {}
+
+void Sample_Estimator::begin_stratum(size_t population_blocks,
+                                     size_t sampled_blocks) {
+  if ((sampled_blocks == 0) || (sampled_blocks > population_blocks)) {
+    throw std::runtime_error("A stratum must sample between 1 block and "
+                             "all of its blocks.");
+  }
+  population_blocks_ = population_blocks;
+  sampled_blocks_ = sampled_blocks;
+  total_sampled_blocks_ += sampled_blocks;
+  stratum_count_++;
+}
+
+void Sample_Estimator::add_block_group(std::string_view pivot_index,
+                                       const Pivot_Vals *pivot_vals) {
+  auto group_it = groups_.find(pivot_index);
+  if (group_it == groups_.end()) {
+    group_it =
+        groups_.emplace(std::string(pivot_index), groups_.size()).first;
+    totals_.resize(totals_.size() + value_count_);
+    stratum_totals_.resize(stratum_totals_.size() + value_count_);
+    in_stratum_.push_back(false);
+  }
+  size_t group = group_it->second;
+  if (!in_stratum_[group]) {
+    in_stratum_[group] = true;
+    stratum_groups_.push_back(group);
+  }
+  for (size_t vfi = 0; vfi < value_count_; vfi++) {
+    Stratum_Totals &stratum = stratum_totals_[group * value_count_ + vfi];
+    double sum = pivot_vals[vfi].pivot_sum;
+    double count = double(pivot_vals[vfi].pivot_count);
+    stratum.sum += sum;
+    stratum.count += count;
+    stratum.sum_squares += sum * sum;
+    stratum.count_squares += count * count;
+    stratum.sum_count_products += sum * count;
+  }
+}
+
+void Sample_Estimator::end_stratum() {
+  /* Adding the current stratum's contribution to each of its groups'
+  estimates and variances (see the notes at the top of this file),
+  then resetting its totals. */
+  double n = double(sampled_blocks_);
+  double population = double(population_blocks_);
+  double expansion = population / n;
+  double variance_weight = population * population * (1.0 - n / population) / n;
+  for (size_t group : stratum_groups_) {
+    for (size_t vfi = 0; vfi < value_count_; vfi++) {
+      Stratum_Totals &stratum = stratum_totals_[group * value_count_ + vfi];
+      Field_Totals &totals = totals_[group * value_count_ + vfi];
+      totals.sum += expansion * stratum.sum;
+      totals.count += expansion * stratum.count;
+      if (sampled_blocks_ > 1) {
+        // (These sample variances and covariance include the blocks
+        // that didn't contain this group, whose values are all 0.)
+        auto sample_covariance = [&](double sum_products, double sum_a,
+                                     double sum_b) {
+          return (sum_products - sum_a * sum_b / n) / (n - 1.0);
+        };
+        totals.sum_variance +=
+            variance_weight * std::max(0.0, sample_covariance(
+                                                stratum.sum_squares,
+                                                stratum.sum, stratum.sum));
+        totals.count_variance +=
+            variance_weight *
+            std::max(0.0, sample_covariance(stratum.count_squares,
+                                            stratum.count, stratum.count));
+        totals.covariance +=
+            variance_weight * sample_covariance(stratum.sum_count_products,
+                                                stratum.sum, stratum.count);
+      }
+      stratum = Stratum_Totals{};
+    }
+    in_stratum_[group] = false;
+  }
+  stratum_groups_.clear();
+}
+
+Sample_Estimate Sample_Estimator::estimate(const Field_Totals &totals,
+                                           double z) {
+  Sample_Estimate estimate;
+  estimate.sum = totals.sum;
+  estimate.count = totals.count;
+  estimate.sum_margin = z * std::sqrt(totals.sum_variance);
+  estimate.count_margin = z * std::sqrt(totals.count_variance);
+  if (totals.count > 0) {
+    estimate.mean = totals.sum / totals.count;
+    double mean_variance =
+        (totals.sum_variance - 2.0 * estimate.mean * totals.covariance +
+         estimate.mean * estimate.mean * totals.count_variance) /
+        (totals.count * totals.count);
+    estimate.mean_margin = z * std::sqrt(std::max(0.0, mean_variance));
+  } else {
+    // (As with exact tables, a group whose values were all skipped
+    // has no mean.)
+    estimate.mean = std::numeric_limits<double>::quiet_NaN();
+    estimate.mean_margin = std::numeric_limits<double>::quiet_NaN();
+  }
+  return estimate;
+}
+
+double Sample_Estimator::normal_quantile(double confidence_level) {
+  /* Finding the z for which erf(z / sqrt(2)), the probability that a
+  standard normal variable falls within [-z, z], equals
+  confidence_level. (Since erf() is increasing, a bisection search
+  converges to full precision within about 60 steps.) */
+  if (!(confidence_level > 0.0) || !(confidence_level < 1.0)) {
+    throw std::runtime_error(
+        "The confidence level must be greater than 0 and less than 1.");
+  }
+  double low = 0.0;
+  double high = 40.0;
+  for (int step = 0; step < 100; step++) {
+    double middle = (low + high) / 2.0;
+    if (std::erf(middle / std::sqrt(2.0)) < confidence_level) {
+      low = middle;
+    } else {
+      high = middle;
+    }
+  }
+  return (low + high) / 2.0;
+}
+
+double Sample_Estimator::critical_value(double confidence_level) const {
+  /* Converting the normal quantile into a t quantile via the
+  Cornish-Fisher expansion given by Abramowitz and Stegun (26.7.5),
+  which is accurate to within about 1% for 3 or more degrees of
+  freedom. (With fewer, the expansion is evaluated at 3 degrees of
+  freedom, so tiny samples receive wide, but not infinite, margins.) */
+  double z = normal_quantile(confidence_level);
+  double df = std::max(3.0, double(total_sampled_blocks_) -
+                                double(stratum_count_));
+  double z2 = z * z;
+  return z + z * (z2 + 1.0) / (4.0 * df) +
+         z * ((5.0 * z2 + 16.0) * z2 + 3.0) / (96.0 * df * df) +
+         z * (((3.0 * z2 + 19.0) * z2 + 17.0) * z2 - 15.0) /
+             (384.0 * df * df * df);
+}
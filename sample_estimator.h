@@ -0,0 +1,112 @@
+// sample_estimator.h
+// Released under the MIT License
+
+// This header defines Sample_Estimator, which estimates a pivot
+// table's sums, counts, and means (along with their confidence
+// intervals) from a stratified sample of a file's blocks. It's used
+// by scan_to_multi_pivot()'s sampled mode (see
+// Scan_Options::sample_fraction); documentation on the estimates
+// themselves is available within sample_estimator.cpp.
+
+#pragma once
+
+#include "pivot_compressors.h"
+#include <cstddef>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A group's estimated totals for one value field, along with the
+// half-width (margin) of each estimate's confidence interval:
+struct Sample_Estimate {
+  double sum{0.0};
+  double count{0.0};
+  double mean{0.0};
+  double sum_margin{0.0};
+  double count_margin{0.0};
+  double mean_margin{0.0};
+};
+
+class Sample_Estimator {
+public:
+  explicit Sample_Estimator(size_t value_count);
+
+  // Begins a new stratum that contains population_blocks blocks, of
+  // which sampled_blocks will be passed to add_block_group(). (Each
+  // stratum must be ended via end_stratum() before the next one
+  // begins.)
+  void begin_stratum(size_t population_blocks, size_t sampled_blocks);
+  // Adds a group's sums and counts within one sampled block of the
+  // current stratum. (This should be called at most once per group
+  // for each block; groups that a block doesn't contain are treated
+  // as having sums and counts of 0 within that block.)
+  void add_block_group(std::string_view pivot_index,
+                       const Pivot_Vals *pivot_vals);
+  void end_stratum();
+
+  size_t size() const { return groups_.size(); }
+
+  // Calls function(pivot_index, estimates) for each group (in
+  // alphabetical order), where estimates points to the group's
+  // value_count estimates. The margins correspond to confidence
+  // intervals at confidence_level (e.g. 0.95).
+  template <typename Function>
+  void for_each_sorted(double confidence_level, Function function) const {
+    double z = critical_value(confidence_level);
+    std::vector<Sample_Estimate> estimates(value_count_);
+    for (const auto &[pivot_index, group] : groups_) {
+      for (size_t vfi = 0; vfi < value_count_; vfi++) {
+        estimates[vfi] = estimate(totals_[group * value_count_ + vfi], z);
+      }
+      function(std::string_view(pivot_index), estimates.data());
+    }
+  }
+
+private:
+  // A group's estimated sum and count for one value field, along with
+  // the estimated variance of each, and their covariance (which is
+  // needed in order to estimate the variance of their ratio):
+  struct Field_Totals {
+    double sum{0.0};
+    double count{0.0};
+    double sum_variance{0.0};
+    double count_variance{0.0};
+    double covariance{0.0};
+  };
+  // A group's sums (of its per-block values) for one value field
+  // within the current stratum:
+  struct Stratum_Totals {
+    double sum{0.0};
+    double count{0.0};
+    double sum_squares{0.0};
+    double count_squares{0.0};
+    double sum_count_products{0.0};
+  };
+
+  static Sample_Estimate estimate(const Field_Totals &totals, double z);
+  // Returns the z value whose two-sided normal interval has the
+  // specified coverage.
+  static double normal_quantile(double confidence_level);
+  // Returns the multiplier for each margin of error: the quantile of
+  // Student's t distribution (with degrees of freedom equal to the
+  // number of sampled blocks minus the number of strata) that
+  // corresponds to confidence_level.
+  double critical_value(double confidence_level) const;
+
+  size_t value_count_;
+  // Each group's number; its totals begin at totals_[group *
+  // value_count_], and its current stratum's totals begin at the
+  // same position within stratum_totals_.
+  std::map<std::string, size_t, std::less<>> groups_;
+  std::vector<Field_Totals> totals_;
+  std::vector<Stratum_Totals> stratum_totals_;
+  // The groups that appeared within the current stratum:
+  std::vector<size_t> stratum_groups_;
+  std::vector<bool> in_stratum_;
+  size_t population_blocks_{0};
+  size_t sampled_blocks_{0};
+  // The total number of sampled blocks and strata so far:
+  size_t total_sampled_blocks_{0};
+  size_t stratum_count_{0};
+};
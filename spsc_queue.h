@@ -0,0 +1,130 @@
+// spsc_queue.h
+// Released under the MIT License
+
+// This header defines Spsc_Queue, a bounded single-producer,
+// single-consumer ring buffer that connects the stages of
+// scan_to_multi_pivot()'s pipelined mode (see pivot_compressors.cpp).
+// The ring's read and write positions are atomics, and each side
+// counts the threads that are waiting on it, so a push or pop that
+// doesn't need to wait (and that doesn't need to wake the other side)
+// never takes a lock; a mutex and condition variable are only used to
+// put a stage to sleep while its queue is full (or empty) and to wake
+// it up again. Since each item is a large
+// block or batch of rows, these waits are rare relative to the work
+// that each item represents.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+template <typename T> class Spsc_Queue {
+public:
+  // capacity: the number of items that can wait within the queue
+  // before push() blocks.
+  explicit Spsc_Queue(size_t capacity) : slots_(capacity) {}
+
+  // Adds value to the queue, first waiting while the queue is full.
+  // Returns false (without adding value) if the queue was cancelled.
+  // Only one thread may call push() and close().
+  bool push(T value) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (wait_until([&] {
+          return tail - head_.load(std::memory_order_acquire) < slots_.size();
+        }) == false) {
+      return false;
+    }
+    slots_[tail % slots_.size()] = std::move(value);
+    tail_.store(tail + 1, std::memory_order_release);
+    notify();
+    return true;
+  }
+
+  // Moves the oldest item within the queue into value, first waiting
+  // while the queue is empty. Returns false once the queue has been
+  // closed and emptied (or if it was cancelled). Only one thread may
+  // call pop().
+  bool pop(T &value) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (wait_until([&] {
+          return (tail_.load(std::memory_order_acquire) != head) ||
+                 closed_.load(std::memory_order_acquire);
+        }) == false) {
+      return false;
+    }
+    if (tail_.load(std::memory_order_acquire) == head) {
+      return false; // The queue was closed, and it's now empty.
+    }
+    value = std::move(slots_[head % slots_.size()]);
+    head_.store(head + 1, std::memory_order_release);
+    notify();
+    return true;
+  }
+
+  // Indicates that no more items will be pushed; pop() will return
+  // false once the remaining items have been removed.
+  void close() {
+    closed_.store(true, std::memory_order_release);
+    notify();
+  }
+
+  // Makes all current and future push() and pop() calls return false,
+  // so that neither thread stays blocked once the other one has
+  // stopped (e.g. because of an exception or a row limit).
+  void cancel() {
+    cancelled_.store(true, std::memory_order_release);
+    notify();
+  }
+
+private:
+  // Waits until ready() returns true, then returns true, unless the
+  // queue gets cancelled first.
+  template <typename Predicate> bool wait_until(Predicate ready) {
+    if (cancelled_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    if (ready()) {
+      return true;
+    }
+    std::unique_lock lock(mutex_);
+    // (The fence keeps the condition from being rechecked before the
+    // waiter count has been raised; see notify().)
+    waiters_.fetch_add(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    condition_.wait(lock, [&] {
+      return cancelled_.load(std::memory_order_acquire) || ready();
+    });
+    waiters_.fetch_sub(1);
+    return !cancelled_.load(std::memory_order_acquire);
+  }
+
+  // Wakes the other thread if it's waiting. The fence pairs with the
+  // one in wait_until(): either the waiter sees the change that was
+  // just made, or this thread sees the waiter. (Briefly acquiring the
+  // mutex then ensures that a waiter that has just found its condition
+  // to be false will already be waiting by the time it's notified.)
+  void notify() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiters_.load(std::memory_order_relaxed) == 0) {
+      return;
+    }
+    { std::lock_guard lock(mutex_); }
+    condition_.notify_all();
+  }
+
+  std::vector<T> slots_;
+  // The number of items that have been popped and pushed so far:
+  std::atomic<size_t> head_{0};
+  std::atomic<size_t> tail_{0};
+  std::atomic<bool> closed_{false};
+  std::atomic<bool> cancelled_{false};
+  // The number of threads that are waiting (or about to wait) on
+  // condition_:
+  std::atomic<int> waiters_{0};
+  std::mutex mutex_;
+  std::condition_variable condition_;
+};
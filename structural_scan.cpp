@@ -0,0 +1,135 @@
+// structural_scan.cpp
+// Released under the MIT License
+
+/* Splitting a .csv line into fields requires finding each delimiter
+and quote character within it. Checking one character at a time (or
+calling memchr() once per field, which carries a fair amount of
+overhead for the short fields found within the BTS datasets) makes
+this step the main bottleneck of a projected scan.
+
+The kernels defined here instead compare 64 bytes at a time against
+both characters and return the results as a bitmask; Column_Projection
+then walks through the set bits (via std::countr_zero) to find each
+field boundary. The best available kernel gets chosen at runtime:
+
+1. On x86-64 CPUs that support AVX2, two 32-byte comparisons are
+performed per chunk. (This kernel is compiled via a target attribute,
+so the rest of the program doesn't need to be built with -mavx2.)
+
+2. Other x86-64 CPUs use SSE2 (which all of them support), performing
+four 16-byte comparisons per chunk.
+
+3. ARM64 CPUs use NEON, also performing four 16-byte comparisons.
+
+4. All other platforms (and compilers other than GCC and Clang) use a
+portable scalar kernel. */
+
+#include "structural_scan.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define STRUCTURAL_SCAN_X86
+#include <immintrin.h>
+#elif defined(__GNUC__) && defined(__aarch64__)
+#define STRUCTURAL_SCAN_NEON
+#include <arm_neon.h>
+#endif
+
+static uint64_t scalar_kernel(const char *chunk, char delimiter,
+                              char quote_char) {
+  uint64_t mask = 0;
+  for (int i = 0; i < structural_chunk_bytes; i++) {
+    if ((chunk[i] == delimiter) || (chunk[i] == quote_char)) {
+      mask |= uint64_t(1) << i;
+    }
+  }
+  return mask;
+}
+
+#if defined(STRUCTURAL_SCAN_X86)
+
+__attribute__((target("avx2"))) static uint64_t
+avx2_kernel(const char *chunk, char delimiter, char quote_char) {
+  __m256i delimiters = _mm256_set1_epi8(delimiter);
+  __m256i quotes = _mm256_set1_epi8(quote_char);
+  uint64_t mask = 0;
+  for (int offset = 0; offset < structural_chunk_bytes; offset += 32) {
+    __m256i bytes =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(chunk + offset));
+    __m256i matches = _mm256_or_si256(_mm256_cmpeq_epi8(bytes, delimiters),
+                                      _mm256_cmpeq_epi8(bytes, quotes));
+    mask |= uint64_t(uint32_t(_mm256_movemask_epi8(matches))) << offset;
+  }
+  return mask;
+}
+
+__attribute__((target("sse2"))) static uint64_t
+sse2_kernel(const char *chunk, char delimiter, char quote_char) {
+  __m128i delimiters = _mm_set1_epi8(delimiter);
+  __m128i quotes = _mm_set1_epi8(quote_char);
+  uint64_t mask = 0;
+  for (int offset = 0; offset < structural_chunk_bytes; offset += 16) {
+    __m128i bytes =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(chunk + offset));
+    __m128i matches = _mm_or_si128(_mm_cmpeq_epi8(bytes, delimiters),
+                                   _mm_cmpeq_epi8(bytes, quotes));
+    mask |= uint64_t(uint16_t(_mm_movemask_epi8(matches))) << offset;
+  }
+  return mask;
+}
+
+#elif defined(STRUCTURAL_SCAN_NEON)
+
+static uint64_t neon_kernel(const char *chunk, char delimiter,
+                            char quote_char) {
+  // NEON lacks a movemask instruction, so each matching byte (0xFF)
+  // gets ANDed with its bit's weight within its half of the vector;
+  // each half's weights then get summed into one byte of the mask.
+  static const uint8_t bit_weights[16] = {1, 2, 4, 8, 16, 32, 64, 128,
+                                          1, 2, 4, 8, 16, 32, 64, 128};
+  uint8x16_t weights = vld1q_u8(bit_weights);
+  uint8x16_t delimiters = vdupq_n_u8(uint8_t(delimiter));
+  uint8x16_t quotes = vdupq_n_u8(uint8_t(quote_char));
+  uint64_t mask = 0;
+  for (int offset = 0; offset < structural_chunk_bytes; offset += 16) {
+    uint8x16_t bytes =
+        vld1q_u8(reinterpret_cast<const uint8_t *>(chunk + offset));
+    uint8x16_t matches =
+        vorrq_u8(vceqq_u8(bytes, delimiters), vceqq_u8(bytes, quotes));
+    uint8x16_t weighted = vandq_u8(matches, weights);
+    uint64_t low_bits = vaddv_u8(vget_low_u8(weighted));
+    uint64_t high_bits = vaddv_u8(vget_high_u8(weighted));
+    mask |= (low_bits | (high_bits << 8)) << offset;
+  }
+  return mask;
+}
+
+#endif
+
+struct Kernel_Choice {
+  Structural_Kernel kernel;
+  const char *name;
+};
+
+static Kernel_Choice choose_kernel() {
+#if defined(STRUCTURAL_SCAN_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return {avx2_kernel, "avx2"};
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return {sse2_kernel, "sse2"};
+  }
+#elif defined(STRUCTURAL_SCAN_NEON)
+  return {neon_kernel, "neon"};
+#endif
+  return {scalar_kernel, "scalar"};
+}
+
+static const Kernel_Choice &kernel_choice() {
+  static const Kernel_Choice choice = choose_kernel();
+  return choice;
+}
+
+Structural_Kernel structural_kernel() { return kernel_choice().kernel; }
+
+const char *structural_kernel_name() { return kernel_choice().name; }
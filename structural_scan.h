@@ -0,0 +1,26 @@
+// structural_scan.h
+// Released under the MIT License
+
+// This header declares the vectorized kernels that Column_Projection
+// uses to locate delimiters and quotes within each line. Documentation
+// on these kernels is available within structural_scan.cpp.
+
+#pragma once
+
+#include <cstdint>
+
+// The number of bytes that a Structural_Kernel examines per call:
+constexpr int structural_chunk_bytes = 64;
+
+// A function that returns a bitmask whose bit i is set if chunk[i]
+// equals either delimiter or quote_char. All structural_chunk_bytes
+// bytes starting at chunk must be readable.
+using Structural_Kernel = uint64_t (*)(const char *chunk, char delimiter,
+                                       char quote_char);
+
+// Returns the fastest kernel that the current CPU supports. (This
+// check is only performed once.)
+Structural_Kernel structural_kernel();
+
+// The name of the kernel returned by structural_kernel() (e.g. "avx2"):
+const char *structural_kernel_name();